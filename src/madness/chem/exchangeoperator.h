@@ -180,6 +180,7 @@ private:
             /// \return the priority as double number (no limits)
             double compute_priority(const Batch& batch) const override {
                 MADNESS_CHECK(batch.input.size() == 2);   // must be quadratic batches
+                if (not (cost1.empty() and cost2.empty())) return estimated_cost(batch);
                 long nrow = batch.input[0].size();
                 long ncol = batch.input[1].size();
                 return double(nrow * ncol);
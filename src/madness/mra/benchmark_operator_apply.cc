@@ -0,0 +1,314 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+
+  $Id$
+*/
+
+/// \file mra/benchmark_operator_apply.cc
+/// \brief Times SeparatedConvolution::apply and the kernels below it, reported as JSON
+
+/// Usage: benchmark_operator_apply [--small] [--output=file] [--min_time=seconds]
+///                                 [--peak_gflops=x] [--peak_gbs=y]
+///
+/// Every record holds the time per call, the flops and bytes of one call,
+/// the achieved rates and the fraction of the roofline bound
+/// min(peak_gflops, intensity*peak_gbs).  Unless given on the command line
+/// the peaks are measured: flops as the best rate of mTxmq on an in-cache
+/// (1024,24)x(24,24) product and bandwidth as a triad over arrays much
+/// larger than the caches.  Flops and bytes are models, see "models" in
+/// the output; for apply() the flops assume every term above tol is applied
+/// at full rank, so its rates are upper bounds.  Results go to stdout
+/// unless --output is given.
+
+#include <madness/mra/mra.h>
+#include <madness/mra/operator.h>
+#include <madness/tensor/aligned.h>
+#include <madness/external/nlohmann_json/json.hpp>
+
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+
+using namespace madness;
+using json = nlohmann::json;
+
+namespace {
+
+    struct Machine {
+        double gflops;      ///< peak flop rate
+        double gbs;         ///< peak memory bandwidth
+        std::string source; ///< "measured" or "user"
+    };
+
+    double min_time = 0.2;
+
+    /// Seconds per call of \c f, repeated until min_time has passed
+    double time_per_call(const std::function<void()>& f, long& ncall) {
+        f();    // warm up caches and operator data
+        ncall = 0;
+        const double start = wall_time();
+        double used;
+        do {
+            f();
+            ++ncall;
+            used = wall_time() - start;
+        } while (used < min_time);
+        return used/ncall;
+    }
+
+    json make_record(const std::string& name, const json& params, const std::function<void()>& f,
+                     double flops, double bytes, const Machine& machine) {
+        long ncall;
+        const double seconds = time_per_call(f, ncall);
+        const double gflops = 1e-9*flops/seconds;
+        const double gbs = 1e-9*bytes/seconds;
+        const double intensity = flops/bytes;
+        const double bound = std::min(machine.gflops, intensity*machine.gbs);
+        json r = params;
+        r["name"] = name;
+        r["calls"] = ncall;
+        r["seconds_per_call"] = seconds;
+        r["flops"] = flops;
+        r["bytes"] = bytes;
+        r["gflops"] = gflops;
+        r["gbytes_per_s"] = gbs;
+        r["intensity"] = intensity;
+        r["roofline_gflops"] = bound;
+        r["fraction_of_peak"] = gflops/bound;
+        return r;
+    }
+
+    Machine measure_machine() {
+        Machine m;
+        m.source = "measured";
+
+        const long dimi = 1024, dimj = 24;
+        Tensor<double> a(dimj, dimi), b(dimj, dimj), c(dimi, dimj);
+        a.fillrandom();
+        b.fillrandom();
+        long ncall;
+        double best = 0.0;
+        for (int rep=0; rep<3; ++rep) {
+            const double t = time_per_call([&]() { mTxmq(dimi, dimj, dimj, c.ptr(), a.ptr(), b.ptr()); }, ncall);
+            best = std::max(best, 2e-9*dimi*dimj*dimj/t);
+        }
+        m.gflops = best;
+
+        const long n = 1L<<23;     // 3 x 64 MB
+        std::vector<double> x(n, 1.0), y(n, 2.0), z(n, 0.0);
+        best = 0.0;
+        for (int rep=0; rep<3; ++rep) {
+            const double t = time_per_call([&]() {
+                    double* MADNESS_RESTRICT pz = z.data();
+                    const double* px = x.data();
+                    const double* py = y.data();
+                    for (long i=0; i<n; ++i) pz[i] = px[i] + 3.0*py[i];
+                }, ncall);
+            best = std::max(best, 24e-9*n/t);
+        }
+        m.gbs = best;
+        return m;
+    }
+
+    double ipow(long k, std::size_t n) {
+        double r = 1.0;
+        for (std::size_t i=0; i<n; ++i) r *= k;
+        return r;
+    }
+
+    /// mTxmq, fast_transform and aligned_axpy on the shapes of a (2k)^3 apply
+    void bench_kernels(long k, const Machine& machine, json& results) {
+        const long twok = 2*k;
+        const long dimi = twok*twok;
+        const json params = {{"k", k}, {"ndim", 3}};
+
+        Tensor<double> a(twok, dimi), b(twok, twok), c(dimi, twok);
+        a.fillrandom();
+        b.fillrandom();
+        results.push_back(make_record("mTxmq", params,
+                                      [&]() { mTxmq(dimi, twok, twok, c.ptr(), a.ptr(), b.ptr()); },
+                                      2.0*dimi*twok*twok, 8.0*(2*dimi*twok + twok*twok), machine));
+
+        Tensor<double> t(twok, twok, twok), r(twok, twok, twok), w(twok, twok, twok);
+        t.fillrandom();
+        results.push_back(make_record("fast_transform", params,
+                                      [&]() { fast_transform(t, b, r, w); },
+                                      3*2.0*ipow(twok,4), 8.0*(2*ipow(twok,3) + twok*twok), machine));
+
+        const long n = t.size();
+        results.push_back(make_record("aligned_axpy", params,
+                                      [&]() { aligned_axpy(n, r.ptr(), t.ptr(), 0.5); },
+                                      2.0*n, 24.0*n, machine));
+    }
+
+    /// filter and unfilter of a FunctionImpl<double,NDIM>
+    template <std::size_t NDIM>
+    void bench_twoscale(World& world, long k, const Machine& machine, json& results) {
+        FunctionDefaults<NDIM>::set_k(k);
+        Function<double,NDIM> f = FunctionFactory<double,NDIM>(world).empty();
+        const auto& impl = *f.get_impl();
+
+        const std::vector<long> v2k(NDIM, 2*k);
+        Tensor<double> s(v2k);
+        s.fillrandom();
+        const json params = {{"k", k}, {"ndim", NDIM}};
+        const double flops = NDIM*2.0*ipow(2*k, NDIM+1);
+        const double bytes = 8.0*(2*ipow(2*k, NDIM) + 4*k*k);
+        results.push_back(make_record("filter", params, [&]() { impl.filter(s); }, flops, bytes, machine));
+        results.push_back(make_record("unfilter", params, [&]() { impl.unfilter(s); }, flops, bytes, machine));
+    }
+
+    /// SeparatedConvolution::apply to random (2k)^NDIM coefficients at level 4, for the zero and a unit displacement
+    template <std::size_t NDIM>
+    void bench_apply(World& world, const std::string& kernel, const SeparatedConvolution<double,NDIM>& op,
+                     double thresh, const Machine& machine, json& results) {
+        const long k = op.get_k();
+        const std::vector<long> v2k(NDIM, 2*k);
+        Tensor<double> coeff(v2k);
+        coeff.fillrandom();
+        const Key<NDIM> source(4, Vector<Translation,NDIM>(8));
+
+        for (int disp=0; disp<2; ++disp) {
+            Vector<Translation,NDIM> l(0);
+            l[0] = disp;
+            const Key<NDIM> shift(4, l);
+
+            const json params = {{"kernel", kernel}, {"k", k}, {"ndim", NDIM}, {"thresh", thresh},
+                                 {"displacement", disp}, {"rank", op.get_rank()}};
+            const double flops = op.get_rank()*NDIM*2.0*(ipow(2*k, NDIM+1) + ipow(k, NDIM+1));
+            const double bytes = 8.0*(2*ipow(2*k, NDIM) + op.get_rank()*NDIM*(4*k*k + k*k));
+            results.push_back(make_record("apply", params,
+                                          [&]() { op.apply(source, shift, coeff, thresh); },
+                                          flops, bytes, machine));
+        }
+    }
+
+    template <std::size_t NDIM>
+    void bench_apply_ndim(World& world, const std::vector<long>& ks, const std::vector<double>& threshs,
+                          const Machine& machine, json& results) {
+        FunctionDefaults<NDIM>::set_cubic_cell(-20, 20);
+        for (long k : ks) {
+            FunctionDefaults<NDIM>::set_k(k);
+            for (double thresh : threshs) {
+                FunctionDefaults<NDIM>::set_thresh(thresh);
+                const double lo = 1e-4;
+                if constexpr (NDIM == 3) {
+                    bench_apply<NDIM>(world, "coulomb", CoulombOperator(world, lo, thresh), thresh, machine, results);
+                }
+                bench_apply<NDIM>(world, "bsh", BSHOperator<NDIM>(world, 1.0, lo, thresh), thresh, machine, results);
+                bench_apply<NDIM>(world, "slater", SlaterOperator<NDIM>(world, 1.0, lo, thresh), thresh, machine, results);
+            }
+            bench_twoscale<NDIM>(world, k, machine, results);
+        }
+    }
+
+}
+
+int main(int argc, char** argv) {
+    World& world = initialize(argc, argv, true);
+    int status = 0;
+    try {
+        startup(world, argc, argv);
+
+        // --key=value or --key
+        std::map<std::string, std::string> args;
+        for (int i=1; i<argc; ++i) {
+            if (std::strncmp(argv[i], "--", 2) != 0) continue;
+            const std::string a(argv[i]+2);
+            const std::size_t eq = a.find('=');
+            args[a.substr(0, eq)] = (eq == std::string::npos) ? "" : a.substr(eq+1);
+        }
+        const bool small = args.count("small") || getenv("MAD_SMALL_TESTS");
+        if (small) min_time = 0.02;
+        if (args.count("min_time")) min_time = std::stod(args["min_time"]);
+
+        Machine machine = measure_machine();
+        if (args.count("peak_gflops")) {
+            machine.gflops = std::stod(args["peak_gflops"]);
+            machine.source = "user";
+        }
+        if (args.count("peak_gbs")) {
+            machine.gbs = std::stod(args["peak_gbs"]);
+            machine.source = "user";
+        }
+
+        // ks and thresholds; 4-6 dimensional applies are restricted to small k
+        const std::vector<long> ks = small ? std::vector<long>{6} : std::vector<long>{6, 8, 10, 12};
+        const std::vector<long> ks_high = {4};
+        const std::vector<double> threshs = small ? std::vector<double>{1e-4} : std::vector<double>{1e-4, 1e-6};
+
+        json results = json::array();
+        for (long k : ks) bench_kernels(k, machine, results);
+        bench_apply_ndim<1>(world, ks, threshs, machine, results);
+        bench_apply_ndim<2>(world, ks, threshs, machine, results);
+        bench_apply_ndim<3>(world, ks, threshs, machine, results);
+        bench_apply_ndim<4>(world, ks_high, {1e-4}, machine, results);
+        if (!small) {
+            bench_apply_ndim<5>(world, ks_high, {1e-4}, machine, results);
+            bench_apply_ndim<6>(world, ks_high, {1e-4}, machine, results);
+        }
+
+        json out;
+        out["benchmark"] = "operator_apply";
+        out["nthreads"] = ThreadPool::size() + 1;
+        out["machine"] = {{"peak_gflops", machine.gflops}, {"peak_gbytes_per_s", machine.gbs},
+                          {"source", machine.source}};
+#ifdef HAVE_X86_MTXMQ
+        out["mtxmq_kernel"] = detail::mTxmq_x86_kernel_name();
+#endif
+        out["models"] = {
+            {"mTxmq", "flops 2*dimi*dimj*dimk; bytes a, b and c once"},
+            {"fast_transform", "flops 2*ndim*(2k)^(ndim+1); bytes input, result and matrix once"},
+            {"filter", "as fast_transform"},
+            {"aligned_axpy", "flops 2n; bytes 3n doubles"},
+            {"apply", "flops as if all rank terms were applied at full rank (R and T parts); "
+                      "bytes input, result and all 1-d matrices once"}};
+        out["results"] = results;
+
+        if (world.rank() == 0) {
+            if (args.count("output")) {
+                std::ofstream f(args["output"]);
+                f << out.dump(2) << std::endl;
+            }
+            else {
+                std::cout << out.dump(2) << std::endl;
+            }
+        }
+        world.gop.fence();
+    }
+    catch (const std::exception& e) {
+        std::cerr << "benchmark_operator_apply: " << e.what() << std::endl;
+        status = 1;
+    }
+    finalize();
+    return status;
+}
@@ -37,12 +37,14 @@
 #include <limits.h>
 #include <madness/tensor/tensor.h>
 #include <madness/mra/simplecache.h>
+#include <madness/mra/operatorcache.h>
 #include <madness/mra/adquad.h>
 #include <madness/mra/twoscale.h>
 #include <madness/tensor/aligned.h>
 #include <madness/tensor/tensor_lapack.h>
 #include <madness/misc/kahan_accumulator.h>
 #include <algorithm>
+#include <atomic>
 
 /// \file mra/convolution1d.h
 /// \brief Computes most matrix elements over 1D operators (including Gaussians)
@@ -173,6 +175,11 @@ namespace madness {
         double N_up, N_diff, N_F;               ///< the norms according to Beylkin 2008, Eq. (21) ff
 
 
+        /// ctor for deserialization (see append_to() and extract_from())
+        ConvolutionData1D() : Rnorm(0.0), Tnorm(0.0), Rnormf(0.0), Tnormf(0.0), NSnormf(0.0),
+                              N_up(0.0), N_diff(0.0), N_F(0.0) {}
+
+
         /// ctor for NS form
         /// make the operator matrices r^n and \uparrow r^(n-1)
         /// @param[in]  R   operator matrix of the requested level;     NS: unfilter(r^(n+1)); modified NS: r^n
@@ -224,6 +231,28 @@ namespace madness {
 
 
 
+        /// append all matrices and norms to \c buf in the format of the operator cache file
+        void append_to(OperatorCacheFile::bytesT& buf) const {
+            for (const Tensor<Q>* t : {&R, &T, &RU, &RVT, &TU, &TVT}) OperatorCacheFile::append_tensor(buf, *t);
+            OperatorCacheFile::append_tensor(buf, Rs);
+            OperatorCacheFile::append_tensor(buf, Ts);
+            const double norms[8] = {Rnorm, Tnorm, Rnormf, Tnormf, NSnormf, N_up, N_diff, N_F};
+            OperatorCacheFile::append(buf, norms, 8);
+        }
+
+        /// inverse of append_to(), returns false if the record of \c nbyte bytes at \c p is malformed
+        static bool extract_from(const unsigned char* p, std::size_t nbyte, ConvolutionData1D& d) {
+            const unsigned char* end = p + nbyte;
+            for (Tensor<Q>* t : {&d.R, &d.T, &d.RU, &d.RVT, &d.TU, &d.TVT})
+                if (!OperatorCacheFile::extract_tensor(p, end, *t)) return false;
+            double norms[8];
+            if (!OperatorCacheFile::extract_tensor(p, end, d.Rs) || !OperatorCacheFile::extract_tensor(p, end, d.Ts)
+                || !OperatorCacheFile::extract(p, end, norms, 8) || p != end) return false;
+            d.Rnorm = norms[0]; d.Tnorm = norms[1]; d.Rnormf = norms[2]; d.Tnormf = norms[3];
+            d.NSnormf = norms[4]; d.N_up = norms[5]; d.N_diff = norms[6]; d.N_F = norms[7];
+            return true;
+        }
+
         /// approximate the operator matrices using SVD, and abuse Rs to hold the error instead of
         /// the singular values (seriously, who named this??)
         void make_approx(const Tensor<Q>& R,
@@ -274,11 +303,86 @@ namespace madness {
         mutable SimpleCache<ConvolutionData1D<Q>, 1> ns_cache;
         mutable SimpleCache<ConvolutionData1D<Q>, 2> mod_ns_cache;
 
+    private:
+        // record kinds in the operator cache file
+        enum {rnlp_record=0, ns_record=1};
+
+        OperatorCacheFile::bytesT cache_params;         ///< parameters identifying this kernel, empty if it cannot be cached
+        std::shared_ptr<const OperatorCacheFile> cache_file_holder;     ///< keeps cache_file mapped
+        std::atomic<const OperatorCacheFile*> cache_file{nullptr};      ///< records of earlier runs, null if not attached
+        std::int64_t cache_file_aux = 0;                ///< aux field of the records of this kernel in cache_file
+        mutable std::atomic<bool> cache_file_dirty{false};  ///< computed records that are not in the file
+
+        const unsigned char* find_record(int kind, Level n, Translation lx, std::size_t& nbyte) const {
+            const OperatorCacheFile* file = cache_file.load(std::memory_order_acquire);
+            if (!file) return nullptr;
+            return file->find(OperatorCacheFile::RecordKey{kind, n, lx, cache_file_aux}, nbyte);
+        }
+
+    protected:
+        /// Makes this kernel eligible for the operator cache file, if enabled
+
+        /// Derived classes call this at the end of their constructor with the
+        /// kernel family and the bytes of all parameters that determine the
+        /// matrix elements; the parameters of this class are appended here.
+        /// The file itself belongs to the operator, see attach_cache_file().
+        void set_cache_params(const std::string& tag, const OperatorCacheFile::bytesT& params) {
+            if (OperatorCacheFile::directory().empty()) return;
+            cache_params.assign(tag.begin(), tag.end());
+            cache_params.push_back(0);
+            cache_params.insert(cache_params.end(), params.begin(), params.end());
+            const int qsize = sizeof(Q);
+            const hashT rhash = range.hash();
+            OperatorCacheFile::append(cache_params, &qsize);
+            OperatorCacheFile::append(cache_params, &k);
+            OperatorCacheFile::append(cache_params, &npt);
+            OperatorCacheFile::append(cache_params, &maxR);
+            OperatorCacheFile::append(cache_params, &bloch_k);
+            OperatorCacheFile::append(cache_params, &rhash);
+        }
+
+    public:
         bool lattice_summed() const { return maxR != 0; }
         bool range_restricted() const { return range.finite(); }
 
         virtual ~Convolution1D() {};
 
+        /// Parameters identifying this kernel in an operator cache file, empty if it cannot be cached
+        const OperatorCacheFile::bytesT& get_cache_params() const { return cache_params; }
+
+        /// Warm-starts the caches from \c file, where the records of this kernel carry \c aux
+
+        /// Kernels are shared between operators, and only the first file
+        /// attached is used.
+        void attach_cache_file(const std::shared_ptr<const OperatorCacheFile>& file, std::int64_t aux) {
+            static Mutex mutex;
+            ScopedMutex<Mutex> obolus(mutex);
+            if (cache_params.empty() || cache_file.load()) return;
+            cache_file_holder = file;
+            cache_file_aux = aux;
+            cache_file.store(file.get(), std::memory_order_release);
+        }
+
+        /// True if matrices were computed that are not in the attached file
+        bool has_unsaved_records() const { return cache_file_dirty; }
+
+        /// Marks the matrices computed so far as saved
+        void set_records_saved() const { cache_file_dirty = false; }
+
+        /// Adds the cached rnlp and NS matrices to \c records under \c aux
+
+        /// Not safe against concurrent modification of the caches.
+        void append_cache_records(OperatorCacheFile::recordsT& records, std::int64_t aux) const {
+            for (const auto& [key, r] : rnlp_cache) {
+                auto& buf = records[OperatorCacheFile::RecordKey{rnlp_record, key.level(), key.translation()[0], aux}];
+                OperatorCacheFile::append_tensor(buf, r);
+            }
+            for (const auto& [key, d] : ns_cache) {
+                auto& buf = records[OperatorCacheFile::RecordKey{ns_record, key.level(), key.translation()[0], aux}];
+                d.append_to(buf);
+            }
+        }
+
         Convolution1D(int k, int npt, int maxR,
                       double bloch_k = 0.0,
                       KernelRange rng = {})
@@ -467,6 +571,16 @@ namespace madness {
             const ConvolutionData1D<Q>* p = ns_cache.getptr(n,lx);
             if (p) return p;
 
+            std::size_t nbyte;
+            if (const unsigned char* rec = find_record(ns_record, n, lx, nbyte)) {
+                ConvolutionData1D<Q> d;
+                if (ConvolutionData1D<Q>::extract_from(rec, nbyte, d) and d.R.ndim()==2 and d.R.dim(0)==2*k) {
+                    ns_cache.set(n,lx,std::move(d));
+                    return ns_cache.getptr(n,lx);
+                }
+            }
+            if (!cache_params.empty()) cache_file_dirty = true;
+
             // PROFILE_MEMBER_FUNC(Convolution1D); // Too fine grain for routine profiling
 
             Tensor<Q> R, T;
@@ -545,6 +659,16 @@ namespace madness {
             long twok = 2*k;
             Tensor<Q> r;
 
+            std::size_t nbyte;
+            if (const unsigned char* rec = find_record(rnlp_record, n, lx, nbyte)) {
+                const unsigned char* end = rec + nbyte;
+                if (OperatorCacheFile::extract_tensor(rec, end, r) and rec == end and r.ndim() == 1 and r.dim(0) == twok) {
+                    rnlp_cache.set(n, lx, r);
+                    return *rnlp_cache.getptr(n,lx);
+                }
+            }
+            if (!cache_params.empty()) cache_file_dirty = true;
+
             if (get_issmall(n, lx)) {
                 r = Tensor<Q>(twok);
             }
@@ -762,6 +886,11 @@ namespace madness {
             , m(m)
         {
             MADNESS_ASSERT(m>=0 && m<=2);
+            OperatorCacheFile::bytesT params;
+            OperatorCacheFile::append(params, &coeff);
+            OperatorCacheFile::append(params, &expnt);
+            OperatorCacheFile::append(params, &m);
+            this->set_cache_params("gauss", params);
             // std::cout << "GC expnt=" << expnt << " coeff="  << coeff << " natlev=" << natlev << " maxR=" << maxR(periodic,expnt) << std::endl;
             // for (Level n=0; n<5; n++) {
             //     for (Translation l=0; l<(1<<n); l++) {
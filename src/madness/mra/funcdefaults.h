@@ -114,6 +114,8 @@ namespace madness {
         static bool truncate_on_project; ///< If true initial projection inserts at n-1 not n
         static bool apply_randomize;   ///< If true use randomization for load balancing in apply integral operator
         static bool project_randomize; ///< If true use randomization for load balancing in project/refine
+        static bool tensor_slab;       ///< If true tensors of the coefficient sizes come from the slab allocator
+        static int traversal_batch;    ///< Max number of local tree nodes a traversal task visits
         static std::optional<BoundaryConditions<NDIM>> bc; ///< Default boundary conditions, not initialized by default and must be set explicitly before use
         static Tensor<double> cell ;   ///< cell[NDIM][2] Simulation cell, cell(0,0)=xlo, cell(0,1)=xhi, ...
         static Tensor<double> cell_width;///< Width of simulation cell in each dimension
@@ -170,6 +172,7 @@ namespace madness {
         static void set_k(int value) {
         	k=value;
         	MADNESS_ASSERT(k>0 && k<=MAXK);
+        	if (tensor_slab) add_tensor_slab_sizes();
         }
 
         /// Returns the default threshold
@@ -306,6 +309,53 @@ namespace madness {
         	project_randomize=value;
         }
 
+        /// Gets the slab allocator flag for tensors
+        static bool get_tensor_slab() {
+        	return tensor_slab;
+        }
+
+        /// Sets the slab allocator flag for tensors
+
+        /// If true, real and complex tensors of size k^NDIM and (2k)^NDIM for
+        /// the default k are allocated from thread-local free lists (see
+        /// TensorSlabAllocator).  The allocator is shared by all dimensions, so
+        /// this turns it on or off globally; sizes registered for other
+        /// dimensions are kept.
+        static void set_tensor_slab(bool value) {
+        	tensor_slab=value;
+        	if (value) add_tensor_slab_sizes();
+        	TensorSlabAllocator::enable(value);
+        }
+
+        /// Gets the number of tree nodes a traversal task may visit
+        static int get_traversal_batch() {
+        	return traversal_batch;
+        }
+
+        /// Sets the number of tree nodes a traversal task may visit
+
+        /// Tree traversals such as norm_tree, sum_down, trickle_down and
+        /// truncate normally spawn one task per node.  With a batch of n>1
+        /// a task also visits locally owned children itself, depth first,
+        /// until it has visited n nodes; the remaining children, and those
+        /// owned by other processes, get their own tasks.  Existing
+        /// functions are unaffected.
+        static void set_traversal_batch(int value) {
+        	traversal_batch=std::max(value,1);
+        }
+
+        /// Registers the coefficient sizes for the default k with the slab allocator
+        static void add_tensor_slab_sizes() {
+        	std::size_t n=1, n2=1;
+        	for (std::size_t d=0; d<NDIM; ++d) {
+        		n *= k;
+        		n2 *= 2*k;
+        	}
+        	for (std::size_t nbyte : {n*sizeof(double), n2*sizeof(double),
+        	                          n*sizeof(double_complex), n2*sizeof(double_complex)})
+        		TensorSlabAllocator::add_size(nbyte);
+        }
+
         /// Returns the default boundary conditions
         static const BoundaryConditions<NDIM>& get_bc() {
           if (!bc.has_value()) {
@@ -52,6 +52,7 @@
 
 #include <array>
 #include <iostream>
+#include <set>
 #include <type_traits>
 
 namespace madness {
@@ -978,6 +979,7 @@ template<size_t NDIM>
         int truncate_mode; ///< 0=default=(|d|<thresh), 1=(|d|<thresh/2^n), 2=(|d|<thresh/4^n);
         bool autorefine; ///< If true, autorefine where appropriate
         bool truncate_on_project; ///< If true projection inserts at level n-1 not n
+        int traversal_batch; ///< Max number of local nodes a traversal task visits
         TensorArgs targs; ///< type of tensor to be used in the FunctionNodes
 
         const FunctionCommonData<T,NDIM>& cdata;
@@ -1013,6 +1015,7 @@ template<size_t NDIM>
             , truncate_mode(factory._truncate_mode)
             , autorefine(factory._autorefine)
             , truncate_on_project(factory._truncate_on_project)
+            , traversal_batch(FunctionDefaults<NDIM>::get_traversal_batch())
 //		  , nonstandard(false)
             , targs(factory._thresh,FunctionDefaults<NDIM>::get_tensor_type())
             , cdata(FunctionCommonData<T,NDIM>::get(k))
@@ -1050,7 +1053,7 @@ template<size_t NDIM>
                 for (typename dcT::const_iterator it=coeffs.begin(); it!=end; ++it) {
                     if (it->second.is_leaf())
                         woT::task(coeffs.owner(it->first), &implT::project_refine_op, it->first, do_refine,
-                                  special_points);
+                                  special_points, numa_attr(it->first));
                 }
             }
             else { // Set as if a zero function
@@ -1084,6 +1087,7 @@ template<size_t NDIM>
                 , truncate_mode(other.truncate_mode)
                 , autorefine(other.autorefine)
                 , truncate_on_project(other.truncate_on_project)
+                , traversal_batch(other.traversal_batch)
                 , targs(other.targs)
                 , cdata(FunctionCommonData<T,NDIM>::get(k))
                 , functor()
@@ -1303,6 +1307,12 @@ template<size_t NDIM>
 
         void set_autorefine(bool value);
 
+        /// Returns the number of tree nodes a traversal task may visit (see FunctionDefaults)
+        int get_traversal_batch() const;
+
+        /// Sets the number of tree nodes a traversal task may visit (see FunctionDefaults)
+        void set_traversal_batch(int value);
+
         int get_k() const;
 
         const dcT& get_coeffs() const;
@@ -1343,6 +1353,9 @@ template<size_t NDIM>
         /// @param[in]  key   the key of the current function node
         Future<bool> truncate_spawn(const keyT& key, double tol);
 
+        /// truncate_spawn visiting up to budget locally owned nodes in this task
+        Future<bool> truncate_batch(const keyT& key, double tol, long& budget);
+
         /// Actually do the truncate operation
         /// @param[in] key the key to the current function node being evaluated for truncation
         /// @param[in] tol the tolerance for thresholding
@@ -1680,6 +1693,19 @@ template<size_t NDIM>
         /// @param[in] child the key to the child function node (box)
         std::vector<Slice> child_patch(const keyT& child) const;
 
+        /// Returns task attributes preferring the NUMA domain of the subtree holding key
+
+        /// Keys below level 2 go with their ancestor at that level, so the
+        /// coefficients of a subtree are created (first touched) and used by
+        /// threads of the same domain.
+        /// @param[in] key the key to the function node (box) the task works on
+        /// @param[in] attr other attributes of the task
+        static TaskAttributes numa_attr(const keyT& key, TaskAttributes attr=TaskAttributes()) {
+            const Level numa_level = 2;
+            const keyT root = (key.level() > numa_level) ? key.parent(key.level()-numa_level) : key;
+            return attr.set_numa_domain(ThreadPool::numa_domain(root.hash()));
+        }
+
         /// Projection with optional refinement w/ special points
         /// @param[in] key the key to the current function node (box)
         /// @param[in] do_refine should we continue refinement?
@@ -2959,7 +2985,7 @@ template<size_t NDIM>
                             vv[i] = copy(vrss[i](cp));
                     }
 
-                    woT::task(coeffs.owner(child), &implT:: template mulXXveca<L,R>, child, left, ll, vright, vv, vresult, tol);
+                    woT::task(coeffs.owner(child), &implT:: template mulXXveca<L,R>, child, left, ll, vright, vv, vresult, tol, numa_attr(child));
                 }
             }
         }
@@ -3044,7 +3070,7 @@ template<size_t NDIM>
                 if (rc.size())
                     rr = copy(rss(child_patch(child)));
 
-                woT::task(coeffs.owner(child), &implT:: template mulXXa<L,R>, child, left, ll, right, rr, tol);
+                woT::task(coeffs.owner(child), &implT:: template mulXXa<L,R>, child, left, ll, right, rr, tol, numa_attr(child));
             }
         }
 
@@ -3114,7 +3140,7 @@ template<size_t NDIM>
                 if (rc.size())
                     rr = copy(rss(child_patch(child)));
 
-                woT::task(coeffs.owner(child), &implT:: template binaryXXa<L,R,opT>, child, left, ll, right, rr, op);
+                woT::task(coeffs.owner(child), &implT:: template binaryXXa<L,R,opT>, child, left, ll, right, rr, op, numa_attr(child));
             }
         }
 
@@ -3163,7 +3189,7 @@ template<size_t NDIM>
                 coeffs.replace(key, nodeT(coeffT(),true)); // Interior node
                 for (KeyChildIterator<NDIM> kit(key); kit; ++kit) {
                     const keyT& child = kit.key();
-                    woT::task(coeffs.owner(child), &implT:: template unaryXXa<Q,opT>, child, func, op);
+                    woT::task(coeffs.owner(child), &implT:: template unaryXXa<Q,opT>, child, func, op, numa_attr(child));
                 }
             }
             else {
@@ -3390,6 +3416,9 @@ template<size_t NDIM>
         /// is this the same as trickle_down() ?
         void sum_down_spawn(const keyT& key, const coeffT& s);
 
+        /// sum_down_spawn visiting up to budget locally owned nodes in this task
+        void sum_down_batch(const keyT& key, const coeffT& s, long& budget);
+
         /// After 1d push operator must sum coeffs down the tree to restore correct scaling function coefficients
         void sum_down(bool fence);
 
@@ -4507,10 +4536,27 @@ template<size_t NDIM>
 
         template <typename opT>
         void refine_spawn(const opT& op, const keyT& key) {
+            long budget = traversal_batch;
+            refine_batch(op, key, budget);
+        }
+
+        /// refine_spawn visiting up to budget locally owned nodes in this task
+
+        /// With a batch of 1 leaves are refined by separate tasks as before,
+        /// otherwise leaves visited by this task are refined inline.
+        template <typename opT>
+        void refine_batch(const opT& op, const keyT& key, long& budget) {
             nodeT& node = coeffs.find(key).get()->second;
             if (node.has_children()) {
-                for (KeyChildIterator<NDIM> kit(key); kit; ++kit)
-                    woT::task(coeffs.owner(kit.key()), &implT:: template refine_spawn<opT>, op, kit.key(), TaskAttributes::hipri());
+                for (KeyChildIterator<NDIM> kit(key); kit; ++kit) {
+                    if (coalesce(kit.key(), budget))
+                        refine_batch(op, kit.key(), budget);
+                    else
+                        woT::task(coeffs.owner(kit.key()), &implT:: template refine_spawn<opT>, op, kit.key(), TaskAttributes::hipri());
+                }
+            }
+            else if (traversal_batch > 1) {
+                refine_op(op, key);
             }
             else {
                 woT::task(coeffs.owner(key), &implT:: template refine_op<opT>, op, key);
@@ -4547,6 +4593,9 @@ template<size_t NDIM>
         /// cf reconstruct_op
         void trickle_down_op(const keyT& key, const coeffT& s);
 
+        /// trickle_down_op visiting up to budget locally owned nodes in this task
+        void trickle_down_batch(const keyT& key, const coeffT& s, long& budget);
+
         /// reconstruct this tree -- respects fence
         void reconstruct(bool fence);
 
@@ -4589,6 +4638,16 @@ template<size_t NDIM>
 
         Future<double> norm_tree_spawn(const keyT& key);
 
+        /// norm_tree_spawn visiting up to budget locally owned nodes in this task
+        Future<double> norm_tree_batch(const keyT& key, long& budget);
+
+        /// True if a traversal should visit child in the current task, charging the budget
+        bool coalesce(const keyT& child, long& budget) const {
+            if (budget <= 1 || !coeffs.is_local(child)) return false;
+            --budget;
+            return true;
+        }
+
         /// truncate using a tree in reconstructed form
 
         /// must be invoked where key is local
@@ -4709,7 +4768,9 @@ template<size_t NDIM>
         double do_apply_kernel2(const opT* op, const Tensor<R>& c, const do_op_args<OPDIM>& args,
                                 const TensorArgs& apply_targs) {
 
-            tensorT result_full = op->apply(args.key, args.d, c, args.tol/args.fac/args.cnorm);
+            // a low-rank result is a copy, so the full-rank one can live in the thread's scratch pool
+            const bool scratch = (apply_targs.tt != TT_FULL);
+            tensorT result_full = op->apply(args.key, args.d, c, args.tol/args.fac/args.cnorm, scratch);
             const double norm=result_full.normf();
 
             // Screen here to reduce communication cost of negligible data
@@ -4974,11 +5035,33 @@ template<size_t NDIM>
         }
 
 
+        template <typename opT>
+        using prefill_cache_t = decltype(std::declval<const opT&>().prefill_cache(Level(0)));
+
+        /// build the operator data for the levels of the local source nodes in parallel
+
+        /// Only done if the operator asks for it with prefill().  The tasks are
+        /// queued ahead of the apply tasks, which then find the data in the
+        /// operator's lock-free cache instead of constructing it themselves.
+        template <typename opT, typename R>
+        void prefill_operator_cache(const opT& op, const FunctionImpl<R,NDIM>& f) const {
+            if constexpr (meta::is_detected<prefill_cache_t, opT>::value) {
+                if (not op.prefill()) return;
+                std::set<Level> levels;
+                for (auto it=f.coeffs.begin(); it!=f.coeffs.end(); ++it) {
+                    const FunctionNode<R,NDIM>& node = it->second;
+                    if (node.has_coeff() and (node.coeff().dim(0) != k or op.doleaves)) levels.insert(it->first.level());
+                }
+                for (Level n : levels) world.taskq.add(op, &opT::prefill_cache, n, TaskAttributes::hipri());
+            }
+        }
+
         /// apply an operator on f to return this
         template <typename opT, typename R>
         void apply(opT& op, const FunctionImpl<R,NDIM>& f, bool fence) {
             PROFILE_MEMBER_FUNC(FunctionImpl);
             MADNESS_ASSERT(!op.modified());
+            prefill_operator_cache(op, f);
             typename dcT::const_iterator end = f.coeffs.end();
             for (typename dcT::const_iterator it=f.coeffs.begin(); it!=end; ++it) {
                 // looping through all the coefficients in the source
@@ -4988,7 +5071,7 @@ template<size_t NDIM>
                     if (node.coeff().dim(0) != k /* i.e. not a leaf */ || op.doleaves) {
                         ProcessID p = FunctionDefaults<NDIM>::get_apply_randomize() ? world.random_proc() : coeffs.owner(key);
 //                        woT::task(p, &implT:: template do_apply<opT,R>, &op, key, node.coeff()); //.full_tensor_copy() ????? why copy ????
-                        woT::task(p, &implT:: template do_apply<opT,R>, &op, key, node.coeff().reconstruct_tensor());
+                        woT::task(p, &implT:: template do_apply<opT,R>, &op, key, node.coeff().reconstruct_tensor(), numa_attr(key));
                     }
                 }
             }
@@ -5137,8 +5220,8 @@ template<size_t NDIM>
 
                 if (coeff.has_data() and (coeff.rank()!=0)) {
                     ProcessID p = FunctionDefaults<NDIM>::get_apply_randomize() ? world.random_proc() : coeffs.owner(key);
-                    woT::task(p, &implT:: template do_apply_directed_screening<opT,R>, &op, key, coeff, true);
-                    woT::task(p, &implT:: template do_apply_directed_screening<opT,R>, &op, key, coeff, false);
+                    woT::task(p, &implT:: template do_apply_directed_screening<opT,R>, &op, key, coeff, true, numa_attr(key));
+                    woT::task(p, &implT:: template do_apply_directed_screening<opT,R>, &op, key, coeff, false, numa_attr(key));
                 }
             }
             if (fence) world.gop.fence();
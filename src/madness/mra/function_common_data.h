@@ -32,6 +32,7 @@
 */
 
 #include <madness/mra/funcdefaults.h>
+#include <madness/tensor/fixed_transform.h>
 
 #ifndef FUNCTIONCOMMONDATA_H_
 #define FUNCTIONCOMMONDATA_H_
@@ -76,6 +77,8 @@ namespace madness {
                 v2k[i] = 2 * k;
             }
             key0 = Key<NDIM> (0, Vector<Translation, NDIM> (0));
+            transform_k = FixedTransform<NDIM>(k);
+            transform_2k = FixedTransform<NDIM>(2 * k);
 
             _init_twoscale();
             _init_quadrature(k, npt, quad_x, quad_w, quad_phi, quad_phiw,
@@ -107,6 +110,9 @@ namespace madness {
         Tensor<double> hg, hgT; ///< The full twoscale coeff (2k,2k) and transpose
         Tensor<double> hgsonly; ///< hg[0:k,:]
 
+        FixedTransform<NDIM> transform_k;  ///< fast_transform of (k,...) tensors, e.g. by quad_phiw
+        FixedTransform<NDIM> transform_2k; ///< fast_transform of (2k,...) tensors, i.e. by hg or hgT
+
         static const FunctionCommonData<T, NDIM>&
         get(int k) {
             MADNESS_ASSERT(k > 0 && k <= MAXK);
@@ -189,6 +189,7 @@ public:
     std::size_t nsubworld=1;                ///< number of worlds (try to have enough batches for all worlds)
     std::string policy = "guided";          ///< how to partition the batches
     std::size_t dimension = 1;              ///< partition one or two vectors
+    std::vector<double> cost1, cost2;       ///< estimated cost per element of the first and second vector
 
     MacroTaskPartitioner() {}
 
@@ -215,6 +216,15 @@ public:
         return *this;
     }
 
+    /// set the estimated cost of each element of the first (and second) partitioned vector
+
+    /// without element costs each element counts as one
+    MacroTaskPartitioner& set_element_costs(const std::vector<double>& c1, const std::vector<double>& c2=std::vector<double>()) {
+        cost1=c1;
+        cost2=c2;
+        return *this;
+    }
+
     /// this will be called by MacroTask, it will *always* partition first (and possibly second) vector of arguments
     template<typename tupleT>
     partitionT partition_tasks(const tupleT& argtuple) const {
@@ -285,8 +295,30 @@ public:
         return result;
     }
 
+    /// the priority of a batch is its estimated cost, larger batches are scheduled first
     virtual double compute_priority(const Batch& batch) const {
-        return batch.size_of_input();
+        if (cost1.empty() and cost2.empty()) return batch.size_of_input();
+        return estimated_cost(batch);
+    }
+
+    /// estimated cost of a batch: the product over the input ranges of the summed element costs
+
+    /// ranges without element costs contribute their number of elements
+    double estimated_cost(const Batch& batch) const {
+        double result=1.0;
+        for (std::size_t d=0; d<batch.input.size(); ++d) {
+            const std::vector<double>& cost=(d==0) ? cost1 : cost2;
+            const Batch_1D& range=batch.input[d];
+            if (cost.empty()) {
+                if (not range.is_full_size()) result*=range.size();
+                continue;
+            }
+            const long end=range.is_full_size() ? long(cost.size()) : std::min(range.end,long(cost.size()));
+            double sum=0.0;
+            for (long i=range.begin; i<end; ++i) sum+=cost[i];
+            result*=sum;
+        }
+        return result;
     }
 
 };
@@ -10,6 +10,14 @@
  This improves locality and speedups for large number of compute nodes, by reducing communications
  within worlds.
 
+ Scheduling is decentralized: when run_all starts, the waiting tasks are partitioned over one queue
+ per subworld by priority (the estimated cost). Each subworld takes its tasks from its own queue,
+ and once that is empty it steals from the queues of the other subworlds. The cost of a task is
+ estimated by its partitioner from the sizes of the functions in the batch; once a task has run, its
+ measured wall time replaces the estimate in the next run of the same taskq, e.g. in the next SCF
+ iteration. Timings are matched by the order of submission within a run, the task name, the lengths
+ of the vector arguments and the batch.
+
  The user defines a macrotask (an example is found in test_vectormacrotask.cc), the tasks are
  lightweight and carry only bookkeeping information, actual input and output are stored in a
  cloud (see cloud.h)
@@ -28,7 +36,6 @@
   - std::tuple<std::vector<XXX>, std::vector<YYY>> (a tuple of n vectors of WorldObjects: XXX, YYY, .. = {Function, ScalarResultImpl, ...})
 
 
- TODO: priority q
  TODO: task submission from inside task (serialize task instead of replicate)
  TODO: update documentation
  TODO: consider serializing task member variables
@@ -44,6 +51,8 @@
 #include <madness/world/cloud.h>
 #include <madness/world/world.h>
 #include <madness/mra/macrotaskpartitioner.h>
+#include <deque>
+#include <map>
 
 namespace madness {
 
@@ -291,6 +300,7 @@ public:
 
 	double priority=1.0;
 	enum Status {Running, Waiting, Complete, Unknown} stat=Unknown;
+	long submission=-1;		///< which call of add_tasks in the current run of the taskq created this task
 
 	void set_complete() {stat=Complete;}
 	void set_running() {stat=Running;}
@@ -303,6 +313,12 @@ public:
 	virtual void run(World& world, Cloud& cloud, taskqT& taskq, const long element, const bool debug) = 0;
 	virtual void cleanup() = 0;		// clear static data (presumably persistent input data)
 
+	/// identifies the task across taskq runs for recording its execution time, empty: do not record
+
+	/// The taskq adds the submission number, so that tasks of the same type submitted by different
+	/// calls in a run (e.g. alpha and beta exchange) are told apart
+	virtual std::string timing_key() const {return "";}
+
     virtual void print_me(std::string s="") const {
         printf("this is task with priority %4.1f\n",priority);
     }
@@ -348,6 +364,12 @@ class MacroTaskQ : public WorldObject< MacroTaskQ> {
     std::shared_ptr<World> subworld_ptr;
 	MacroTaskBase::taskqT taskq;
 	std::mutex taskq_mutex;
+	std::deque<long> myqueue;            ///< tasks of this subworld, only on subworld rank 0
+	std::vector<long> scheduled;         ///< all tasks of the current run_all
+	std::vector<bool> empty_victim;      ///< queues found empty when stealing
+	std::map<std::string,double> timing_history;	///< wall times of the tasks of the last run, identical on all processes
+	long nsubmission=0;                  ///< number of calls of add_tasks in the current run
+	long nsteal=0;                       ///< number of tasks this subworld stole from others
 	long printlevel=0;
 	long nsubworld=1;
     std::shared_ptr< WorldDCPmapInterface< Key<1> > > pmap1;
@@ -408,8 +430,9 @@ static std::shared_ptr<World> create_worlds(World& universe, const std::size_t n
 		}
 
 		double cpu0=cpu_time();
-		cloud.replicate();
+		partition_tasks();
         universe.gop.fence();
+		cloud.start_replication();
 		double cpu1=cpu_time();
 		if (printtimings()) print("cloud replication wall time",cpu1-cpu0);
         if (printdebug()) cloud.print_size(universe);
@@ -427,10 +450,12 @@ static std::shared_ptr<World> create_worlds(World& universe, const std::size_t n
 		World& subworld=get_subworld();
 //		if (printdebug()) print("I am subworld",subworld.id());
 		double tasktime=0.0;
+		std::vector<double> walltime(taskq.size(),0.0);
 		if (printprogress() and universe.rank()==0) std::cout << "progress in percent: " << std::flush;
 		while (true) {
 			long element=get_scheduled_task_number(subworld);
 			double cpu0=cpu_time();
+			double wall0=wall_time();
 			if (element<0) break;
 			std::shared_ptr<MacroTaskBase> task=taskq[element];
 			if (printdebug()) print("starting task no",element, "in subworld",subworld.id(),"at time",wall_time());
@@ -438,7 +463,8 @@ static std::shared_ptr<World> create_worlds(World& universe, const std::size_t n
 			task->run(subworld,cloud, taskq, element, printdebug());
 
 			double cpu1=cpu_time();
-			set_complete(element);
+			if (subworld.rank()==0) walltime[element]=wall_time()-wall0;
+			task->set_complete();
 			tasktime+=(cpu1-cpu0);
 			if (printdebug()) printf("completed task %3ld after %6.1fs at time %6.1fs\n",element,cpu1-cpu0,wall_time());
 
@@ -458,18 +484,25 @@ static std::shared_ptr<World> create_worlds(World& universe, const std::size_t n
         universe.gop.set_forbid_fence(false);
 		universe.gop.fence();
 		universe.gop.sum(tasktime);
+		double nstolen=nsteal;
+		universe.gop.sum(nstolen);
+		universe.gop.sum(walltime.data(),walltime.size());
+		record_timings(walltime);
+		set_scheduled_complete();
+		nsubmission=0;
 		if (printprogress() and universe.rank()==0) std::cout << std::endl;
         double cpu11=cpu_time();
         if (printlevel>=3) cloud.print_timings(universe);
         if (printtimings()) {
             printf("completed taskqueue after    %4.1fs at time %4.1fs\n", cpu11 - cpu00, wall_time());
             printf(" total cpu time / per world  %4.1fs %4.1fs\n", tasktime, tasktime / universe.size());
+            printf(" tasks stolen between worlds %4.0f\n", nstolen);
         }
 
 		// cleanup task-persistent input data
 		for (auto& task : taskq) task->cleanup();
 		cloud.clear_cache(subworld);
-		cloud.clear();
+		cloud.clear_stale();
 		subworld.gop.fence();
         subworld.gop.fence();
         universe.gop.fence();
@@ -483,12 +516,25 @@ static std::shared_ptr<World> create_worlds(World& universe, const std::size_t n
 	}
 
 	void add_tasks(MacroTaskBase::taskqT& vtask) {
+        for (const auto& t : vtask) t->submission=nsubmission;
+        nsubmission++;
+        refine_priorities(vtask);
         for (const auto& t : vtask) {
-            if (universe.rank()==0) t->set_waiting();
+            t->set_waiting();
             add_replicated_task(t);
         }
 	}
 
+    /// forget the execution times recorded in the last run, e.g. after the molecular geometry changed
+    void clear_timing_history() {
+        timing_history.clear();
+    }
+
+    /// the wall times of the tasks of the last run, keyed by submission number and MacroTaskBase::timing_key()
+    const std::map<std::string,double>& get_timing_history() const {
+        return timing_history;
+    }
+
     void print_taskq() const {
         universe.gop.fence();
         if (universe.rank()==0) {
@@ -505,43 +551,125 @@ private:
 		taskq.push_back(task);
 	}
 
-	/// scheduler is located on universe.rank==0
+	/// key of a task in the timing history: its submission number and MacroTaskBase::timing_key(), empty: not recorded
+	static std::string history_key(const MacroTaskBase& task) {
+		const std::string key=task.timing_key();
+		if (key.empty()) return key;
+		return std::to_string(task.submission)+" "+key;
+	}
+
+	/// remember the wall time of the tasks of this run for refining the priorities of the next run
+
+	/// Only the timings of this run are kept, so the history does not grow when the taskq is reused
+	void record_timings(const std::vector<double>& walltime) {
+		timing_history.clear();
+		for (long element : scheduled) {
+			const std::string key=history_key(*taskq[element]);
+			if (not key.empty()) timing_history[key]=walltime[element];
+		}
+	}
+
+	/// replace the estimated cost of the tasks by their wall time in an earlier run, if available
+
+	/// The estimates of tasks without a recorded time are scaled by the ratio of the recorded times to
+	/// their estimates, so that all priorities are comparable. Since tasks are scheduled by decreasing
+	/// priority this puts the longest tasks first, e.g. from the second SCF iteration on, if the same
+	/// taskq is used in every iteration.
+	void refine_priorities(MacroTaskBase::taskqT& vtask) const {
+		const auto& history=timing_history;
+		double recorded=0.0, estimated=0.0;
+		for (const auto& t : vtask) {
+			auto it=history.find(history_key(*t));
+			if (it==history.end()) continue;
+			recorded+=it->second;
+			estimated+=t->get_priority();
+		}
+		if (recorded<=0.0 or estimated<=0.0) return;
+		for (auto& t : vtask) {
+			auto it=history.find(history_key(*t));
+			if (it!=history.end()) t->set_priority(it->second);
+			else t->set_priority(t->get_priority()*recorded/estimated);
+		}
+	}
+
+	/// number of task queues: one per subworld, owned by the subworld's rank 0 (universe rank 0..nqueue-1)
+	long get_nqueue() const {return std::min(nsubworld,long(universe.size()));}
+
+	/// distribute the waiting tasks over the per-subworld queues
+
+	/// Every process computes the same partition, no communication is needed. Tasks are sorted by
+	/// decreasing priority, which doubles as the estimated cost, and each one is assigned to the
+	/// queue with the smallest accumulated cost. Only the queue owners keep their part.
+	void partition_tasks() {
+		std::vector<long> waiting;
+		for (std::size_t i=0; i<taskq.size(); ++i) if (taskq[i]->is_waiting()) waiting.push_back(i);
+		auto larger_priority = [&](const long a, const long b) {
+			return taskq[a]->get_priority()>taskq[b]->get_priority();
+		};
+		std::stable_sort(waiting.begin(),waiting.end(),larger_priority);
+
+		const long nqueue=get_nqueue();
+		std::vector<double> load(nqueue,0.0);
+		std::lock_guard<std::mutex> lock(taskq_mutex);
+		myqueue.clear();
+		for (long element : waiting) {
+			const long q=std::min_element(load.begin(),load.end())-load.begin();
+			load[q]+=std::max(taskq[element]->get_priority(),0.0);
+			if (q==universe.rank()) myqueue.push_back(element);
+		}
+		scheduled=waiting;
+		nsteal=0;
+	}
+
+	/// pop the next task from the local queue, or steal one from another subworld's queue
+
+	/// Only subworld rank 0 owns a queue and does the scheduling, the result is broadcast to the
+	/// other ranks of the subworld. Queues are only drained during run_all, so a victim that was
+	/// found empty once is not asked again.
 	long get_scheduled_task_number(World& subworld) {
-		long number=0;
+		long number=-1;
 		if (subworld.rank()==0) {
-		  Future<long> r = this->send(ProcessID(0), &MacroTaskQ::get_scheduled_task_number_local);
-		  number=r.get();
+			number=pop_front_local();
+			const long nqueue=get_nqueue();
+			if (number<0 and empty_victim.size()!=std::size_t(nqueue)) empty_victim.assign(nqueue,false);
+			for (long k=1; (number<0) and (k<nqueue); ++k) {
+				const ProcessID victim=(universe.rank()+k)%nqueue;
+				if (empty_victim[victim]) continue;
+				Future<long> r = this->send(victim, &MacroTaskQ::steal_local);
+				number=r.get();
+				if (number<0) empty_victim[victim]=true;
+				else nsteal++;
+			}
 		}
 		subworld.gop.broadcast_serializable(number, 0);
 		subworld.gop.fence();
+		if (number>=0) taskq[number]->set_running();
 		return number;
-
 	}
 
-	long get_scheduled_task_number_local() {
-		MADNESS_ASSERT(universe.rank()==0);
+	/// the owner takes tasks from the front of its queue, most expensive first
+	long pop_front_local() {
 		std::lock_guard<std::mutex> lock(taskq_mutex);
-
-		auto is_Waiting = [](const std::shared_ptr<MacroTaskBase>& mtb_ptr) {return mtb_ptr->is_waiting();};
-		auto it=std::find_if(taskq.begin(),taskq.end(),is_Waiting);
-		if (it!=taskq.end()) {
-			it->get()->set_running();
-			long element=it-taskq.begin();
-			return element;
-		}
-//		print("could not find task to schedule");
-		return -1;
+		if (myqueue.empty()) return -1;
+		long element=myqueue.front();
+		myqueue.pop_front();
+		return element;
 	}
 
-	/// scheduler is located on rank==0
-	void set_complete(const long task_number) const {
-		this->task(ProcessID(0), &MacroTaskQ::set_complete_local, task_number);
+	/// thieves take tasks from the back of the victim's queue
+	long steal_local() {
+		std::lock_guard<std::mutex> lock(taskq_mutex);
+		if (myqueue.empty()) return -1;
+		long element=myqueue.back();
+		myqueue.pop_back();
+		return element;
 	}
 
-	/// scheduler is located on rank==0
-	void set_complete_local(const long task_number) const {
-		MADNESS_ASSERT(universe.rank()==0);
-		taskq[task_number]->set_complete();
+	/// mark all tasks of this run as complete, on all processes
+	void set_scheduled_complete() {
+		for (long element : scheduled) taskq[element]->set_complete();
+		scheduled.clear();
+		empty_victim.clear();
 	}
 
 public:
@@ -640,6 +768,9 @@ public:
         auto partitioner=task.partitioner;
         if (not partitioner) partitioner.reset(new MacroTaskPartitioner);
         partitioner->set_nsubworld(world.size());
+        constexpr std::size_t I1 = get_index_of_first_vector_argument<argtupleT, 0>();
+        constexpr std::size_t I2 = get_index_of_second_vector_argument<argtupleT, 0>();
+        partitioner->set_element_costs(element_costs<I1>(argtuple), element_costs<I2>(argtuple));
         partitionT partition = partitioner->partition_tasks(argtuple);
 
         // store input and output: output being a pointer to a universe function (vector)
@@ -649,9 +780,11 @@ public:
 
         // create tasks and add them to the taskq
         MacroTaskBase::taskqT vtask;
+        const std::string input_sizes=vector_sizes(argtuple);
         for (const auto& batch_prio : partition) {
-            vtask.push_back(
-                    std::shared_ptr<MacroTaskBase>(new MacroTaskInternal(task, batch_prio, inputrecords, outputrecords)));
+            auto mtask=std::make_shared<MacroTaskInternal>(task, batch_prio, inputrecords, outputrecords);
+            mtask->input_sizes=input_sizes;
+            vtask.push_back(mtask);
         }
         taskq_ptr->add_tasks(vtask);
 
@@ -666,6 +799,35 @@ public:
     std::shared_ptr<MacroTaskQ> taskq_ptr;
 private:
 
+    /// the lengths of the vector arguments, e.g. "(5,5)", to tell apart tasks over different inputs
+    static std::string vector_sizes(const argtupleT& argtuple) {
+        std::stringstream ss;
+        ss << "(";
+        std::apply([&ss](const auto&... arg) {
+            std::size_t i=0;
+            auto print_size = [&ss,&i](const auto& a) {
+                if constexpr (is_vector<std::decay_t<decltype(a)>>::value) ss << (i++ ? "," : "") << a.size();
+            };
+            (print_size(arg), ...);
+        }, argtuple);
+        ss << ")";
+        return ss.str();
+    }
+
+    /// estimated cost of the elements of the I-th argument: the number of coefficients of each
+    /// function if it is a vector of Functions, empty otherwise
+    template<std::size_t I>
+    std::vector<double> element_costs(const argtupleT& argtuple) const {
+        std::vector<double> cost;
+        if constexpr (I < std::tuple_size_v<argtupleT>) {
+            typedef std::decay_t<std::tuple_element_t<I, argtupleT>> argT;
+            if constexpr (is_madness_function_vector<argT>::value) {
+                for (const auto& f : std::get<I>(argtuple)) cost.push_back(f.is_initialized() ? f.size_local() : 0.0);
+                if (cost.size()>0) world.gop.sum(cost.data(),cost.size());
+            }
+        }
+        return cost;
+    }
 
     /// store *pointers* to the result WorldObject in the cloud and return the recordlist
     recordlistT prepare_output_records(Cloud &cloud, resultT& result) {
@@ -723,6 +885,7 @@ private:
         recordlistT outputrecords;
     public:
         taskT task;
+        std::string input_sizes;    ///< lengths of the vector arguments, part of the timing key
     	std::string get_name() const {
     		if (task.name=="unknown_task") return typeid(task).name();
     		return task.name;
@@ -742,6 +905,12 @@ private:
         }
 
 
+        std::string timing_key() const override {
+            std::stringstream ss;
+            ss << get_name() << " " << input_sizes << " " << task.batch;
+            return ss.str();
+        }
+
         void print_me(std::string s="") const override {
             print("this is task",get_name(),"with batch", task.batch,"priority",this->get_priority());
         }
@@ -321,6 +321,12 @@ namespace madness {
     template <typename T, std::size_t NDIM>
     void FunctionImpl<T,NDIM>::set_autorefine(bool value) {autorefine = value;}
 
+    template <typename T, std::size_t NDIM>
+    int FunctionImpl<T,NDIM>::get_traversal_batch() const {return traversal_batch;}
+
+    template <typename T, std::size_t NDIM>
+    void FunctionImpl<T,NDIM>::set_traversal_batch(int value) {traversal_batch = std::max(value,1);}
+
     template <typename T, std::size_t NDIM>
     int FunctionImpl<T,NDIM>::get_k() const {return k;}
 
@@ -859,39 +865,52 @@ namespace madness {
     /// is this the same as trickle_down() ?
     template <typename T, std::size_t NDIM>
     void FunctionImpl<T,NDIM>::sum_down_spawn(const keyT& key, const coeffT& s) {
-        typename dcT::accessor acc;
-        coeffs.insert(acc,key);
-        nodeT& node = acc->second;
-        coeffT& c = node.coeff();
+        PROFILE_MEMBER_FUNC(FunctionImpl);
+        long budget = traversal_batch;
+        sum_down_batch(key, s, budget);
+    }
+
+    template <typename T, std::size_t NDIM>
+    void FunctionImpl<T,NDIM>::sum_down_batch(const keyT& key, const coeffT& s, long& budget) {
+        PROFILE_BLOCK(sum_down_node);
+        coeffT d;
+        {
+            typename dcT::accessor acc;
+            coeffs.insert(acc,key);
+            nodeT& node = acc->second;
+            coeffT& c = node.coeff();
 
-        //print(key,"received",s.normf(),c.normf(),node.has_children());
+            //print(key,"received",s.normf(),c.normf(),node.has_children());
 
-        if (s.size() > 0) {
-            if (c.size() > 0)
-                c.gaxpy(1.0,s,1.0);
-            else
-                c = s;
-        }
+            if (s.size() > 0) {
+                if (c.size() > 0)
+                    c.gaxpy(1.0,s,1.0);
+                else
+                    c = s;
+            }
 
-        if (node.has_children()) {
-            coeffT d;
+            if (!node.has_children()) {
+                // Missing coeffs assumed to be zero
+                if (c.size() <= 0) c = coeffT(cdata.vk,targs);
+                return;
+            }
             if (c.has_data()) {
                 d = coeffT(cdata.v2k,targs);
                 d(cdata.s0) += c;
                 d = unfilter(d);
                 node.clear_coeff();
             }
-            for (KeyChildIterator<NDIM> kit(key); kit; ++kit) {
-                coeffT ss;
-                const keyT& child = kit.key();
-                if (d.size() > 0) ss = copy(d(child_patch(child)));
-                //print(key,"sending",ss.normf(),"to",child);
-                woT::task(coeffs.owner(child), &implT::sum_down_spawn, child, ss);
-            }
-        }
-        else {
-            // Missing coeffs assumed to be zero
-            if (c.size() <= 0) c = coeffT(cdata.vk,targs);
+        } // Release the node before visiting children in this task
+
+        for (KeyChildIterator<NDIM> kit(key); kit; ++kit) {
+            coeffT ss;
+            const keyT& child = kit.key();
+            if (d.size() > 0) ss = copy(d(child_patch(child)));
+            //print(key,"sending",ss.normf(),"to",child);
+            if (coalesce(child, budget))
+                sum_down_batch(child, ss, budget);
+            else
+                woT::task(coeffs.owner(child), &implT::sum_down_spawn, child, ss, numa_attr(child));
         }
     }
 
@@ -1137,7 +1156,7 @@ namespace madness {
     typename FunctionImpl<T,NDIM>::tensorT FunctionImpl<T,NDIM>::filter(const tensorT& s) const {
         tensorT r(cdata.v2k,false);
         tensorT w(cdata.v2k,false);
-        return fast_transform(s,cdata.hgT,r,w);
+        return cdata.transform_2k(s,cdata.hgT,r,w);
         //return transform(s,cdata.hgT);
     }
 
@@ -1166,7 +1185,7 @@ namespace madness {
     typename FunctionImpl<T,NDIM>::tensorT FunctionImpl<T,NDIM>::unfilter(const tensorT& s) const {
         tensorT r(cdata.v2k,false);
         tensorT w(cdata.v2k,false);
-        return fast_transform(s,cdata.hg,r,w);
+        return cdata.transform_2k(s,cdata.hg,r,w);
         //return transform(s, cdata.hg);
     }
 
@@ -1348,6 +1367,14 @@ namespace madness {
     /// cf reconstruct_op
     template <typename T, std::size_t NDIM>
     void FunctionImpl<T,NDIM>::trickle_down_op(const keyT& key, const coeffT& s) {
+        PROFILE_MEMBER_FUNC(FunctionImpl);
+        long budget = traversal_batch;
+        trickle_down_batch(key, s, budget);
+    }
+
+    template <typename T, std::size_t NDIM>
+    void FunctionImpl<T,NDIM>::trickle_down_batch(const keyT& key, const coeffT& s, long& budget) {
+        PROFILE_BLOCK(trickle_down_node);
         // Note that after application of an integral operator not all
         // siblings may be present so it is necessary to check existence
         // and if absent insert an empty leaf node.
@@ -1377,8 +1404,13 @@ namespace madness {
                 const keyT& child = kit.key();
                 coeffT ss= upsample(child,d);
                 ss.reduce_rank(thresh);
-                PROFILE_BLOCK(recon_send);
-                woT::task(coeffs.owner(child), &implT::trickle_down_op, child, ss);
+                if (coalesce(child, budget)) {
+                    trickle_down_batch(child, ss, budget);
+                }
+                else {
+                    PROFILE_BLOCK(recon_send);
+                    woT::task(coeffs.owner(child), &implT::trickle_down_op, child, ss, numa_attr(child));
+                }
             }
         }
         else {
@@ -1601,12 +1633,32 @@ namespace madness {
 
     template <typename T, std::size_t NDIM>
     Future<double> FunctionImpl<T,NDIM>::norm_tree_spawn(const keyT& key) {
+        PROFILE_MEMBER_FUNC(FunctionImpl);
+        long budget = traversal_batch;
+        return norm_tree_batch(key, budget);
+    }
+
+    template <typename T, std::size_t NDIM>
+    Future<double> FunctionImpl<T,NDIM>::norm_tree_batch(const keyT& key, long& budget) {
+        PROFILE_BLOCK(norm_tree_node);
         nodeT& node = coeffs.find(key).get()->second;
         if (node.has_children()) {
             std::vector< Future<double> > v = future_vector_factory<double>(1<<NDIM);
+            bool ready = true;
             int i=0;
             for (KeyChildIterator<NDIM> kit(key); kit; ++kit,++i) {
-                v[i] = woT::task(coeffs.owner(kit.key()), &implT::norm_tree_spawn, kit.key());
+                if (coalesce(kit.key(), budget))
+                    v[i] = norm_tree_batch(kit.key(), budget);
+                else
+                    v[i] = woT::task(coeffs.owner(kit.key()), &implT::norm_tree_spawn, kit.key());
+                ready = ready && v[i].probe();
+            }
+            if (ready) { // All children were visited in this task
+                double sum = 0.0;
+                for (const Future<double>& f : v) sum += f.get()*f.get();
+                sum = sqrt(sum);
+                node.set_norm_tree(sum);
+                return Future<double>(sum);
             }
             return woT::task(world.rank(),&implT::norm_tree_op, key, v);
         }
@@ -2146,7 +2198,7 @@ namespace madness {
                     coeffT ss = copy(d(child_patch(child)));
                     ss.reduce_rank(thresh);
                     //PROFILE_BLOCK(recon_send); // Too fine grain for routine profiling
-                    woT::task(coeffs.owner(child), &implT::reconstruct_op, child, ss, accumulate_NS);
+                    woT::task(coeffs.owner(child), &implT::reconstruct_op, child, ss, accumulate_NS, numa_attr(child));
                 }
             } else {
                 MADNESS_ASSERT(node.is_leaf());
@@ -2538,7 +2590,7 @@ namespace madness {
                         p = coeffs.owner(child);
                     }
                     //PROFILE_BLOCK(proj_refine_send); // Too fine grain for routine profiling
-                    woT::task(p, &implT::project_refine_op, child, do_refine, newspecialpts);
+                    woT::task(p, &implT::project_refine_op, child, do_refine, newspecialpts, numa_attr(child));
                 }
             }
             else {
@@ -2636,6 +2688,13 @@ namespace madness {
     template <typename T, std::size_t NDIM>
     Future<bool> FunctionImpl<T,NDIM>::truncate_spawn(const keyT& key, double tol) {
         //PROFILE_MEMBER_FUNC(FunctionImpl);
+        long budget = traversal_batch;
+        return truncate_batch(key, tol, budget);
+    }
+
+    template <typename T, std::size_t NDIM>
+    Future<bool> FunctionImpl<T,NDIM>::truncate_batch(const keyT& key, double tol, long& budget) {
+        PROFILE_BLOCK(truncate_node);
         typename dcT::iterator it = coeffs.find(key).get();
         if (it == coeffs.end()) {
             // In a standard tree all children would exist but some ops (transform)
@@ -2647,10 +2706,16 @@ namespace madness {
         nodeT& node = it->second;
         if (node.has_children()) {
             std::vector< Future<bool> > v = future_vector_factory<bool>(1<<NDIM);
+            bool ready = true;
             int i=0;
             for (KeyChildIterator<NDIM> kit(key); kit; ++kit,++i) {
-                v[i] = woT::task(coeffs.owner(kit.key()), &implT::truncate_spawn, kit.key(), tol, TaskAttributes::generator());
+                if (coalesce(kit.key(), budget))
+                    v[i] = truncate_batch(kit.key(), tol, budget);
+                else
+                    v[i] = woT::task(coeffs.owner(kit.key()), &implT::truncate_spawn, kit.key(), tol, TaskAttributes::generator());
+                ready = ready && v[i].probe();
             }
+            if (ready) return Future<bool>(truncate_op(key, tol, v)); // All children were visited in this task
             return woT::task(world.rank(),&implT::truncate_op, key, tol, v);
         }
         else {
@@ -2832,7 +2897,7 @@ namespace madness {
         madness::fcube(key,*functor,cdata.quad_x,work);
         work.scale(sqrt(FunctionDefaults<NDIM>::get_cell_volume()*pow(0.5,double(NDIM*key.level()))));
         //return transform(work,cdata.quad_phiw);
-        return fast_transform(work,cdata.quad_phiw,fval,workq);
+        return cdata.transform_k(work,cdata.quad_phiw,fval,workq);
     }
 
     template <typename T, std::size_t NDIM>
@@ -3574,6 +3639,8 @@ template <typename T, std::size_t NDIM>
         truncate_on_project = true;
         apply_randomize = false;
         project_randomize = false;
+        tensor_slab = false;
+        traversal_batch = 1;
         if (!bc.has_value()) bc = BoundaryConditions<NDIM>(BC_FREE);
         tt = TT_FULL;
         cell = make_default_cell();
@@ -3605,6 +3672,8 @@ template <typename T, std::size_t NDIM>
     		std::cout << "             truncate_on_project" <<  ": " << truncate_on_project << std::endl;
     		std::cout << "                 apply_randomize" <<  ": " << apply_randomize << std::endl;
     		std::cout << "               project_randomize" <<  ": " << project_randomize << std::endl;
+    		std::cout << "                     tensor_slab" <<  ": " << tensor_slab << std::endl;
+    		std::cout << "                 traversal_batch" <<  ": " << traversal_batch << std::endl;
     		std::cout << "                              bc" <<  ": " << get_bc() << std::endl;
     		std::cout << "                              tt" <<  ": " << tt << std::endl;
     		std::cout << "                            cell" <<  ": " << cell << std::endl;
@@ -3626,6 +3695,8 @@ template <typename T, std::size_t NDIM>
     template <std::size_t NDIM> bool FunctionDefaults<NDIM>::truncate_on_project = true;
     template <std::size_t NDIM> bool FunctionDefaults<NDIM>::apply_randomize = false;
     template <std::size_t NDIM> bool FunctionDefaults<NDIM>::project_randomize = false;
+    template <std::size_t NDIM> bool FunctionDefaults<NDIM>::tensor_slab = false;
+    template <std::size_t NDIM> int FunctionDefaults<NDIM>::traversal_batch = 1;
     template <std::size_t NDIM> std::optional<BoundaryConditions<NDIM>> FunctionDefaults<NDIM>::bc;
     template <std::size_t NDIM> TensorType FunctionDefaults<NDIM>::tt = TT_FULL;
     template <std::size_t NDIM> Tensor<double> FunctionDefaults<NDIM>::cell = FunctionDefaults<NDIM>::make_default_cell();
@@ -42,6 +42,7 @@
 #include <madness/mra/adquad.h>
 #include <madness/tensor/aligned.h>
 #include <madness/tensor/tensor_lapack.h>
+#include <madness/tensor/scratchpool.h>
 #include <madness/constants.h>
 
 #include <madness/mra/simplecache.h>
@@ -112,6 +113,8 @@ namespace madness {
     in the SimpleCache "data", which is of type SeparatedConvolutionData, which keeps the matrices
     for all separated terms and dimensions. These SeparatedConvolutionData are constructed using
     ConvolutionND "ops", which is constructed at the construction of the SeparatedConvolution.
+    For the standard displacements the SeparatedConvolutionData live in the lock-free FlatLevelCache
+    "flat_data" (resp. "flat_mod_data") instead, indexed directly by level and displacement.
 
                         SeparatedConvolution (all terms, all dim, all displacements)
 
@@ -158,6 +161,9 @@ namespace madness {
         int particle_=1;        ///< must only be 1 or 2
         bool destructive_=false;	///< destroy the argument or restore it (expensive for 6d functions)
         bool print_timings=false;
+        bool prefill_=false;     ///< precompute the operator data for the source levels before apply()
+        long apply_batch=8;                     ///< max number of full-rank terms fused in apply() (<2 disables)
+        long apply_batch_stack_size=1L<<18;     ///< max number of elements in the batch buffer
 
         typedef Key<NDIM> keyT;
         const static size_t opdim=NDIM;
@@ -180,6 +186,50 @@ namespace madness {
         // SeparatedConvolutionData keeps data for all terms and all dimensions and 1 displacement
         mutable SimpleCache< SeparatedConvolutionData<Q,NDIM>, NDIM > data; ///< cache for all terms, dims and displacements
         mutable SimpleCache< SeparatedConvolutionData<Q,NDIM>, 2*NDIM > mod_data; ///< cache for all terms, dims and displacements
+        // flat lock-free front ends of data and mod_data for the standard displacements; the hashed caches hold the rest
+        mutable FlatLevelCache< SeparatedConvolutionData<Q,NDIM>, NDIM > flat_data{Displacements<NDIM>::bmax_default()};
+        mutable FlatLevelCache< SeparatedConvolutionData<Q,NDIM>, NDIM > flat_mod_data{Displacements<NDIM>::bmax_default(), 1L<<NDIM};
+
+        std::string cache_file_path;                    ///< operator cache file of all terms, empty if not backed by one
+        OperatorCacheFile::bytesT cache_file_header;    ///< parameters of the 1D kernels of all terms
+
+        /// The distinct 1D kernels of all terms, each with the aux of its records in the operator cache file
+        std::vector<std::pair<std::shared_ptr<Convolution1D<Q>>, std::int64_t>> cache_kernels() const {
+            std::vector<std::pair<std::shared_ptr<Convolution1D<Q>>, std::int64_t>> result;
+            for (int mu=0; mu<rank; ++mu) {
+                for (std::size_t d=0; d<NDIM; ++d) {
+                    const std::shared_ptr<Convolution1D<Q>> op = ops[mu].getop(d);
+                    if (std::none_of(result.begin(), result.end(), [&](const auto& r) {return r.first == op;}))
+                        result.emplace_back(op, std::int64_t(mu*NDIM + d));
+                }
+            }
+            return result;
+        }
+
+        /// Warm-starts all terms from one operator cache file, if enabled
+
+        /// Called at the end of the constructors.  The file is named after
+        /// the parameters of all 1D kernels, and nothing is cached if one of
+        /// them does not support it.
+        void attach_cache_file() {
+            if (OperatorCacheFile::directory().empty() || ops.empty()) return;
+            const auto kernels = cache_kernels();
+            OperatorCacheFile::bytesT header;
+            for (const auto& [op, aux] : kernels) {
+                if (!op) return;
+                const OperatorCacheFile::bytesT& params = op->get_cache_params();
+                if (params.empty()) return;
+                const std::uint64_t nbyte = params.size();
+                OperatorCacheFile::append(header, &aux);
+                OperatorCacheFile::append(header, &nbyte);
+                header.insert(header.end(), params.begin(), params.end());
+            }
+            cache_file_header = std::move(header);
+            cache_file_path = OperatorCacheFile::filename("op", hash_range(cache_file_header.begin(), cache_file_header.end()));
+            auto file = std::make_shared<OperatorCacheFile>();
+            if (file->open(cache_file_path, cache_file_header))
+                for (const auto& [op, aux] : kernels) op->attach_cache_file(file, aux);
+        }
 
     public:
 
@@ -197,6 +247,9 @@ namespace madness {
         bool& destructive() {return destructive_;}
         const bool& destructive() const {return destructive_;}
 
+        bool& prefill() {return prefill_;}
+        const bool& prefill() const {return prefill_;}
+
         const double& gamma() const {return info.mu;}
         const double& mu() const {return info.mu;}
         const int get_rank() const { return rank; }
@@ -216,10 +269,19 @@ namespace madness {
         };
 
         /// too lazy for extended calling lists
-        struct Transformation {
+        template <typename P>
+        struct TransformationT {
             long r;             // Effective rank of transformation
-            const Q* U;         // Ptr to matrix
-            const Q* VT;
+            const P* U;         // Ptr to matrix
+            const P* VT;
+        };
+        typedef TransformationT<Q> Transformation;
+
+        /// Single-precision copies of the input and workspace of apply() (see OperatorInfo::single_precision)
+        struct SinglePrecisionWork {
+            Tensor<float> f, f0;        ///< the input and its scaling part
+            Tensor<float> work1, work2;
+            Tensor<float> mat;          ///< the matrices of one term
         };
 
         static inline std::pair<Tensor<Q>,Tensor<Q>>
@@ -319,14 +381,17 @@ namespace madness {
 
 
         /// accumulate into result
-        template <typename T, typename R>
+
+        /// The transforms are done in the type \c R of the workspace, which
+        /// may be of lower precision than the result (see apply_transformation_single)
+        template <typename T, typename R, typename P, typename S>
         void apply_transformation(long dimk,
-                                  const Transformation trans[NDIM],
+                                  const TransformationT<P> trans[NDIM],
                                   const Tensor<T>& f,
                                   Tensor<R>& work1,
                                   Tensor<R>& work2,
                                   const Q mufac,
-                                  Tensor<R>& result) const {
+                                  Tensor<S>& result) const {
 
             //PROFILE_MEMBER_FUNC(SeparatedConvolution); // Too fine grain for routine profiling
             long size = 1;
@@ -377,7 +442,57 @@ namespace madness {
                 }
             }
             // Assuming here that result is contiguous and aligned
-            aligned_axpy(size, result.ptr(), w1, mufac);
+            if constexpr (std::is_same<R,S>::value) {
+                aligned_axpy(size, result.ptr(), w1, mufac);
+            }
+            else {
+                S* MADNESS_RESTRICT p = result.ptr();
+                for (long i=0; i<size; ++i) p[i] += mufac*S(w1[i]);
+            }
+        }
+
+
+        /// True if applying a term of norm \c norm in single precision stays below \c tol
+
+        /// The rounding error of NDIM products with inner dimension \c dimk
+        /// is estimated as eps*NDIM*sqrt(dimk) relative to the term; tol is,
+        /// as everywhere in apply(), relative to the norm of the input.
+        static bool single_precision_ok(double norm, long dimk, double tol) {
+            const double eps = std::numeric_limits<float>::epsilon();
+            return norm*eps*(1.0 + NDIM*std::sqrt(double(dimk))) < tol;
+        }
+
+
+        /// accumulate into result, with the transformations done in single precision
+
+        /// The matrices of \c trans are converted to float into \c sp.mat; the
+        /// result is accumulated in double.
+        void apply_transformation_single(long dimk,
+                                         const Transformation trans[NDIM],
+                                         const Tensor<float>& f,
+                                         SinglePrecisionWork& sp,
+                                         const Q mufac,
+                                         Tensor<double>& result) const {
+            TransformationT<float> strans[NDIM];
+            float* MADNESS_RESTRICT m = sp.mat.ptr();
+            for (std::size_t d=0; d<NDIM; ++d) {
+                strans[d].r = trans[d].r;
+                // U is used as (dimk,r) with leading dimension dimk, VT as (r,dimk)
+                const long nu = trans[d].VT ? dimk*dimk : dimk*trans[d].r;
+                for (long i=0; i<nu; ++i) m[i] = float(trans[d].U[i]);
+                strans[d].U = m;
+                m += nu;
+                if (trans[d].VT) {
+                    const long nvt = trans[d].r*dimk;
+                    for (long i=0; i<nvt; ++i) m[i] = float(trans[d].VT[i]);
+                    strans[d].VT = m;
+                    m += nvt;
+                }
+                else {
+                    strans[d].VT = nullptr;
+                }
+            }
+            apply_transformation(dimk, strans, f, sp.work1, sp.work2, mufac, result);
         }
 
 
@@ -458,7 +573,60 @@ namespace madness {
         }
 
 
+        /// Determine the 1-d transformations for the R (\c r_term) or T part of one separated term
+
+        /// Picks for each dimension either the full matrix or its SVD truncated
+        /// to the rank needed for \c tol.
+        /// @return false if the term contributes nothing
+        bool make_transformation(const ConvolutionData1D<Q>* const ops_1d[NDIM], const bool r_term,
+                                 const double tol, Transformation trans[NDIM]) const {
+
+            double norm = 1.0;
+            for (std::size_t d=0; d<NDIM; ++d) norm *= (r_term ? ops_1d[d]->Rnorm : ops_1d[d]->Tnorm);
+            if (r_term and not (norm > 1.e-20)) return false;
+            if (not r_term and not (norm > 0.0)) return false;
+
+            const auto tol_s = tol/(norm*NDIM);  // Errors are relative within here
+
+            // Determine rank of SVD to use or if to use the full matrix
+            long dimk = k;
+            if (r_term and not modified()) dimk = 2*k;
+
+            long break_even;
+            if (NDIM==1) break_even = long(0.5*dimk);
+            else if (NDIM==2) break_even = long(0.6*dimk);
+            else if (NDIM==3) break_even=long(0.65*dimk);
+            else break_even=long(0.7*dimk);
+            for (std::size_t d=0; d<NDIM; ++d) {
+                const Tensor<typename Tensor<Q>::scalar_type>& s = r_term ? ops_1d[d]->Rs : ops_1d[d]->Ts;
+                long r;
+                for (r=0; r<dimk; ++r) {
+                    if (s[r] < tol_s) break;
+                }
+                if (r >= break_even) {
+                    trans[d].r = dimk;
+                    trans[d].U = r_term ? ops_1d[d]->R.ptr() : ops_1d[d]->T.ptr();
+                    trans[d].VT = 0;
+                }
+                else {
+
+#ifdef USE_GENTENSOR
+                    r = std::max(2L,r+(r&1L)); // (needed for 6D == when GENTENSOR is on) NOLONGER NEED TO FORCE OPERATOR RANK TO BE EVEN
+#endif
+                    if (r == 0) return false;
+                    trans[d].r = r;
+                    trans[d].U = r_term ? ops_1d[d]->RU.ptr() : ops_1d[d]->TU.ptr();
+                    trans[d].VT = r_term ? ops_1d[d]->RVT.ptr() : ops_1d[d]->TVT.ptr();
+                }
+            }
+            return true;
+        }
+
+
         /// Apply one of the separated terms, accumulating into the result
+
+        /// If \c sp is given the R and T parts are each done in single
+        /// precision when single_precision_ok() for \c tol, else in double.
         template <typename T>
         void muopxv_fast(ApplyTerms at,
                          const ConvolutionData1D<Q>* const ops_1d[NDIM],
@@ -468,104 +636,190 @@ namespace madness {
                          const double tol,
                          const Q mufac,
                          Tensor<TENSOR_RESULT_TYPE(T,Q)>& work1,
-                         Tensor<TENSOR_RESULT_TYPE(T,Q)>& work2) const {
+                         Tensor<TENSOR_RESULT_TYPE(T,Q)>& work2,
+                         SinglePrecisionWork* sp=nullptr) const {
 
             //PROFILE_MEMBER_FUNC(SeparatedConvolution); // Too fine grain for routine profiling
             Transformation trans[NDIM];
-            Tensor<T> trans2[NDIM];
-
-            double Rnorm = 1.0;
-            for (std::size_t d=0; d<NDIM; ++d) Rnorm *= ops_1d[d]->Rnorm;
-
-            if (at.r_term and (Rnorm > 1.e-20)) {
 
-                const auto tol_Rs = tol/(Rnorm*NDIM);  // Errors are relative within here
+            auto term_norm = [&](bool r_term) {
+                double norm = 1.0;
+                for (std::size_t d=0; d<NDIM; ++d) norm *= (r_term ? ops_1d[d]->Rnorm : ops_1d[d]->Tnorm);
+                return norm;
+            };
 
-                // Determine rank of SVD to use or if to use the full matrix
+            if (at.r_term and make_transformation(ops_1d, true, tol, trans)) {
                 long twok = 2*k;
                 if (modified()) twok=k;
-
-                long break_even;
-                if (NDIM==1) break_even = long(0.5*twok);
-                else if (NDIM==2) break_even = long(0.6*twok);
-                else if (NDIM==3) break_even=long(0.65*twok);
-                else break_even=long(0.7*twok);
-                bool rank_is_zero = false;
-                for (std::size_t d=0; d<NDIM; ++d) {
-                    long r;
-                    for (r=0; r<twok; ++r) {
-                        if (ops_1d[d]->Rs[r] < tol_Rs) break;
+                if constexpr (std::is_same<T,double>::value && std::is_same<Q,double>::value) {
+                    if (sp and single_precision_ok(term_norm(true), twok, tol)) {
+                        apply_transformation_single(twok, trans, sp->f, *sp, mufac, result);
+                        at.r_term = false;
                     }
-                    if (r >= break_even) {
-                        trans[d].r = twok;
-                        trans[d].U = ops_1d[d]->R.ptr();
-                        trans[d].VT = 0;
+                }
+                if (at.r_term) apply_transformation(twok, trans, f, work1, work2, mufac, result);
+            }
+
+            if (at.t_term and make_transformation(ops_1d, false, tol, trans)) {
+                if constexpr (std::is_same<T,double>::value && std::is_same<Q,double>::value) {
+                    if (sp and single_precision_ok(term_norm(false), k, tol)) {
+                        apply_transformation_single(k, trans, sp->f0, *sp, -mufac, result0);
+                        return;
                     }
-                    else {
+                }
+                apply_transformation(k, trans, f0, work1, work2, -mufac, result0);
+            }
+        }
 
-#ifdef USE_GENTENSOR
-                        r = std::max(2L,r+(r&1L)); // (needed for 6D == when GENTENSOR is on) NOLONGER NEED TO FORCE OPERATOR RANK TO BE EVEN
-#endif
-                        if (r == 0) {
-                            rank_is_zero = true;
-                            break;
-                        }
-                        trans[d].r = r;
-                        trans[d].U = ops_1d[d]->RU.ptr();
-                        trans[d].VT = ops_1d[d]->RVT.ptr();
+
+        /// Accumulates a batch of full-rank separated terms into result
+
+        /// Each term runs its first NDIM-1 transformations into its own
+        /// slot of \c stack.  The last transformation of all terms, together
+        /// with their factors and the sum over terms, is then a single
+        /// mTxmq with the slots stacked along the contracted index:
+        /// \code
+        ///    result += sum_mu fac_mu W_mu^T U_mu = stack^T ustack
+        /// \endcode
+        /// This replaces nterm small transforms and axpys by one product
+        /// with a long inner dimension.
+        /// @param[in]  trans   nterm*NDIM full-rank transformations, term-major
+        /// @param[in]  fac     the factors of the nterm terms
+        template <typename T, typename R>
+        void apply_transformation_batch(long dimk, long nterm,
+                                        const Transformation* trans,
+                                        const Q* fac,
+                                        const Tensor<T>& f,
+                                        Tensor<R>& work1,
+                                        Tensor<R>& work2,
+                                        Tensor<R>& stack,
+                                        Tensor<Q>& ustack,
+                                        Tensor<R>& result) const {
+
+            long size = 1;
+            for (std::size_t i=0; i<NDIM; ++i) size *= dimk;
+            const long dimi = size/dimk;
+
+            R* MADNESS_RESTRICT s = stack.ptr();
+            Q* MADNESS_RESTRICT u = ustack.ptr();
+            for (long t=0; t<nterm; ++t, s+=size, u+=dimk*dimk) {
+                const Transformation* tr = trans + t*NDIM;
+                if constexpr (NDIM == 1) {
+                    const T* p = f.ptr();
+                    for (long i=0; i<size; ++i) s[i] = p[i];
+                }
+                else {
+                    R* MADNESS_RESTRICT w1 = (NDIM==2) ? s : work1.ptr();
+                    R* MADNESS_RESTRICT w2 = work2.ptr();
+                    mTxmq(dimi, dimk, dimk, w1, f.ptr(), tr[0].U, dimk);
+                    for (std::size_t d=1; d<NDIM-1; ++d) {
+                        if (d == NDIM-2) w2 = s;
+                        mTxmq(dimi, dimk, dimk, w2, w1, tr[d].U, dimk);
+                        std::swap(w1,w2);
                     }
-                    trans2[d]=ops_1d[d]->R;
                 }
+                const Q* MADNESS_RESTRICT U = tr[NDIM-1].U;
+                for (long i=0; i<dimk*dimk; ++i) u[i] = fac[t]*U[i];
+            }
+
+            mTxmq(dimi, dimk, nterm*dimk, work1.ptr(), stack.ptr(), ustack.ptr());
+            aligned_axpy(size, result.ptr(), work1.ptr(), Q(1.0));
+        }
+
 
-                if (!rank_is_zero)
-                    apply_transformation(twok, trans, f, work1, work2, mufac, result);
+        /// Apply all separated terms, batching the full-rank ones (see apply_transformation_batch)
 
-                //            apply_transformation2(n, twok, tol, trans2, f, work1, work2, mufac, result);
-//                apply_transformation3(trans2, f, mufac, result);
+        /// Terms needing low-rank transformations are applied one at a time
+        /// by muopxv_fast as before.
+        /// @param[in]  nbatch  max number of terms per batch
+        template <typename T>
+        void muopxv_batched(ApplyTerms at,
+                            const SeparatedConvolutionData<Q,NDIM>* op,
+                            const long nbatch,
+                            const Tensor<T>& f, const Tensor<T>& f0,
+                            Tensor<TENSOR_RESULT_TYPE(T,Q)>& result,
+                            Tensor<TENSOR_RESULT_TYPE(T,Q)>& result0,
+                            const double tol,
+                            Tensor<TENSOR_RESULT_TYPE(T,Q)>& work1,
+                            Tensor<TENSOR_RESULT_TYPE(T,Q)>& work2) const {
+
+            typedef TENSOR_RESULT_TYPE(T,Q) resultT;
+            long twok = 2*k;
+            if (modified()) twok=k;
+            long size2k = 1, sizek = 1;
+            for (std::size_t d=0; d<NDIM; ++d) {
+                size2k *= twok;
+                sizek *= k;
             }
 
-            double Tnorm = 1.0;
-            for (std::size_t d=0; d<NDIM; ++d) Tnorm *= ops_1d[d]->Tnorm;
+            std::vector<Transformation> rtrans, ttrans;
+            std::vector<Q> rfac, tfac;
+            rtrans.reserve(nbatch*NDIM);
+            ttrans.reserve(nbatch*NDIM);
+            rfac.reserve(nbatch);
+            tfac.reserve(nbatch);
+            Tensor<resultT> rstack, tstack;
+            Tensor<Q> rustack, tustack;
+
+            auto full_rank = [](const Transformation trans[NDIM]) {
+                for (std::size_t d=0; d<NDIM; ++d) if (trans[d].VT) return false;
+                return true;
+            };
+            auto flush_r = [&]() {
+                if (rfac.empty()) return;
+                if (rstack.size() == 0) {
+                    rstack = ScratchTensorPool<resultT>::borrow(std::vector<long>(1,nbatch*size2k), false);
+                    rustack = ScratchTensorPool<Q>::borrow(std::vector<long>(1,nbatch*twok*twok), false);
+                }
+                apply_transformation_batch(twok, long(rfac.size()), rtrans.data(), rfac.data(),
+                                           f, work1, work2, rstack, rustack, result);
+                rtrans.clear();
+                rfac.clear();
+            };
+            auto flush_t = [&]() {
+                if (tfac.empty()) return;
+                if (tstack.size() == 0) {
+                    tstack = ScratchTensorPool<resultT>::borrow(std::vector<long>(1,nbatch*sizek), false);
+                    tustack = ScratchTensorPool<Q>::borrow(std::vector<long>(1,nbatch*k*k), false);
+                }
+                apply_transformation_batch(long(k), long(tfac.size()), ttrans.data(), tfac.data(),
+                                           f0, work1, work2, tstack, tustack, result0);
+                ttrans.clear();
+                tfac.clear();
+            };
 
-            if (at.t_term and (Tnorm>0.0)) {
-                const auto tol_Ts = tol/(Tnorm*NDIM);  // Errors are relative within here
+            for (int mu=0; mu<rank; ++mu) {
+                const SeparatedConvolutionInternal<Q,NDIM>& muop = op->muops[mu];
+                if (not (muop.norm > tol)) continue;
 
-                long break_even;
-                if (NDIM==1) break_even = long(0.5*k);
-                else if (NDIM==2) break_even = long(0.6*k);
-                else if (NDIM==3) break_even=long(0.65*k);
-                else break_even=long(0.7*k);
-                bool rank_is_zero = false;
-                for (std::size_t d=0; d<NDIM; ++d) {
-                    long r;
-                    for (r=0; r<k; ++r) {
-                        if (ops_1d[d]->Ts[r] < tol_Ts) break;
-                    }
-                    if (r >= break_even) {
-                        trans[d].r = k;
-                        trans[d].U = ops_1d[d]->T.ptr();
-                        trans[d].VT = 0;
+                const Q fac = ops[mu].getfac();
+                const double mutol = tol/std::abs(fac);
+                Transformation trans[NDIM];
+
+                if (at.r_term and make_transformation(muop.ops, true, mutol, trans)) {
+                    if (full_rank(trans)) {
+                        rtrans.insert(rtrans.end(), trans, trans+NDIM);
+                        rfac.push_back(fac);
+                        if (long(rfac.size()) == nbatch) flush_r();
                     }
                     else {
+                        apply_transformation(twok, trans, f, work1, work2, fac, result);
+                    }
+                }
 
-#ifdef USE_GENTENSOR
-                        r = std::max(2L,r+(r&1L)); // (needed for 6D == GENTENSOR is USED) NOLONGER NEED TO FORCE OPERATOR RANK TO BE EVEN
-#endif
-                        if (r == 0) {
-                            rank_is_zero = true;
-                            break;
-                        }
-                        trans[d].r = r;
-                        trans[d].U = ops_1d[d]->TU.ptr();
-                        trans[d].VT = ops_1d[d]->TVT.ptr();
+                if (at.t_term and make_transformation(muop.ops, false, mutol, trans)) {
+                    if (full_rank(trans)) {
+                        ttrans.insert(ttrans.end(), trans, trans+NDIM);
+                        tfac.push_back(-fac);
+                        if (long(tfac.size()) == nbatch) flush_t();
+                    }
+                    else {
+                        apply_transformation(k, trans, f0, work1, work2, -fac, result0);
                     }
-                    trans2[d]=ops_1d[d]->T;
                 }
-                if (!rank_is_zero)
-                    apply_transformation(k, trans, f0, work1, work2, -mufac, result0);
-//                apply_transformation2(n, k, tol, trans2, f0, work1, work2, -mufac, result0);
-//                apply_transformation3(trans2, f0, -mufac, result0);
             }
+            flush_r();
+            flush_t();
         }
 
 
@@ -834,7 +1088,8 @@ namespace madness {
         /// @return pointer to cached operator
         const SeparatedConvolutionData<Q,NDIM>* getop_ns(Level n, const Key<NDIM>& d) const {
             //PROFILE_MEMBER_FUNC(SeparatedConvolution); // Too fine grain for routine profiling
-            const SeparatedConvolutionData<Q,NDIM>* p = data.getptr(n,d);
+            const long idx = flat_data.index(n, d.translation());
+            const SeparatedConvolutionData<Q,NDIM>* p = (idx >= 0) ? flat_data.getptr(n,idx) : data.getptr(n,d);
             if (p) return p;
 
             // get the data for each term
@@ -852,6 +1107,7 @@ namespace madness {
             }
 	    //print("getop", n, d, norm);
             op.norm = sqrt(norm);
+            if (idx >= 0) return flat_data.set(n, idx, std::move(op));
             data.set(n, d, op);
             return data.getptr(n,d);
         }
@@ -871,10 +1127,15 @@ namespace madness {
 
             // in the modified NS form the upsampled part of the operator depends on the modulus of the source
             Vector<Translation,NDIM> t=source.translation();
-            for (size_t i=0; i<NDIM; ++i) t[i]=t[i]%2;
+            long parity=0;
+            for (size_t i=0; i<NDIM; ++i) {
+                t[i]=t[i]%2;
+                if (t[i]) parity |= 1L<<i;
+            }
             Key<2*NDIM> key=disp.merge_with(Key<NDIM>(source.level(),t));
 
-            const SeparatedConvolutionData<Q,NDIM>* p = mod_data.getptr(n,key);
+            const long idx = (source.level() == n) ? flat_mod_data.index(n, disp.translation(), parity) : -1;
+            const SeparatedConvolutionData<Q,NDIM>* p = (idx >= 0) ? flat_mod_data.getptr(n,idx) : mod_data.getptr(n,key);
             if (p) return p;
 
             // get the data for each term
@@ -890,11 +1151,43 @@ namespace madness {
             }
 
             op.norm = sqrt(norm);
+            if (idx >= 0) return flat_mod_data.set(n, idx, std::move(op));
             mod_data.set(n, key, op);
             return mod_data.getptr(n,key);
         }
 
 
+    public:
+        /// precompute the operator for all standard displacements at level \c n
+
+        /// Afterwards lookups at level \c n in apply() are lock-free and never
+        /// construct operator data.  FunctionImpl::apply() does this for the
+        /// levels of the source function if prefill() is set; otherwise, and
+        /// for entries still missing, the data are computed on first use.
+        /// Every displacement of get_disp(n) is built, including those that
+        /// screening would skip, so this is costly in high dimensions.
+        void prefill_cache(Level n) const {
+            auto& cache = modified() ? flat_mod_data : flat_data;
+            if (cache.is_filled(n)) return;
+            for (const Key<NDIM>& d : get_disp(n)) {
+                if (not modified()) {
+                    if (flat_data.index(n, d.translation()) >= 0) getop_ns(n, d);
+                }
+                else {
+                    for (long parity=0; parity<(1L<<NDIM); ++parity) {
+                        Vector<Translation,NDIM> t;
+                        for (size_t i=0; i<NDIM; ++i) t[i] = (parity>>i) & 1;
+                        if (flat_mod_data.index(n, d.translation(), parity) >= 0)
+                            getop_modified(n, d, Key<NDIM>(n,t));
+                    }
+                }
+            }
+            cache.set_filled(n);
+        }
+
+    private:
+
+
         void check_cubic() {
             // !!! NB ... cell volume obtained from global defaults
             const Tensor<double>& cell_width = FunctionDefaults<NDIM>::get_cell_width();
@@ -1025,6 +1318,7 @@ namespace madness {
             }
             init_range();
             init_lattice_summed();
+            attach_cache_file();
 
             this->process_pending();
         }
@@ -1051,6 +1345,7 @@ namespace madness {
         {
             init_range();
             init_lattice_summed();
+            attach_cache_file();
             this->process_pending();
         }
 
@@ -1069,6 +1364,7 @@ namespace madness {
             ops.resize(rank);
             initialize(coeff,expnt,range);
             init_lattice_summed();
+            attach_cache_file();
         }
 
         /// Constructor for Gaussian Convolutions (mostly for backward compatability)
@@ -1094,6 +1390,7 @@ namespace madness {
             initialize(coeff,expnt);
             init_range();
             init_lattice_summed();
+            attach_cache_file();
         }
 
         void initialize(const Tensor<Q>& coeff, const Tensor<double>& expnt, std::array<KernelRange, NDIM> range = {}) {
@@ -1150,9 +1447,33 @@ namespace madness {
                 }
             }
             init_lattice_summed();
+            attach_cache_file();
         }
 
-        virtual ~SeparatedConvolution() { }
+        virtual ~SeparatedConvolution() {
+            if (initialized()) save_cache_file();
+        }
+
+        /// Writes the matrices computed by all terms, merged with those on file, to the operator cache file
+
+        /// Only the first process of each node writes, so a job updates the
+        /// file once per node rather than once per process.  The destructor
+        /// calls this while MADNESS is initialized; operators that outlive
+        /// finalize() must call it before.  Does nothing if not backed by a
+        /// file or if every matrix came from the file.
+        void save_cache_file() const {
+            if (cache_file_path.empty()) return;
+            const std::vector<int>& leader = detail::WorldMpi::node_leaders();
+            const int me = SafeMPI::COMM_WORLD.Get_rank();
+            if (!leader.empty() && leader[me] != me) return;
+            const auto kernels = cache_kernels();
+            if (std::none_of(kernels.begin(), kernels.end(), [](const auto& r) {return r.first->has_unsaved_records();}))
+                return;
+            OperatorCacheFile::recordsT records;
+            for (const auto& [op, aux] : kernels) op->append_cache_records(records, aux);
+            if (OperatorCacheFile::update(cache_file_path, cache_file_header, std::move(records)))
+                for (const auto& r : kernels) r.first->set_records_saved();
+        }
 
         void print_timer() const {
         	if (this->get_world().rank()==0) {
@@ -1275,12 +1596,15 @@ namespace madness {
         /// @param[in]  source  the source key
         /// @param[in]  shift   the displacement, where the source coeffs come from
         /// @param[in]  tol     thresh/#neigh*cnorm
+        /// @param[in]  scratch_result  if true the result is borrowed from the calling thread's
+        ///                     ScratchTensorPool (for results that are consumed right away)
         /// @return     a tensor of full rank with the result op(coeff)
         template <typename T>
         Tensor<TENSOR_RESULT_TYPE(T,Q)> apply(const Key<NDIM>& source,
                                               const Key<NDIM>& shift,
                                               const Tensor<T>& coeff,
-                                              double tol) const {
+                                              double tol,
+                                              bool scratch_result=false) const {
             //PROFILE_MEMBER_FUNC(SeparatedConvolution); // Too fine grain for routine profiling
             MADNESS_ASSERT(coeff.ndim()==NDIM);
 
@@ -1298,7 +1622,7 @@ namespace madness {
                     // it is not necessary.  It is necessary for operators such
                     // as differentiation and time evolution and will also occur
                     // if the application of the operator widens the tree.
-                    dummy = Tensor<T>(v2k);
+                    dummy = ScratchTensorPool<T>::borrow(v2k);
                     dummy(s0) = coeff;
                     input = &dummy;
                 }
@@ -1317,24 +1641,55 @@ namespace madness {
 
             //print("sepop",source,shift,op->norm,tol);
 
-            Tensor<resultT> r(v2k), r0(vk);
-            Tensor<resultT> work1(v2k,false), work2(v2k,false);
+            // everything but the result comes from the per-thread scratch pool
+            const std::vector<long>& vr = modified() ? vk : v2k;
+            Tensor<resultT> r = scratch_result ? ScratchTensorPool<resultT>::borrow(vr) : Tensor<resultT>(vr);
+            Tensor<resultT> r0 = ScratchTensorPool<resultT>::borrow(vk);
+            Tensor<resultT> work1 = ScratchTensorPool<resultT>::borrow(vr,false);
+            Tensor<resultT> work2 = ScratchTensorPool<resultT>::borrow(vr,false);
 
-            if (modified()) {
-                   r=Tensor<resultT>(vk);
-                   work1=Tensor<resultT>(vk,false);
-                   work2=Tensor<resultT>(vk,false);
+            Tensor<T> f0 = ScratchTensorPool<T>::borrow(vk,false);
+            f0(s0) = coeff(s0);
+
+            // batch as many terms as fit into the stack budget
+            long size = 1;
+            for (std::size_t d=0; d<NDIM; ++d) size *= (modified() ? k : 2*k);
+            const long nbatch = std::min(apply_batch, std::max(1L, apply_batch_stack_size/size));
+
+            // single precision if even the largest term allows it (see OperatorInfo::single_precision)
+            SinglePrecisionWork swork;
+            SinglePrecisionWork* sp = nullptr;
+            if constexpr (std::is_same<T,double>::value && std::is_same<Q,double>::value) {
+                const long dimk = modified() ? k : 2*k;
+                if (info.single_precision and single_precision_ok(op->norm, dimk, tol)) {
+                    swork.f = ScratchTensorPool<float>::borrow(vr,false);
+                    swork.f0 = ScratchTensorPool<float>::borrow(vk,false);
+                    swork.work1 = ScratchTensorPool<float>::borrow(vr,false);
+                    swork.work2 = ScratchTensorPool<float>::borrow(vr,false);
+                    swork.mat = ScratchTensorPool<float>::borrow(std::vector<long>(1,2*NDIM*dimk*dimk),false);
+                    float* MADNESS_RESTRICT pf = swork.f.ptr();
+                    const double* p = input->ptr();
+                    for (long i=0; i<swork.f.size(); ++i) pf[i] = float(p[i]);
+                    pf = swork.f0.ptr();
+                    p = f0.ptr();
+                    for (long i=0; i<swork.f0.size(); ++i) pf[i] = float(p[i]);
+                    sp = &swork;
+                }
             }
 
-            const Tensor<T> f0 = copy(coeff(s0));
-            for (int mu=0; mu<rank; ++mu) {
-                // SeparatedConvolutionInternal keeps data for 1 term and all dimensions and 1 displacement
-                const SeparatedConvolutionInternal<Q,NDIM>& muop =  op->muops[mu];
-                if (muop.norm > tol) {
-                    // ops is of ConvolutionND, returns data for 1 term and all dimensions
-                    Q fac = ops[mu].getfac();
-                    muopxv_fast(at, muop.ops, *input, f0, r, r0, tol/std::abs(fac), fac,
-                                work1, work2);
+            if (nbatch > 1 and not sp) {
+                muopxv_batched(at, op, nbatch, *input, f0, r, r0, tol, work1, work2);
+            }
+            else {
+                for (int mu=0; mu<rank; ++mu) {
+                    // SeparatedConvolutionInternal keeps data for 1 term and all dimensions and 1 displacement
+                    const SeparatedConvolutionInternal<Q,NDIM>& muop =  op->muops[mu];
+                    if (muop.norm > tol) {
+                        // ops is of ConvolutionND, returns data for 1 term and all dimensions
+                        Q fac = ops[mu].getfac();
+                        muopxv_fast(at, muop.ops, *input, f0, r, r0, tol/std::abs(fac), fac,
+                                    work1, work2, sp);
+                    }
                 }
             }
 
@@ -1382,7 +1737,8 @@ namespace madness {
             const SeparatedConvolutionData<Q,NDIM>* op = getop(source.level(), shift, source);
 
             // some workspace
-            Tensor<resultT> work1(v2k,false), work2(v2k,false);
+            Tensor<resultT> work1 = ScratchTensorPool<resultT>::borrow(v2k,false);
+            Tensor<resultT> work2 = ScratchTensorPool<resultT>::borrow(v2k,false);
 
             // sliced input and final result
             const GenTensor<T> f0 = copy(coeff(s00));
@@ -0,0 +1,227 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+
+  $Id$
+*/
+
+/// \file mra/operatorcache.cc
+/// \brief Memory-mapped file of operator matrices shared between runs
+
+#include <madness/mra/operatorcache.h>
+#include <madness/world/safempi.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace madness {
+
+    namespace {
+        const char magic[8] = {'M','A','D','O','P','C','0','1'};
+
+        std::size_t pad8(std::size_t n) { return (n + 7) & ~std::size_t(7); }
+
+        bool write_all(int fd, const void* p, std::size_t n) {
+            const char* c = static_cast<const char*>(p);
+            while (n) {
+                ssize_t w = ::write(fd, c, n);
+                if (w <= 0) return false;
+                c += w;
+                n -= w;
+            }
+            return true;
+        }
+
+        /// host, MPI rank (-1 outside MPI) and pid, unique among all writers of a shared file system
+        std::string writer_name() {
+            char host[256] = "unknown";
+            gethostname(host, sizeof(host));
+            host[sizeof(host)-1] = 0;
+            int rank = -1;
+            if (SafeMPI::Is_initialized() && !SafeMPI::Is_finalized()) rank = SafeMPI::COMM_WORLD.Get_rank();
+            return std::string(host) + "." + std::to_string(rank) + "." + std::to_string(getpid());
+        }
+    }
+
+    const std::string& OperatorCacheFile::directory() {
+        static const std::string dir = getenv("MAD_OPERATOR_CACHE_DIR") ? getenv("MAD_OPERATOR_CACHE_DIR") : "";
+        return dir;
+    }
+
+    std::string OperatorCacheFile::filename(const std::string& tag, std::size_t hash) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%016zx", hash);
+        return directory() + "/" + tag + "-" + buf + ".opc";
+    }
+
+    void OperatorCacheFile::close() {
+        if (base) munmap(base, length);
+        base = nullptr;
+        length = 0;
+        index = nullptr;
+        nrec = 0;
+    }
+
+    bool OperatorCacheFile::open(const std::string& path, const bytesT& header) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < 24) {
+            ::close(fd);
+            return false;
+        }
+        void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) return false;
+
+        // validate magic, header and that the index and all records lie inside the file
+        const unsigned char* c = static_cast<const unsigned char*>(p);
+        const std::size_t size = st.st_size;
+        std::uint64_t hlen = 0, n = 0;
+        bool ok = std::memcmp(c, magic, sizeof(magic)) == 0;
+        if (ok) {
+            std::memcpy(&hlen, c+8, sizeof(hlen));
+            ok = hlen == header.size() && 16 + pad8(hlen) + 8 <= size
+                && std::memcmp(c+16, header.data(), hlen) == 0;
+        }
+        std::size_t pos = 16 + pad8(hlen);
+        if (ok) {
+            std::memcpy(&n, c+pos, sizeof(n));
+            pos += 8;
+            ok = n <= (size - pos)/sizeof(IndexEntry);
+        }
+        if (ok) {
+            const IndexEntry* e = reinterpret_cast<const IndexEntry*>(c+pos);
+            for (std::uint64_t i=0; ok && i<n; ++i)
+                ok = e[i].offset <= size && e[i].nbyte <= size - e[i].offset;
+        }
+        if (!ok) {
+            munmap(p, size);
+            return false;
+        }
+
+        base = p;
+        length = size;
+        index = reinterpret_cast<const IndexEntry*>(c+pos);
+        nrec = n;
+        return true;
+    }
+
+    const unsigned char* OperatorCacheFile::find(const RecordKey& key, std::size_t& nbyte) const {
+        const IndexEntry* end = index + nrec;
+        const IndexEntry* e = std::lower_bound(index, end, key,
+                                               [](const IndexEntry& a, const RecordKey& k) {return a.key < k;});
+        if (e == end || !(e->key == key)) return nullptr;
+        nbyte = e->nbyte;
+        return static_cast<const unsigned char*>(base) + e->offset;
+    }
+
+    void OperatorCacheFile::merge_into(recordsT& records) const {
+        const unsigned char* c = static_cast<const unsigned char*>(base);
+        for (std::size_t i=0; i<nrec; ++i) {
+            const IndexEntry& e = index[i];
+            if (records.count(e.key)) continue;
+            records[e.key] = bytesT(c + e.offset, c + e.offset + e.nbyte);
+        }
+    }
+
+    bool OperatorCacheFile::write(const std::string& path, const bytesT& header, const recordsT& records) {
+        const std::string tmp = path + ".tmp." + writer_name();
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+
+        const std::uint64_t hlen = header.size(), n = records.size();
+        std::vector<IndexEntry> idx;
+        idx.reserve(n);
+        std::uint64_t offset = 16 + pad8(hlen) + 8 + n*sizeof(IndexEntry);
+        for (const auto& r : records) {
+            idx.push_back(IndexEntry{r.first, offset, r.second.size()});
+            offset += pad8(r.second.size());
+        }
+
+        const char zeros[8] = {0};
+        bool ok = write_all(fd, magic, sizeof(magic))
+            && write_all(fd, &hlen, sizeof(hlen))
+            && write_all(fd, header.data(), hlen)
+            && write_all(fd, zeros, pad8(hlen) - hlen)
+            && write_all(fd, &n, sizeof(n))
+            && write_all(fd, idx.data(), n*sizeof(IndexEntry));
+        for (auto r=records.begin(); ok && r!=records.end(); ++r) {
+            ok = write_all(fd, r->second.data(), r->second.size())
+                && write_all(fd, zeros, pad8(r->second.size()) - r->second.size());
+        }
+        ok = (::close(fd) == 0) && ok;
+        if (ok) ok = (rename(tmp.c_str(), path.c_str()) == 0);
+        if (!ok) unlink(tmp.c_str());
+        return ok;
+    }
+
+    bool OperatorCacheFile::update(const std::string& path, const bytesT& header, recordsT records) {
+        // fcntl locks exclude other processes only, the mutex excludes other threads of this one
+        static std::mutex mutex;
+        std::lock_guard<std::mutex> guard(mutex);
+
+        const std::string lockname = path + ".lock";
+        int lockfd = ::open(lockname.c_str(), O_RDWR | O_CREAT, 0644);
+        if (lockfd < 0) return false;
+        struct flock lock;
+        std::memset(&lock, 0, sizeof(lock));
+        lock.l_type = F_WRLCK;
+        lock.l_whence = SEEK_SET;
+        int rc;
+        while ((rc = fcntl(lockfd, F_SETLKW, &lock)) != 0 && errno == EINTR);
+        if (rc != 0) {
+            ::close(lockfd);
+            return false;
+        }
+
+        bool ok = true;
+        {
+            OperatorCacheFile current;
+            std::size_t nnew = records.size();
+            if (current.open(path, header)) {
+                std::size_t nbyte;
+                for (const auto& r : records) if (current.find(r.first, nbyte)) --nnew;
+                current.merge_into(records);
+            }
+            if (nnew > 0) ok = write(path, header, records);
+        }
+        ::close(lockfd);        // releases the lock
+        return ok;
+    }
+
+}
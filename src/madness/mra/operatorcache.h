@@ -0,0 +1,200 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+
+  $Id$
+*/
+#ifndef MADNESS_MRA_OPERATORCACHE_H__INCLUDED
+#define MADNESS_MRA_OPERATORCACHE_H__INCLUDED
+
+/// \file mra/operatorcache.h
+/// \brief Memory-mapped file of operator matrices shared between runs
+
+#include <madness/tensor/tensor.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace madness {
+
+    /// Read-only, memory-mapped file of binary records keyed by (kind, level, translation, aux)
+
+    /// Used by Convolution1D to warm-start its caches from matrices computed by
+    /// earlier runs.  The file is selected by the directory in the environment
+    /// variable \c MAD_OPERATOR_CACHE_DIR (the feature is off if unset) and a
+    /// hash of the kernel parameters; the full parameter blob is stored in the
+    /// file and compared byte for byte on open so that hash collisions or
+    /// stale files are simply ignored.
+    ///
+    /// Layout: magic, header length, header, number of records, a sorted index
+    /// of (key, offset, nbyte) and then the 8-byte aligned record data.  Files
+    /// are replaced atomically by write(), so readers in other processes keep
+    /// a consistent (if older) view; update() serializes the writers.  Records
+    /// are validated against their size when they are extracted, and a record
+    /// that does not fit is treated as missing.
+    class OperatorCacheFile {
+    public:
+        struct RecordKey {
+            std::int32_t kind;
+            std::int32_t n;
+            std::int64_t l;
+            std::int64_t aux;
+
+            bool operator<(const RecordKey& b) const {
+                if (kind != b.kind) return kind < b.kind;
+                if (n != b.n) return n < b.n;
+                if (l != b.l) return l < b.l;
+                return aux < b.aux;
+            }
+            bool operator==(const RecordKey& b) const {
+                return kind==b.kind && n==b.n && l==b.l && aux==b.aux;
+            }
+        };
+
+        typedef std::vector<unsigned char> bytesT;
+        typedef std::map<RecordKey, bytesT> recordsT;
+
+    private:
+        struct IndexEntry {
+            RecordKey key;
+            std::uint64_t offset;
+            std::uint64_t nbyte;
+        };
+
+        void* base = nullptr;               ///< start of the mapping
+        std::size_t length = 0;             ///< length of the mapping
+        const IndexEntry* index = nullptr;  ///< sorted index inside the mapping
+        std::size_t nrec = 0;               ///< number of records
+
+        void close();
+
+    public:
+        OperatorCacheFile() = default;
+        OperatorCacheFile(const OperatorCacheFile&) = delete;
+        OperatorCacheFile& operator=(const OperatorCacheFile&) = delete;
+        ~OperatorCacheFile() { close(); }
+
+        /// Directory holding the cache files (empty if the feature is disabled)
+        static const std::string& directory();
+
+        /// Full path of the cache file for kernel family \c tag and parameter hash \c hash
+        static std::string filename(const std::string& tag, std::size_t hash);
+
+        /// Maps \c path if it exists and was written with the same \c header; returns true on success
+        bool open(const std::string& path, const bytesT& header);
+
+        /// True if a file is mapped
+        bool is_open() const { return base != nullptr; }
+
+        /// Number of records in the mapped file
+        std::size_t size() const { return nrec; }
+
+        /// Pointer to the data of record \c key and its size in bytes, or NULL if not present
+        const unsigned char* find(const RecordKey& key, std::size_t& nbyte) const;
+
+        /// Adds all records of the mapped file that are not already in \c records
+        void merge_into(recordsT& records) const;
+
+        /// Writes \c records to \c path via a temporary file and rename; returns true on success
+
+        /// The temporary file is named after the host, MPI rank and pid of the writer.
+        static bool write(const std::string& path, const bytesT& header, const recordsT& records);
+
+        /// Adds \c records to the file at \c path, keeping the records already on file
+
+        /// Holds an exclusive lock on \c path.lock while the current file is read
+        /// again, merged and replaced, so that ranks and jobs writing the same
+        /// file do not drop each other's records.  Nothing is written if the
+        /// file already holds all of \c records.  Returns true on success.
+        static bool update(const std::string& path, const bytesT& header, recordsT records);
+
+        /// Appends the raw bytes of \c n objects at \c p to \c buf
+        template <typename T>
+        static void append(bytesT& buf, const T* p, std::size_t n=1) {
+            const unsigned char* c = reinterpret_cast<const unsigned char*>(p);
+            buf.insert(buf.end(), c, c + n*sizeof(T));
+        }
+
+        /// Copies \c n objects out of \c p and advances \c p; returns false if that would read past \c end
+        template <typename T>
+        static bool extract(const unsigned char*& p, const unsigned char* end, T* out, std::size_t n=1) {
+            if (n > std::size_t(end - p)/sizeof(T)) return false;
+            std::memcpy(out, p, n*sizeof(T));
+            p += n*sizeof(T);
+            return true;
+        }
+
+        /// Appends the dimensions and (contiguous) elements of \c t to \c buf
+        template <typename T>
+        static void append_tensor(bytesT& buf, const Tensor<T>& t) {
+            const std::int64_t ndim = t.ndim();
+            append(buf, &ndim);
+            if (ndim <= 0) return;
+            for (long i=0; i<ndim; ++i) {
+                const std::int64_t d = t.dim(i);
+                append(buf, &d);
+            }
+            const Tensor<T> c = t.iscontiguous() ? t : copy(t);
+            append(buf, c.ptr(), c.size());
+        }
+
+        /// Reads a tensor written by append_tensor() and advances \c p
+
+        /// Returns false if the dimensions are invalid or the elements extend past \c end.
+        template <typename T>
+        static bool extract_tensor(const unsigned char*& p, const unsigned char* end, Tensor<T>& t) {
+            std::int64_t ndim;
+            if (!extract(p, end, &ndim) || ndim > TENSOR_MAXDIM) return false;
+            if (ndim <= 0) {
+                t = Tensor<T>();
+                return true;
+            }
+            long dims[TENSOR_MAXDIM];
+            std::size_t size = 1;
+            const std::size_t maxsize = std::size_t(end - p)/sizeof(T);
+            for (long i=0; i<ndim; ++i) {
+                std::int64_t d;
+                if (!extract(p, end, &d) || d < 0) return false;
+                if (d > 0 && size > maxsize/std::size_t(d)) return false;
+                size *= d;
+                dims[i] = d;
+            }
+            if (size > std::size_t(end - p)/sizeof(T)) return false;
+            t = Tensor<T>(ndim, dims, false);
+            return extract(p, end, t.ptr(), t.size());
+        }
+    };
+
+}
+
+#endif // MADNESS_MRA_OPERATORCACHE_H__INCLUDED
@@ -68,6 +68,7 @@ struct OperatorInfo {
     std::vector<KernelRange> range = std::vector<KernelRange>(6);
     bool debug=false;
     std::optional<bool> truncate_lowexp_gaussians;  // if given, overrides the default for whether to truncate low-exponent gaussians
+    bool single_precision=false;  ///< apply in single precision (accumulating in double) where the requested tolerance allows
 
     template <std::size_t NDIM>
     std::array<KernelRange, NDIM> range_as_array() const {
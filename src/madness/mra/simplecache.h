@@ -36,6 +36,9 @@
 #include <madness/mra/key.h>
 #include <madness/world/worldhashmap.h>
 
+#include <atomic>
+#include <cstdint>
+
 namespace madness {
     /// Simplified interface around hash_map to cache stuff for 1D
 
@@ -50,6 +53,8 @@ namespace madness {
         mapT cache;
 
     public:
+        typedef typename mapT::const_iterator const_iterator;
+
         SimpleCache() : cache() {};
 
         SimpleCache(const SimpleCache& c) : cache(c.cache) {};
@@ -102,6 +107,121 @@ namespace madness {
             Key<NDIM> key(n,disp.translation());
             set(key, val);
         }
+
+        /// Iteration over the cached (key,value) pairs ... not safe against concurrent insertion
+        const_iterator begin() const { return cache.begin(); }
+        const_iterator end() const { return cache.end(); }
+    };
+
+    /// Dense, lock-free, write-once cache indexed by level and displacement
+
+    /// Operators are applied with a small, fixed set of displacements at each
+    /// level (see Displacements), so rather than hashing the key the value for
+    /// displacement \c l at level \c n lives in a flat per-level array at
+    /// index \c ((l[0]+bmax)*(2*bmax+1) + l[1]+bmax)*... , optionally with
+    /// \c nsub sub-slots per displacement (e.g.\ the parity of the source box in
+    /// the modified NS form).  The array for a level is allocated on first use.
+    ///
+    /// Lookups are a single acquire load.  Values are published with
+    /// compare-and-swap and the first writer wins, so as with SimpleCache
+    /// pointers to cached data are never invalidated.  Displacements outside
+    /// the box have index -1 and must be cached elsewhere.
+    template <typename Q, std::size_t NDIM>
+    class FlatLevelCache {
+    public:
+        static const Level nlevel = 8*sizeof(Translation);
+
+    private:
+        typedef std::atomic<const Q*> slotT;
+
+        Translation bmax;       ///< half-width of the box of displacements (<0 disables the cache)
+        long nsub;              ///< number of sub-slots per displacement
+        long nslot;             ///< number of slots per level
+        mutable std::atomic<slotT*> levels[nlevel];
+        std::atomic<std::uint64_t> filled{0};    ///< bit n is set once level n has been filled completely
+
+        void init(Translation b, long maxslot) {
+            for (bmax=b; bmax>=0; --bmax) {
+                nslot = nsub;
+                for (std::size_t d=0; d<NDIM; ++d) nslot *= 2*bmax+1;
+                if (nslot <= maxslot) break;
+            }
+            if (bmax < 0) nslot = 0;
+            for (Level n=0; n<nlevel; ++n) levels[n].store(nullptr, std::memory_order_relaxed);
+        }
+
+        slotT* level(Level n) const {
+            slotT* p = levels[n].load(std::memory_order_acquire);
+            if (p) return p;
+            slotT* q = new slotT[nslot];
+            for (long i=0; i<nslot; ++i) q[i].store(nullptr, std::memory_order_relaxed);
+            if (levels[n].compare_exchange_strong(p, q, std::memory_order_acq_rel)) return q;
+            delete [] q;
+            return p;
+        }
+
+    public:
+        /// Makes an empty cache for displacements with |l[d]|<=bmax
+
+        /// If the resulting number of slots per level exceeds \c maxslot
+        /// the box is shrunk until it fits.
+        FlatLevelCache(Translation bmax, long nsub=1, long maxslot=1L<<18) : nsub(nsub) {
+            init(bmax, maxslot);
+        }
+
+        /// Copies the geometry but not the content (entries are recomputed on demand, no level is filled)
+        FlatLevelCache(const FlatLevelCache& c) : nsub(c.nsub) {
+            init(c.bmax, c.nslot);
+        }
+
+        FlatLevelCache& operator=(const FlatLevelCache& c) = delete;
+
+        ~FlatLevelCache() {
+            for (Level n=0; n<nlevel; ++n) {
+                slotT* p = levels[n].load(std::memory_order_acquire);
+                if (!p) continue;
+                for (long i=0; i<nslot; ++i) delete p[i].load(std::memory_order_relaxed);
+                delete [] p;
+            }
+        }
+
+        /// Index of displacement \c l (and sub-slot \c sub) at level \c n, or -1 if not cached here
+        inline long index(Level n, const Vector<Translation,NDIM>& l, long sub=0) const {
+            if (n < 0 || n >= nlevel || bmax < 0) return -1;
+            long idx = 0;
+            for (std::size_t d=0; d<NDIM; ++d) {
+                if (l[d] < -bmax || l[d] > bmax) return -1;
+                idx = idx*(2*bmax+1) + (l[d]+bmax);
+            }
+            return idx*nsub + sub;
+        }
+
+        /// If slot \c idx at level \c n is filled return pointer to cached value, otherwise return NULL
+        inline const Q* getptr(Level n, long idx) const {
+            const slotT* p = levels[n].load(std::memory_order_acquire);
+            return p ? p[idx].load(std::memory_order_acquire) : nullptr;
+        }
+
+        /// Set value in slot \c idx at level \c n unless already present; returns pointer to the cached value
+        inline const Q* set(Level n, long idx, Q&& val) {
+            slotT& slot = level(n)[idx];
+            const Q* p = slot.load(std::memory_order_acquire);
+            if (p) return p;
+            const Q* q = new Q(std::move(val));
+            if (slot.compare_exchange_strong(p, q, std::memory_order_acq_rel)) return q;
+            delete q;
+            return p;
+        }
+
+        /// True if level \c n has been marked as completely filled
+        bool is_filled(Level n) const {
+            return (filled.load(std::memory_order_acquire) >> n) & 1;
+        }
+
+        /// Marks level \c n as completely filled
+        void set_filled(Level n) {
+            filled.fetch_or(std::uint64_t(1) << n, std::memory_order_acq_rel);
+        }
     };
 }
 #endif // MADNESS_MRA_SIMPLECACHE_H__INCLUDED
@@ -164,6 +164,103 @@ int chunk_example(World &universe) {
 }
 
 
+/// test loading with all replication policies, the LRU eviction of the on-demand cache,
+/// and the node-shared store of upfront replication
+int test_replication_policies(World &universe) {
+    int success = 0;
+    std::vector<int> testvec(100);
+    for (int i=0; i<100; i++) testvec[i]=i;
+    real_function_3d f = real_factory_3d(universe).functor(gaussian(1.0));
+
+    auto store_and_load = [&](Cloud& cloud) {
+        auto vrecords = cloud.store(universe, testvec);
+        auto frecords = cloud.store(universe, f);
+        cloud.start_replication();
+
+        double error = 0.0;
+        for (int i=0; i<2; i++) {
+            auto v = cloud.load<std::vector<int>>(universe, vrecords);
+            auto f1 = cloud.load<real_function_3d>(universe, frecords);
+            for (int j=0; j<100; j++) error += std::abs(v[j] - testvec[j]);
+            error += (f1 - f).norm2();
+        }
+        return error;
+    };
+
+    for (auto policy : {Cloud::replicate_upfront, Cloud::replicate_pipelined, Cloud::fetch_on_demand}) {
+        test_output test_p("testing replication policy " + std::to_string(policy));
+        Cloud cloud(universe);
+        cloud.set_replication_policy(policy);
+        if (policy==Cloud::fetch_on_demand) cloud.set_cache_budget(1);     // evict everything but the last object
+        double error = store_and_load(cloud);
+        test_p.logger << "error " << error << std::endl;
+        universe.gop.fence();
+        // all pushes have arrived, none of the loaded records may be kept
+        const std::size_t nreplica = cloud.get_replica_size();
+        test_p.logger << "replicas left " << nreplica << std::endl;
+        success += test_p.end(error < 1.e-10 and nreplica == 0);
+        universe.gop.fence();
+    }
+    {
+        test_output test_p("testing node-shared replication");
+        Cloud cloud(universe);
+        cloud.set_replication_policy(Cloud::replicate_upfront);
+        cloud.set_node_shared(true);
+        double error = store_and_load(cloud);
+        test_p.logger << "error " << error << std::endl;
+        success += test_p.end(error < 1.e-10);
+        universe.gop.fence();
+    }
+    return success;
+}
+
+/// test that a versioned cloud reused across runs replicates only the records that changed
+/// with a node-shared store its size must not grow as records change
+int test_versioned_records(World &universe, const bool node_shared) {
+    test_output test_p(std::string("testing versioned records") + (node_shared ? " in node-shared store" : ""));
+    Cloud cloud(universe);
+    cloud.set_versioned(true);
+    cloud.set_node_shared(node_shared);
+    cloud.set_replication_policy(Cloud::replicate_upfront);
+    real_function_3d f = real_factory_3d(universe).functor(gaussian(1.0));
+    real_function_3d g = real_factory_3d(universe).functor(gaussian(2.0));
+    f.compress();                   // the error computation below would compress them, changing their records
+    g.compress();
+    const double fnorm = f.norm2();
+    const double gnorm = g.norm2();
+
+    auto run = [&]() {
+        auto frecords = cloud.store(universe, f);
+        auto grecords = cloud.store(universe, g);
+        long nreplicated = cloud.get_replicated_records();
+        cloud.start_replication();
+        nreplicated = cloud.get_replicated_records() - nreplicated;
+        universe.gop.sum(nreplicated);
+        double error = (cloud.load<real_function_3d>(universe, frecords) - f).norm2()
+                       + (cloud.load<real_function_3d>(universe, grecords) - g).norm2();
+        cloud.clear_cache(universe);
+        cloud.clear_stale();
+        return std::make_pair(nreplicated, error);
+    };
+
+    auto [n1, error1] = run();
+    const std::size_t size1 = cloud.get_node_store_size();
+    auto [n2, error2] = run();      // nothing changed
+    g.scale(2.0);                   // in place: same record, new content
+    auto [n3, error3] = run();
+    g.scale(0.5);
+    auto [n4, error4] = run();
+    const std::size_t size4 = cloud.get_node_store_size();
+    double error = error1 + error2 + error3 + error4 + std::abs(g.norm2() - gnorm) + std::abs(f.norm2() - fnorm);
+    test_p.logger << "records replicated per run " << n1 << " " << n2 << " " << n3 << " " << n4 << std::endl;
+    test_p.logger << "node-shared store size " << size1 << " " << size4 << std::endl;
+    test_p.logger << "error " << error << std::endl;
+    bool success = (n1 == 2) and (n2 == 0) and (n3 == 1) and (n4 == 1) and (error < 1.e-10);
+    if (node_shared) success = success and (size1 > 0) and (size4 == size1);
+    universe.gop.fence();
+    return test_p.end(success);
+}
+
 template<typename T> using is_world_constructible = std::is_constructible<T, World &>;
 
 
@@ -215,6 +312,7 @@ int test_custom_serialization(World& universe, Cloud& cloud) {
     typedef std::tuple<int,double,custom_serialize_tester> tupleT;
     tupleT tuple1=std::make_tuple(1,2.0,cst);
     cloud.clear();
+    universe.gop.fence();   // clear() is local, a record stored to another process must not be cleared there
     {
         auto records = cloud.store(universe, tuple1);
         auto tuple2=cloud.load<tupleT>(universe, records);
@@ -235,6 +333,9 @@ int main(int argc, char **argv) {
     chunk_example(universe);
     simple_example(universe);
     int success = 0;
+    success += test_replication_policies(universe);
+    success += test_versioned_records(universe, false);
+    success += test_versioned_records(universe, true);
     {
         Cloud cloud(universe);
 //        cloud.set_debug(true);
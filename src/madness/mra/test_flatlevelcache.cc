@@ -0,0 +1,132 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+*/
+
+/// \file test_flatlevelcache.cc
+/// \brief test the lock-free per-level operator cache
+
+#include <madness/mra/mra.h>
+#include <madness/mra/operator.h>
+#include <madness/world/test_utilities.h>
+
+#include <thread>
+
+using namespace madness;
+
+/// many threads look up and fill the same slots, every one must see the first value published
+int test_concurrent_lookups(World& world) {
+    test_output t1("testing concurrent FlatLevelCache lookups");
+    typedef FlatLevelCache<long,3> cacheT;
+    const Translation bmax = 2;
+    const long nsub = 2;
+    cacheT cache(bmax, nsub);
+
+    std::vector<Vector<Translation,3>> disps;
+    for (Translation i=-bmax; i<=bmax; ++i)
+        for (Translation j=-bmax; j<=bmax; ++j)
+            for (Translation l=-bmax; l<=bmax; ++l) disps.push_back(Vector<Translation,3>{i,j,l});
+    const Level nlevel = 4;
+    const long nslot = disps.size()*nsub;
+
+    const int nthread = 8;
+    std::vector<std::vector<const long*>> seen(nthread, std::vector<const long*>(nlevel*nslot, nullptr));
+    std::vector<std::thread> threads;
+    for (int t=0; t<nthread; ++t) {
+        threads.emplace_back([&, t]() {
+            // each thread starts at a different slot, every other one walks backwards
+            const long ntotal = nlevel*nslot;
+            for (long count=0; count<ntotal; ++count) {
+                const long i = ((t%2 ? ntotal-1-count : count) + t*ntotal/nthread) % ntotal;
+                const Level n = i/nslot;
+                const long idx = cache.index(n, disps[(i%nslot)/nsub], i%nsub);
+                const long* p = cache.getptr(n, idx);
+                if (!p) p = cache.set(n, idx, 1000*idx + n + long(t)*1000000);
+                seen[t][i] = p;
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+
+    bool consistent = true;
+    for (long i=0; i<nlevel*nslot; ++i) {
+        const Level n = i/nslot;
+        const long idx = cache.index(n, disps[(i%nslot)/nsub], i%nsub);
+        const long* p = cache.getptr(n, idx);
+        consistent = consistent and p and (*p % 1000000 == 1000*idx + n);
+        for (int t=0; t<nthread; ++t) consistent = consistent and (seen[t][i] == p);
+    }
+    t1.checkpoint(consistent, "all threads see the first published value");
+
+    t1.checkpoint(cache.index(0, Vector<Translation,3>{0,bmax+1,0}) == -1, "displacements outside the box are not cached");
+
+    cache.set_filled(2);
+    cacheT copy(cache);
+    t1.checkpoint(cache.is_filled(2) and not cache.is_filled(1), "filled levels are marked");
+    t1.checkpoint(not copy.is_filled(2) and copy.getptr(0, 0) == nullptr, "copies start empty");
+    return t1.end();
+}
+
+/// applying an operator after prefilling its cache must give the same result as without
+int test_prefill(World& world) {
+    test_output t1("testing prefilled operator cache");
+    real_function_3d f = real_factory_3d(world).functor([](const coord_3d& r) {return exp(-2.0*inner(r,r));});
+
+    SeparatedConvolution<double,3> op1 = CoulombOperator(world, 1.e-4, 1.e-6);
+    real_function_3d g1 = op1(f);
+
+    SeparatedConvolution<double,3> op2 = CoulombOperator(world, 1.e-4, 1.e-6);
+    for (Level n=0; n<4; ++n) op2.prefill_cache(n);
+    real_function_3d g2 = op2(f);
+
+    SeparatedConvolution<double,3> op3 = CoulombOperator(world, 1.e-4, 1.e-6);
+    op3.prefill()=true;
+    real_function_3d g3 = op3(f);
+
+    const double error = (g1 - g2).norm2();
+    const double error3 = (g1 - g3).norm2();
+    t1.logger << "error " << error << " " << error3 << std::endl;
+    return t1.end(error < 1.e-12*g1.norm2() and error3 < 1.e-12*g1.norm2());
+}
+
+int main(int argc, char **argv) {
+    World& world = initialize(argc, argv);
+    startup(world, argc, argv);
+    FunctionDefaults<3>::set_thresh(1.e-6);
+    FunctionDefaults<3>::set_k(6);
+    FunctionDefaults<3>::set_cubic_cell(-10, 10);
+
+    int success = 0;
+    success += test_concurrent_lookups(world);
+    success += test_prefill(world);
+
+    world.gop.fence();
+    finalize();
+    return success;
+}
@@ -125,6 +125,35 @@ int test_partitioner(World& world) {
     return 0;
 }
 
+int test_cost_model(World& world) {
+
+    using partitionT  = MacroTaskPartitioner::partitionT;
+
+    vector_real_function_1d vf= zero_functions<double,1>(world,4);
+    auto tuple3=std::make_tuple(vf,3.0,vf);
+
+    // element i costs i+1 in the first vector, the second vector has unit costs
+    MacroTaskPartitioner mtp;
+    mtp.set_min_batch_size(2).set_max_batch_size(2).set_nsubworld(2).set_dimension(2);
+    mtp.set_element_costs({1.0,2.0,3.0,4.0});
+
+    print("\n2D partitioning with element costs");
+    partitionT partition = mtp.partition_tasks(tuple3);
+    for (auto p : partition) print(p);
+
+    MADNESS_CHECK(partition.size()==4);
+    for (auto& [batch,priority] : partition) {
+        const double rowcost=(batch.input[0].begin==0) ? 3.0 : 7.0;
+        const double colcost=batch.input[1].size();
+        MADNESS_CHECK(std::abs(priority-rowcost*colcost)<1.e-12);
+    }
+
+    // full-size ranges sum over all elements
+    Batch full(Batch_1D(0,-1), Batch_1D(1,3), Batch_1D(0,-1));
+    MADNESS_CHECK(std::abs(mtp.estimated_cost(full)-20.0)<1.e-12);
+    return 0;
+}
+
 int main(int argc, char **argv) {
 
     madness::World &universe = madness::initialize(argc, argv);
@@ -134,6 +163,7 @@ int main(int argc, char **argv) {
     success+=test_batch_1D(universe);
     success+=test_batch(universe);
     success+=test_partitioner(universe);
+    success+=test_cost_model(universe);
 //    success+=test_partitioner(universe);
 //    success+=test_partitioner(universe);
 
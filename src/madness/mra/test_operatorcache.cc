@@ -0,0 +1,222 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+*/
+
+
+/// \file test_operatorcache.cc
+/// \brief test the file-backed operator cache
+
+#include <madness/mra/mra.h>
+#include <madness/mra/operatorcache.h>
+#include <madness/world/test_utilities.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace madness;
+
+namespace {
+    typedef OperatorCacheFile::RecordKey keyT;
+    typedef OperatorCacheFile::bytesT bytesT;
+    typedef OperatorCacheFile::recordsT recordsT;
+
+    bytesT tensor_record(long n, double value) {
+        Tensor<double> t(n);
+        t.fill(value);
+        bytesT buf;
+        OperatorCacheFile::append_tensor(buf, t);
+        return buf;
+    }
+
+    bool holds(const OperatorCacheFile& file, const keyT& key, long n, double value) {
+        std::size_t nbyte = 0;
+        const unsigned char* p = file.find(key, nbyte);
+        if (!p) return false;
+        Tensor<double> t;
+        const unsigned char* end = p + nbyte;
+        return OperatorCacheFile::extract_tensor(p, end, t) and p == end
+            and t.size() == n and (t - value).normf() == 0.0;
+    }
+}
+
+/// records written to a file are found again after reopening, and only under the same header
+int test_round_trip(const std::string& dir) {
+    test_output t1("testing operator cache file round trip");
+    const std::string path = dir + "/roundtrip.opc";
+    const bytesT header = {1, 2, 3, 4, 5};
+    recordsT records;
+    records[keyT{0, 3, -2, 0}] = tensor_record(10, 1.5);
+    records[keyT{1, 3, 7, 0}] = tensor_record(3, -2.0);
+    t1.checkpoint(OperatorCacheFile::write(path, header, records), "write");
+
+    OperatorCacheFile file;
+    t1.checkpoint(file.open(path, header) and file.size() == 2, "reopen");
+    t1.checkpoint(holds(file, keyT{0, 3, -2, 0}, 10, 1.5) and holds(file, keyT{1, 3, 7, 0}, 3, -2.0), "read back");
+    std::size_t nbyte;
+    t1.checkpoint(file.find(keyT{0, 3, 2, 0}, nbyte) == nullptr, "missing record");
+
+    OperatorCacheFile other;
+    bytesT wrong = header;
+    wrong.back() = 6;
+    t1.checkpoint(not other.open(path, wrong), "header with different content is rejected");
+    wrong.push_back(0);
+    t1.checkpoint(not other.open(path, wrong), "header with different length is rejected");
+    unlink(path.c_str());
+    return t1.end();
+}
+
+/// updates by writers that opened the file at different times must not drop each other's records
+int test_update(const std::string& dir) {
+    test_output t1("testing operator cache file update");
+    const std::string path = dir + "/update.opc";
+    const bytesT header = {9};
+
+    // both writers start from an empty file, as two ranks of one job would
+    recordsT first, second;
+    first[keyT{0, 1, 0, 0}] = tensor_record(4, 1.0);
+    second[keyT{0, 1, 1, 0}] = tensor_record(4, 2.0);
+    t1.checkpoint(OperatorCacheFile::update(path, header, first), "first update");
+    t1.checkpoint(OperatorCacheFile::update(path, header, second), "second update");
+
+    OperatorCacheFile file;
+    t1.checkpoint(file.open(path, header) and file.size() == 2, "both records on file");
+    t1.checkpoint(holds(file, keyT{0, 1, 0, 0}, 4, 1.0) and holds(file, keyT{0, 1, 1, 0}, 4, 2.0), "records intact");
+
+    struct stat before, after;
+    stat(path.c_str(), &before);
+    t1.checkpoint(OperatorCacheFile::update(path, header, first), "update with known records");
+    stat(path.c_str(), &after);
+    t1.checkpoint(before.st_ino == after.st_ino, "file is not rewritten if nothing is new");
+
+    unlink(path.c_str());
+    unlink((path + ".lock").c_str());
+    return t1.end();
+}
+
+/// records that are truncated or claim more elements than they hold are rejected
+int test_malformed() {
+    test_output t1("testing malformed operator cache records");
+    const bytesT good = tensor_record(6, 3.0);
+    Tensor<double> t;
+
+    const unsigned char* p = good.data();
+    t1.checkpoint(OperatorCacheFile::extract_tensor(p, good.data() + good.size(), t) and t.size() == 6, "valid record");
+
+    p = good.data();
+    t1.checkpoint(not OperatorCacheFile::extract_tensor(p, good.data() + good.size() - 1, t), "truncated data");
+    p = good.data();
+    t1.checkpoint(not OperatorCacheFile::extract_tensor(p, good.data() + 12, t), "truncated dimensions");
+
+    bytesT huge;
+    const std::int64_t ndim = 2, dim = std::int64_t(1) << 40;
+    OperatorCacheFile::append(huge, &ndim);
+    OperatorCacheFile::append(huge, &dim);
+    OperatorCacheFile::append(huge, &dim);
+    p = huge.data();
+    t1.checkpoint(not OperatorCacheFile::extract_tensor(p, huge.data() + huge.size(), t), "overflowing dimensions");
+
+    bytesT deep;
+    const std::int64_t baddim = TENSOR_MAXDIM + 1;
+    OperatorCacheFile::append(deep, &baddim);
+    p = deep.data();
+    t1.checkpoint(not OperatorCacheFile::extract_tensor(p, deep.data() + deep.size(), t), "too many dimensions");
+    return t1.end();
+}
+
+/// an operator warm-started from the file of an earlier one must give the same matrices without computing them
+int test_warm_start(World& world, const std::string& dir) {
+    test_output t1("testing operator cache warm start");
+    t1.checkpoint(OperatorCacheFile::directory() == dir, "cache directory in use");
+    if (OperatorCacheFile::directory() != dir) return t1.end();
+    const int k = 6;
+    auto kernels = [&]() {
+        std::vector<std::shared_ptr<Convolution1D<double>>> result;
+        for (double expnt : {1000.0, 10.0})
+            result.push_back(std::make_shared<GaussianConvolution1D<double>>(k, 1.0, expnt, 0, false));
+        return result;
+    };
+    std::vector<Tensor<double>> rnlp;
+    {
+        const auto g = kernels();
+        SeparatedConvolution<double,1> op(world, g, k);
+        for (Translation l=-2; l<=2; ++l) rnlp.push_back(copy(g[0]->get_rnlp(4, l)));
+        g[1]->nonstandard(3, 1);
+        op.save_cache_file();
+        t1.checkpoint(not g[0]->has_unsaved_records() and not g[1]->has_unsaved_records(), "records saved");
+    }
+    int nfile = 0;
+    if (DIR* d = opendir(OperatorCacheFile::directory().c_str())) {
+        while (dirent* e = readdir(d)) {
+            const std::string name = e->d_name;
+            if (name.size() > 4 and name.compare(name.size() - 4, 4, ".opc") == 0) ++nfile;
+        }
+        closedir(d);
+    }
+    t1.checkpoint(nfile == 1, "one cache file for all terms of the operator");
+
+    const auto g = kernels();
+    SeparatedConvolution<double,1> op(world, g, k);
+    double error = 0.0;
+    for (Translation l=-2; l<=2; ++l) error = std::max(error, (g[0]->get_rnlp(4, l) - rnlp[l+2]).normf());
+    t1.checkpoint(error == 0.0, "rnlp read back");
+    const ConvolutionData1D<double>* d = g[1]->nonstandard(3, 1);
+    t1.checkpoint(d and d->R.dim(0) == 2*k and d->T.dim(0) == k, "ns record read back");
+    t1.checkpoint(not g[0]->has_unsaved_records() and not g[1]->has_unsaved_records(), "nothing computed");
+    return t1.end();
+}
+
+int main(int argc, char **argv) {
+    // the cache directory is read once, so it has to be set before anything can look at it
+    char dirname[] = "/tmp/madopcXXXXXX";
+    const std::string dir = mkdtemp(dirname);
+    setenv("MAD_OPERATOR_CACHE_DIR", dir.c_str(), 1);
+
+    World& world = initialize(argc, argv);
+    startup(world, argc, argv);
+
+    int success = 0;
+    success += test_round_trip(dir);
+    success += test_update(dir);
+    success += test_malformed();
+    success += test_warm_start(world, dir);
+
+    if (DIR* d = opendir(dir.c_str())) {
+        while (dirent* e = readdir(d)) unlink((dir + "/" + e->d_name).c_str());
+        closedir(d);
+    }
+    rmdir(dir.c_str());
+
+    world.gop.fence();
+    finalize();
+    return success;
+}
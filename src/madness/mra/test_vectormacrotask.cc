@@ -355,6 +355,34 @@ int test_twice(World& universe, const std::vector<real_function_3d>& v3,
     return success;
 }
 
+/// a reused taskq keeps the timings of the last run apart per submission and input size
+int test_timing_history(World& universe, const std::vector<real_function_3d>& v3,
+                        const std::vector<real_function_3d>& ref) {
+    if (universe.rank() == 0) print("\nstarting timing history\n");
+    auto taskq = std::shared_ptr<MacroTaskQ>(new MacroTaskQ(universe, universe.size()));
+    MicroTask<double,3> t;
+    MacroTask task(universe, t, taskq);
+    std::vector<real_function_3d> v2(v3.begin(), v3.begin()+2);
+    int success=0;
+    std::size_t nentry=0;
+    for (int run=0; run<2; ++run) {
+        std::vector<real_function_3d> f3 = task(v3[0], 2.0, v3);
+        std::vector<real_function_3d> f2 = task(v3[0], 2.0, v2);
+        taskq->run_all();
+        success += check_vector(universe, ref, f3, "timing history, run " + std::to_string(run));
+
+        // both submissions are recorded, and only those of the last run are kept
+        const auto& history = taskq->get_timing_history();
+        std::size_t nfirst = 0;
+        for (const auto& [key, time] : history) if (key.substr(0,2) == "0 ") nfirst++;
+        if (run == 0) nentry = history.size();
+        const bool ok = (nfirst > 0) and (nfirst < history.size()) and (history.size() == nentry);
+        if (universe.rank() == 0) print("timing history of run", run, "has", history.size(), "entries", (ok ? "passed" : "failed"));
+        if (not ok) success++;
+    }
+    return success;
+}
+
 int test_task1(World& universe, const std::vector<real_function_3d>& v3) {
     if (universe.rank()==0) print("\nstarting Microtask1\n");
     MicroTask1 t1;
@@ -539,6 +567,7 @@ int main(int argc, char **argv) {
         success+=test_twice(universe,v3,ref3);
         timer1.tag("executing a task twice");
 
+        success+=test_timing_history(universe,v3,ref3);
         success+=test_task1(universe,v3);
         timer1.tag("task1 immediate execution");
 
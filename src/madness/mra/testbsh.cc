@@ -147,6 +147,44 @@ int test_bsh(World& world) {
         //if ((opferr>ferr) and (opferr>FunctionDefaults<3>::get_thresh())) success++;
         if (opferr>2*ferr) success++;
 
+        // at a loose threshold the single-precision apply must agree with the double one
+        {
+            const double thresh = 1e-4;
+            Function<T,3> fl = copy(f);
+            fl.set_thresh(thresh);
+            SeparatedConvolution<T,3> opl = BSHOperator<3>(world, mu, 1e-4, thresh);
+            Function<T,3> opfd = opl(fl);
+            opl.info.single_precision = true;
+            Function<T,3> opfs = opl(fl);
+            const double diff = (opfd - opfs).norm2();
+            if (world.rank() == 0) print("single - double precision apply", diff);
+            if (diff > thresh*opfd.norm2()) success++;
+        }
+
+        // batching the full-rank terms must only change the result by rounding
+        {
+            SeparatedConvolution<T,3> opb = BSHOperator<3>(world, mu, 1e-4, 1e-8);
+            opb.apply_batch = 1;
+            Function<T,3> op1 = opb(f);
+            opb.apply_batch = 8;
+            Function<T,3> op8 = opb(f);
+            const double diff = (op1 - op8).norm2();
+            if (world.rank() == 0) print("batched - unbatched apply", diff);
+            if (diff > 1e-12*op1.norm2()) success++;
+        }
+
+        // reusing scratch tensors must not change the result
+        {
+            SeparatedConvolution<T,3> opp = BSHOperator<3>(world, mu, 1e-4, 1e-8);
+            ScratchTensorPool<T>::enable(false);
+            Function<T,3> opnopool = opp(f);
+            ScratchTensorPool<T>::enable(true);
+            Function<T,3> oppool = opp(f);
+            const double diff = (opnopool - oppool).norm2();
+            if (world.rank() == 0) print("scratch pool - no pool apply", diff);
+            if (diff > 1e-12*oppool.norm2()) success++;
+        }
+
         // //opf.truncate();
         // Function<T,3> opinvopf = opf*(mu*mu);
         // for (int axis=0; axis<3; ++axis) {
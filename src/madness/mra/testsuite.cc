@@ -242,6 +242,25 @@ int test_basic(World& world) {
     CHECK(new_norm-norm, 1e-9, "new_norm");
     CHECK(new_err, 3e-5, "new_err");
 
+    // batched traversals must give the same trees as one task per node
+    Function<T,NDIM> g1 = FunctionFactory<T,NDIM>(world).functor(functor);
+    g1.compress();
+    g1.truncate();
+    FunctionDefaults<NDIM>::set_traversal_batch(64);
+    Function<T,NDIM> g = FunctionFactory<T,NDIM>(world).functor(functor);
+    g.compress();
+    g.truncate();
+    // norm2, size and err are collective so evaluate them on every rank
+    const double batched_norm = g.norm2()-g1.norm2();
+    const double batched_size = double(g.size())-double(g1.size());
+    CHECK(batched_norm, 1e-12, "batched truncate norm");
+    CHECK(batched_size, 0.5, "batched truncate size");
+    g.reconstruct();
+    g1.reconstruct();
+    const double batched_err = g.err(*functor)-g1.err(*functor);
+    CHECK(batched_err, 1e-12, "batched reconstruct err");
+    FunctionDefaults<NDIM>::set_traversal_batch(1);
+
     world.gop.fence();
     if (world.rank() == 0) print("projection, compression, reconstruction, truncation OK",ok,"\n\n");
     if (not ok) return 1;
@@ -785,6 +804,46 @@ int test_op(World& world) {
     }
     CHECK(re, 30*thresh, "err in test_op");
 
+    // batched traversals must match one task per node: norm_tree directly,
+    // trickle_down when apply reconstructs its non-standard result,
+    // sum_down after a 1-d push, and refine
+    {
+        GaussianConvolution1D<double> op1d(10, 1.0, 100.0, 0, false);
+        Function<T,NDIM> p1 = apply_1d_realspace_push(op1d, f, 0);
+        p1.sum_down();
+        f.norm_tree();
+
+        FunctionDefaults<NDIM>::set_traversal_batch(64);
+        Function<T,NDIM> f64 = FunctionFactory<T,NDIM>(world).functor(functor);
+        f64.reconstruct();
+        f64.norm_tree();
+        double normdiff = 0.0;
+        const auto& fcoeffs = f.get_impl()->get_coeffs();
+        for (auto it=fcoeffs.begin(); it!=fcoeffs.end(); ++it) {
+            const double n64 = f64.get_impl()->get_coeffs().find(it->first).get()->second.get_norm_tree();
+            normdiff = std::max(normdiff, std::abs(it->second.get_norm_tree() - n64));
+        }
+        world.gop.max(normdiff);
+        CHECK(normdiff, 1e-12, "batched norm_tree");
+
+        Function<T,NDIM> r64 = madness::apply(op,f64);
+        const double rdiff = (r64 - r).norm2();
+        CHECK(rdiff, 1e-12, "batched trickle_down");
+
+        Function<T,NDIM> p64 = apply_1d_realspace_push(op1d, f64, 0);
+        p64.sum_down();
+        const double pdiff = (p64 - p1).norm2();
+        CHECK(pdiff, 1e-12, "batched sum_down");
+
+        f.refine();
+        f64.refine();
+        const double sizediff = double(f64.size())-double(f.size());
+        const double refinediff = (f64 - f).norm2();
+        CHECK(sizediff, 0.5, "batched refine size");
+        CHECK(refinediff, 1e-12, "batched refine");
+        FunctionDefaults<NDIM>::set_traversal_batch(1);
+    }
+
 //     for (int i=0; i<=100; ++i) {
 //         coordT c(-10.0+20.0*i/100.0);
 //         print("           ",i,c[0],r(c),r(c)-(*fexact)(c));
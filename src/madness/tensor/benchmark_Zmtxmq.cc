@@ -0,0 +1,156 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+
+  $Id$
+*/
+
+/// \file tensor/benchmark_Zmtxmq.cc
+/// \brief Times complex*real mTxmq against real*real for the shapes used in operator apply
+
+// For each m (=k or 2k) this times (m*m,m)T*(m,m) and the three
+// chained transforms of a 3-d apply, once with complex a and real b
+// (what a real operator applied to a complex function does) and once
+// with everything real.  A complex*real product does twice the flops
+// of a real one, so equal GF/s means equal efficiency.
+//
+// m up to 40 covers 2k for k>16, beyond the x86 kernels, and
+// (m^5,m)T*(m,m) the 6-d apply.  The NO-X86 column times the
+// complex*real fallback used on hosts without AVX2 (the same as
+// running with MAD_MTXMQ_KERNEL=blas).
+
+#include <madness/world/safempi.h>
+#include <madness/world/posixmem.h>
+#include <madness/tensor/tensor.h>
+#include <madness/tensor/mxm.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <complex>
+
+typedef std::complex<double> double_complex;
+
+using namespace madness;
+
+double ran() {
+    static unsigned long seed = 76521;
+    seed = seed*1812433253 + 12345;
+    return double(seed & 0x7fffffff)*4.6566128752458e-10;
+}
+
+/// Best rate in GF/s over ntrial repeats of nloop calls of mtxmq
+template <typename cT, typename aT, typename mtxmqT>
+double time_mTxmq(mtxmqT mtxmq, long ni, long nj, long nk, cT* c, aT* a, const double* b,
+                  int ntran, double flop_per_fma, int ntrial, int nloop) {
+    const double nflop = ntran*flop_per_fma*ni*nj*nk;
+    double fastest = 0.0;
+    for (int t=0; t<ntrial; t++) {
+        double start = SafeMPI::Wtime();
+        for (int loop=0; loop<nloop; ++loop) {
+            mtxmq(ni,nj,nk,c,a,b);
+            if (ntran == 3) {
+                mtxmq(ni,nj,nk,a,c,b);
+                mtxmq(ni,nj,nk,c,a,b);
+            }
+        }
+        double used = SafeMPI::Wtime() - start;
+        double rate = 1.e-9*nflop/(used/nloop);
+        if (rate > fastest) fastest = rate;
+    }
+    return fastest;
+}
+
+int main(int argc, char * argv[]) {
+    SafeMPI::Init_thread(argc, argv, MPI_THREAD_SINGLE);
+
+    bool smalltest = false;
+    if (getenv("MAD_SMALL_TESTS")) smalltest=true;
+    for (int iarg=1; iarg<argc; iarg++) if (strcmp(argv[iarg],"--small")==0) smalltest=true;
+    const int ntrial = smalltest ? 3 : 20;
+    const int nloop = smalltest ? 10 : 100;
+
+    const long mmax = 40;          // largest m of the 3-d shapes
+    const long m6max = 12;         // largest m of the 6-d shapes
+    const long nmax = std::max(mmax*mmax*mmax, m6max*m6max*m6max*m6max*m6max*m6max);
+    double *ra, *rb, *rc;
+    double_complex *za, *zc;
+    if (posix_memalign((void **) &ra, 64, nmax*sizeof(double)) ||
+        posix_memalign((void **) &rc, 64, nmax*sizeof(double)) ||
+        posix_memalign((void **) &rb, 64, mmax*mmax*sizeof(double)) ||
+        posix_memalign((void **) &za, 64, nmax*sizeof(double_complex)) ||
+        posix_memalign((void **) &zc, 64, nmax*sizeof(double_complex))) {
+        printf("benchmark_Zmtxmq: allocation failed\n");
+        return 1;
+    }
+
+    for (long i=0; i<nmax; ++i) {
+        ra[i] = ran();
+        za[i] = double_complex(ran(),ran());
+    }
+    for (long i=0; i<mmax*mmax; ++i) rb[i] = ran();
+
+    auto dispatched = [](long ni, long nj, long nk, auto* c, const auto* a, const double* b) {
+        mTxmq(ni,nj,nk,c,a,b);
+    };
+    auto portable = [](long ni, long nj, long nk, double_complex* c, const double_complex* a, const double* b) {
+        detail::mTxmq_portable(ni,nj,nk,c,a,b,nj);
+    };
+
+#ifdef HAVE_X86_MTXMQ
+    printf("x86 kernel : %s\n", detail::mTxmq_x86_kernel_name());
+#endif
+    printf("%20s %7s %3s %3s %10s %10s %10s (GF/s)\n", "type", "M", "N", "K", "REAL", "CPLX*REAL", "NO-X86");
+    for (long m=4; m<=mmax; m+=2) {
+        double r = time_mTxmq(dispatched,m*m,m,m,rc,ra,rb,1,2.0,ntrial,nloop);
+        double z = time_mTxmq(dispatched,m*m,m,m,zc,za,rb,1,4.0,ntrial,nloop);
+        double p = time_mTxmq(portable,m*m,m,m,zc,za,rb,1,4.0,ntrial,nloop);
+        printf("%20s %7ld %3ld %3ld %10.2f %10.2f %10.2f\n","(m*m,m)T*(m,m)",m*m,m,m,r,z,p);
+    }
+    for (long m=4; m<=mmax; m+=2) {
+        double r = time_mTxmq(dispatched,m*m,m,m,rc,ra,rb,3,2.0,ntrial,nloop);
+        double z = time_mTxmq(dispatched,m*m,m,m,zc,za,rb,3,4.0,ntrial,nloop);
+        double p = time_mTxmq(portable,m*m,m,m,zc,za,rb,3,4.0,ntrial,nloop);
+        printf("%20s %7ld %3ld %3ld %10.2f %10.2f %10.2f\n","tran(m,m,m)",m*m,m,m,r,z,p);
+    }
+    for (long m=4; m<=m6max; m+=2) {
+        const long m5 = m*m*m*m*m;
+        const int nloop6 = std::max(1L, nloop*1000/m5);
+        double r = time_mTxmq(dispatched,m5,m,m,rc,ra,rb,1,2.0,ntrial,nloop6);
+        double z = time_mTxmq(dispatched,m5,m,m,zc,za,rb,1,4.0,ntrial,nloop6);
+        double p = time_mTxmq(portable,m5,m,m,zc,za,rb,1,4.0,ntrial,nloop6);
+        printf("%20s %7ld %3ld %3ld %10.2f %10.2f %10.2f\n","(m^5,m)T*(m,m)",m5,m,m,r,z,p);
+    }
+
+    free(ra); free(rb); free(rc); free(za); free(zc);
+
+    SafeMPI::Finalize();
+    return 0;
+}
@@ -0,0 +1,116 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+
+  $Id$
+*/
+
+#ifndef MADNESS_TENSOR_FIXED_TRANSFORM_H__INCLUDED
+#define MADNESS_TENSOR_FIXED_TRANSFORM_H__INCLUDED
+
+/// \file tensor/fixed_transform.h
+/// \brief fast_transform for a shape fixed when the object is made
+
+#include <madness/tensor/tensor.h>
+
+namespace madness {
+
+    /// fast_transform of NDIM-cubes of side \c K by a \c K x \c K matrix
+
+    /// The shape of the transforms in MRA is known once k is: filter and
+    /// unfilter work on (2k)^NDIM cubes and the quadrature transforms on
+    /// k^NDIM or (k+1)^NDIM.  The matrix kernel for \c K (with its k loop
+    /// unrolled, see mTxmq_x86_fixed) is looked up once on construction and
+    /// the NDIM passes are unrolled at compile time.  Real transforms of the
+    /// constructed shape use it; everything else, or if there is no kernel
+    /// for \c K on this host, goes to fast_transform.  Construction is cheap
+    /// but the objects are meant to live in FunctionCommonData.
+    template <std::size_t NDIM>
+    class FixedTransform {
+        long K = 0;         ///< side of the cube and of the matrix
+        long dimi = 0;      ///< K^(NDIM-1)
+#ifdef HAVE_X86_MTXMQ
+        detail::mtxmq_fixed_kernel kernel = nullptr;
+#endif
+
+    public:
+        FixedTransform() = default;
+
+        explicit FixedTransform(long K) : K(K), dimi(1) {
+            for (std::size_t d=1; d<NDIM; ++d) dimi *= K;
+#ifdef HAVE_X86_MTXMQ
+            kernel = detail::mTxmq_x86_fixed(K);
+#endif
+        }
+
+        /// True if real transforms of this shape avoid fast_transform
+        bool specialized() const {
+#ifdef HAVE_X86_MTXMQ
+            return kernel != nullptr;
+#else
+            return false;
+#endif
+        }
+
+        /// Same as fast_transform(t, c, result, workspace)
+        template <typename T, typename Q>
+        Tensor< TENSOR_RESULT_TYPE(T,Q) >& operator()(const Tensor<T>& t, const Tensor<Q>& c,
+                                                      Tensor< TENSOR_RESULT_TYPE(T,Q) >& result,
+                                                      Tensor< TENSOR_RESULT_TYPE(T,Q) >& workspace) const {
+            return fast_transform(t, c, result, workspace);
+        }
+
+        /// Same as fast_transform(t, c, result, workspace)
+        Tensor<double>& operator()(const Tensor<double>& t, const Tensor<double>& c,
+                                   Tensor<double>& result, Tensor<double>& workspace) const {
+#ifdef HAVE_X86_MTXMQ
+            if (kernel && t.ndim() == long(NDIM) && c.dim(0) == K && c.dim(1) == K) {
+                for (std::size_t d=0; d<NDIM; ++d)
+                    TENSOR_ASSERT(t.dim(d) == K, "FixedTransform: tensor is not a cube of the constructed side", t.dim(d), &t);
+                TENSOR_ASSERT(t.iscontiguous() && c.iscontiguous(), "FixedTransform: arguments must be contiguous", 0, &t);
+                TENSOR_ASSERT(result.iscontiguous() && result.size() == t.size(), "FixedTransform: bad result tensor", result.size(), &result);
+                TENSOR_ASSERT(workspace.iscontiguous() && workspace.size() >= t.size(), "FixedTransform: bad workspace", workspace.size(), &workspace);
+                const double* pc = c.ptr();
+                double *t0 = workspace.ptr(), *t1 = result.ptr();
+                if (NDIM&1) std::swap(t0, t1);
+                kernel(dimi, t0, t.ptr(), pc);
+                for (std::size_t n=1; n<NDIM; ++n) {
+                    kernel(dimi, t1, t0, pc);
+                    std::swap(t0, t1);
+                }
+                return result;
+            }
+#endif
+            return fast_transform(t, c, result, workspace);
+        }
+    };
+
+}
+
+#endif // MADNESS_TENSOR_FIXED_TRANSFORM_H__INCLUDED
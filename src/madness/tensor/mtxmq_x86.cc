@@ -0,0 +1,660 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+
+  $Id$
+*/
+
+/// \file tensor/mtxmq_x86.cc
+/// \brief Register-blocked AVX2/AVX-512 mTxmq kernels selected at startup via CPUID
+
+// The transforms in MRA are dominated by c(i,j) = sum(k) a(k,i)*b(k,j)
+// with dimj,dimk = k or 2k and dimi = dimk^(NDIM-1).  These are far
+// too small for BLAS to get past its call overhead, so we provide
+// our own kernels.  Each kernel keeps an IB x JV block of c in
+// registers (JV vectors along j), broadcasts a(k,i) and streams one
+// row of b per k.  The i loop is outermost so the IB columns of a
+// stay in L1 while all of b (at most 32x32 doubles) is reused.
+//
+// The kernels are compiled with function-level target attributes so
+// the rest of the library does not need -mavx2/-mavx512f, and the
+// best one for the host is picked once via __builtin_cpu_supports.
+// The complex*real variants work on the interleaved storage of
+// std::complex, which is what complex functions need when applying a
+// real operator.  Single-precision kernels serve the mixed-precision
+// apply of operators.
+//
+// Setting MAD_MTXMQ_KERNEL to blas, avx2 or avx512 overrides the
+// choice (useful for benchmarking).
+
+#include <madness/madness_config.h>
+
+#ifdef HAVE_X86_MTXMQ
+
+#include <madness/tensor/mxm.h>
+#include <immintrin.h>
+#include <complex>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+namespace madness {
+    namespace detail {
+
+        namespace {
+
+            /// Largest dimj/dimk handled by the kernels (2k for k<=16)
+            const long MTXMQ_X86_MAXDIM = 32;
+
+            typedef void (*mtxmq_x86_kernel)(long dimi, long dimj, long dimk,
+                                             double* MADNESS_RESTRICT c, const double* a,
+                                             const double* b, long ldb);
+
+            /// Complex*real kernel ... c and a are interleaved (re,im) pairs
+            typedef void (*zmtxmq_x86_kernel)(long dimi, long dimj, long dimk,
+                                              double* MADNESS_RESTRICT c, const double* a,
+                                              const double* b, long ldb);
+
+            // ---------------------------------------------------------------- AVX2+FMA
+
+            /// acc[i][v] += a[i]*b[4*v:4*v+4] for one k
+            template <int IB, int JV, bool TAIL>
+            __attribute__((target("avx2,fma"), always_inline))
+            inline void step_avx2(__m256d (&acc)[IB][JV], const double* a, const double* b, __m256i mask) {
+                __m256d bv[JV];
+                for (int v=0; v<JV; ++v) {
+                    if (TAIL && v==JV-1) bv[v] = _mm256_maskload_pd(b+4*v, mask);
+                    else bv[v] = _mm256_loadu_pd(b+4*v);
+                }
+                for (int i=0; i<IB; ++i) {
+                    const __m256d ai = _mm256_broadcast_sd(a+i);
+                    for (int v=0; v<JV; ++v) acc[i][v] = _mm256_fmadd_pd(ai, bv[v], acc[i][v]);
+                }
+            }
+
+            /// c[0:IB,0:4*JV] = a[:,0:IB]^T * b[:,0:4*JV] ... last vector masked if TAIL
+
+            /// If KF is nonzero it is the value of dimk and the k loop is fully unrolled
+            template <int IB, int JV, bool TAIL, int KF=0>
+            __attribute__((target("avx2,fma")))
+            inline void block_avx2(long dimi, long dimj, long dimk, long ldb,
+                                   double* MADNESS_RESTRICT c, const double* a, const double* b,
+                                   __m256i mask) {
+                __m256d acc[IB][JV];
+                for (int i=0; i<IB; ++i)
+                    for (int v=0; v<JV; ++v) acc[i][v] = _mm256_setzero_pd();
+
+                if (KF) {
+#pragma GCC unroll 32
+                    for (int k=0; k<KF; ++k) step_avx2<IB,JV,TAIL>(acc, a+k*dimi, b+k*ldb, mask);
+                }
+                else {
+                    // do-while (dimk>=1) so that gcc keeps acc in registers
+                    long k = dimk;
+                    do {
+                        step_avx2<IB,JV,TAIL>(acc, a, b, mask);
+                        a += dimi;
+                        b += ldb;
+                    } while (--k);
+                }
+
+                for (int i=0; i<IB; ++i, c+=dimj) {
+                    for (int v=0; v<JV; ++v) {
+                        if (TAIL && v==JV-1) _mm256_maskstore_pd(c+4*v, mask, acc[i][v]);
+                        else _mm256_storeu_pd(c+4*v, acc[i][v]);
+                    }
+                }
+            }
+
+            /// All j-panels for one block of IB rows of c
+            template <int IB, int KF=0>
+            __attribute__((target("avx2,fma")))
+            inline void rows_avx2(long dimi, long dimj, long dimk, long ldb,
+                                  double* MADNESS_RESTRICT c, const double* a, const double* b,
+                                  __m256i mask) {
+                const long nvec = (dimj+3)/4;
+                const bool tail = (dimj%4) != 0;
+                long v = 0;
+                for (; v+3<nvec; v+=3)
+                    block_avx2<IB,3,false,KF>(dimi, dimj, dimk, ldb, c+4*v, a, b+4*v, mask);
+                switch (nvec-v) {
+                case 3:
+                    if (tail) block_avx2<IB,3,true ,KF>(dimi, dimj, dimk, ldb, c+4*v, a, b+4*v, mask);
+                    else      block_avx2<IB,3,false,KF>(dimi, dimj, dimk, ldb, c+4*v, a, b+4*v, mask);
+                    break;
+                case 2:
+                    if (tail) block_avx2<IB,2,true ,KF>(dimi, dimj, dimk, ldb, c+4*v, a, b+4*v, mask);
+                    else      block_avx2<IB,2,false,KF>(dimi, dimj, dimk, ldb, c+4*v, a, b+4*v, mask);
+                    break;
+                default:
+                    if (tail) block_avx2<IB,1,true ,KF>(dimi, dimj, dimk, ldb, c+4*v, a, b+4*v, mask);
+                    else      block_avx2<IB,1,false,KF>(dimi, dimj, dimk, ldb, c+4*v, a, b+4*v, mask);
+                    break;
+                }
+            }
+
+            template <int KF>
+            __attribute__((target("avx2,fma"), always_inline))
+            inline void mTxmq_avx2_impl(long dimi, long dimj, long dimk,
+                                        double* MADNESS_RESTRICT c, const double* a, const double* b, long ldb) {
+                const long rem = dimj%4;
+                const __m256i mask = _mm256_set_epi64x(rem>3 ? -1 : 0, rem>2 ? -1 : 0,
+                                                       rem>1 ? -1 : 0, rem>0 ? -1 : 0);
+                long i = 0;
+                for (; i+4<=dimi; i+=4) rows_avx2<4,KF>(dimi, dimj, dimk, ldb, c+i*dimj, a+i, b, mask);
+                switch (dimi-i) {
+                case 3: rows_avx2<3,KF>(dimi, dimj, dimk, ldb, c+i*dimj, a+i, b, mask); break;
+                case 2: rows_avx2<2,KF>(dimi, dimj, dimk, ldb, c+i*dimj, a+i, b, mask); break;
+                case 1: rows_avx2<1,KF>(dimi, dimj, dimk, ldb, c+i*dimj, a+i, b, mask); break;
+                default: break;
+                }
+            }
+
+            __attribute__((target("avx2,fma")))
+            void mTxmq_avx2(long dimi, long dimj, long dimk,
+                            double* MADNESS_RESTRICT c, const double* a, const double* b, long ldb) {
+                mTxmq_avx2_impl<0>(dimi, dimj, dimk, c, a, b, ldb);
+            }
+
+            /// dimj=dimk=ldb=K known at compile time
+            template <int K>
+            __attribute__((target("avx2,fma")))
+            void mTxmq_avx2_fixed(long dimi, double* MADNESS_RESTRICT c, const double* a, const double* b) {
+                mTxmq_avx2_impl<K>(dimi, K, K, c, a, b, K);
+            }
+
+            // ---------------------------------------------------------------- AVX-512
+
+            /// acc[i][v] += a[i]*b[8*v:8*v+8] for one k ... last vector masked by mask
+            template <int IB, int JV>
+            __attribute__((target("avx512f"), always_inline))
+            inline void step_avx512(__m512d (&acc)[IB][JV], const double* a, const double* b, __mmask8 mask) {
+                __m512d bv[JV];
+                for (int v=0; v<JV-1; ++v) bv[v] = _mm512_loadu_pd(b+8*v);
+                bv[JV-1] = _mm512_maskz_loadu_pd(mask, b+8*(JV-1));
+                for (int i=0; i<IB; ++i) {
+                    const __m512d ai = _mm512_set1_pd(a[i]);
+                    for (int v=0; v<JV; ++v) acc[i][v] = _mm512_fmadd_pd(ai, bv[v], acc[i][v]);
+                }
+            }
+
+            /// c[0:IB,0:8*JV] = a[:,0:IB]^T * b[:,0:8*JV] ... last vector masked by mask
+
+            /// If KF is nonzero it is the value of dimk and the k loop is fully unrolled
+            template <int IB, int JV, int KF=0>
+            __attribute__((target("avx512f")))
+            inline void block_avx512(long dimi, long dimj, long dimk, long ldb,
+                                     double* MADNESS_RESTRICT c, const double* a, const double* b,
+                                     __mmask8 mask) {
+                __m512d acc[IB][JV];
+                for (int i=0; i<IB; ++i)
+                    for (int v=0; v<JV; ++v) acc[i][v] = _mm512_setzero_pd();
+
+                if (KF) {
+#pragma GCC unroll 32
+                    for (int k=0; k<KF; ++k) step_avx512<IB,JV>(acc, a+k*dimi, b+k*ldb, mask);
+                }
+                else {
+                    long k = dimk;
+                    do {
+                        step_avx512<IB,JV>(acc, a, b, mask);
+                        a += dimi;
+                        b += ldb;
+                    } while (--k);
+                }
+
+                for (int i=0; i<IB; ++i, c+=dimj) {
+                    for (int v=0; v<JV-1; ++v) _mm512_storeu_pd(c+8*v, acc[i][v]);
+                    _mm512_mask_storeu_pd(c+8*(JV-1), mask, acc[i][JV-1]);
+                }
+            }
+
+            /// All j-panels for one block of IB rows of c ... dimj<=32 fits in one panel
+            template <int IB, int KF=0>
+            __attribute__((target("avx512f")))
+            inline void rows_avx512(long dimi, long dimj, long dimk, long ldb,
+                                    double* MADNESS_RESTRICT c, const double* a, const double* b) {
+                const long nvec = (dimj+7)/8;
+                const long rem = dimj - 8*(nvec-1);
+                const __mmask8 mask = __mmask8((1u<<rem)-1u);
+                switch (nvec) {
+                case 4: block_avx512<IB,4,KF>(dimi, dimj, dimk, ldb, c, a, b, mask); break;
+                case 3: block_avx512<IB,3,KF>(dimi, dimj, dimk, ldb, c, a, b, mask); break;
+                case 2: block_avx512<IB,2,KF>(dimi, dimj, dimk, ldb, c, a, b, mask); break;
+                default: block_avx512<IB,1,KF>(dimi, dimj, dimk, ldb, c, a, b, mask); break;
+                }
+            }
+
+            template <int KF>
+            __attribute__((target("avx512f"), always_inline))
+            inline void mTxmq_avx512_impl(long dimi, long dimj, long dimk,
+                                          double* MADNESS_RESTRICT c, const double* a, const double* b, long ldb) {
+                long i = 0;
+                for (; i+6<=dimi; i+=6) rows_avx512<6,KF>(dimi, dimj, dimk, ldb, c+i*dimj, a+i, b);
+                switch (dimi-i) {
+                case 5: rows_avx512<5,KF>(dimi, dimj, dimk, ldb, c+i*dimj, a+i, b); break;
+                case 4: rows_avx512<4,KF>(dimi, dimj, dimk, ldb, c+i*dimj, a+i, b); break;
+                case 3: rows_avx512<3,KF>(dimi, dimj, dimk, ldb, c+i*dimj, a+i, b); break;
+                case 2: rows_avx512<2,KF>(dimi, dimj, dimk, ldb, c+i*dimj, a+i, b); break;
+                case 1: rows_avx512<1,KF>(dimi, dimj, dimk, ldb, c+i*dimj, a+i, b); break;
+                default: break;
+                }
+            }
+
+            __attribute__((target("avx512f")))
+            void mTxmq_avx512(long dimi, long dimj, long dimk,
+                              double* MADNESS_RESTRICT c, const double* a, const double* b, long ldb) {
+                mTxmq_avx512_impl<0>(dimi, dimj, dimk, c, a, b, ldb);
+            }
+
+            /// dimj=dimk=ldb=K known at compile time
+            template <int K>
+            __attribute__((target("avx512f")))
+            void mTxmq_avx512_fixed(long dimi, double* MADNESS_RESTRICT c, const double* a, const double* b) {
+                mTxmq_avx512_impl<K>(dimi, K, K, c, a, b, K);
+            }
+
+            // ---------------------------------------------------------------- complex*real
+
+            // For complex a and real b the interleaved storage of c is used
+            // directly: each vector holds whole (re,im) pairs of c, a(k,i) is
+            // broadcast as a pair and b(k,j) is duplicated into both halves
+            // of its pair.  No splitting of a or merging of c is needed.
+
+            /// c[0:IB,0:2*JV] = a[:,0:IB]^T * b[:,0:2*JV] (complex*real) ... last vector masked if TAIL
+            template <int IB, int JV, bool TAIL>
+            __attribute__((target("avx2,fma")))
+            inline void zblock_avx2(long dimi, long dimj, long dimk, long ldb,
+                                    double* MADNESS_RESTRICT c, const double* a, const double* b) {
+                const __m256i mask = _mm256_set_epi64x(0, 0, -1, -1);
+                __m256d acc[IB][JV];
+                for (int i=0; i<IB; ++i)
+                    for (int v=0; v<JV; ++v) acc[i][v] = _mm256_setzero_pd();
+
+                long k = dimk;
+                do {
+                    __m256d bv[JV];
+                    for (int v=0; v<JV; ++v) {
+                        const __m128d b2 = (TAIL && v==JV-1) ? _mm_load_sd(b+2*v) : _mm_loadu_pd(b+2*v);
+                        bv[v] = _mm256_permute4x64_pd(_mm256_castpd128_pd256(b2), 0x50);
+                    }
+                    for (int i=0; i<IB; ++i) {
+                        const __m256d ai = _mm256_broadcast_pd(reinterpret_cast<const __m128d*>(a+2*i));
+                        for (int v=0; v<JV; ++v) acc[i][v] = _mm256_fmadd_pd(ai, bv[v], acc[i][v]);
+                    }
+                    a += 2*dimi;
+                    b += ldb;
+                } while (--k);
+
+                for (int i=0; i<IB; ++i, c+=2*dimj) {
+                    for (int v=0; v<JV; ++v) {
+                        if (TAIL && v==JV-1) _mm256_maskstore_pd(c+4*v, mask, acc[i][v]);
+                        else _mm256_storeu_pd(c+4*v, acc[i][v]);
+                    }
+                }
+            }
+
+            template <int IB>
+            __attribute__((target("avx2,fma")))
+            inline void zrows_avx2(long dimi, long dimj, long dimk, long ldb,
+                                   double* MADNESS_RESTRICT c, const double* a, const double* b) {
+                const long nvec = (dimj+1)/2;
+                const bool tail = (dimj%2) != 0;
+                long v = 0;
+                for (; v+2<nvec; v+=2)
+                    zblock_avx2<IB,2,false>(dimi, dimj, dimk, ldb, c+4*v, a, b+2*v);
+                if (nvec-v == 2) {
+                    if (tail) zblock_avx2<IB,2,true >(dimi, dimj, dimk, ldb, c+4*v, a, b+2*v);
+                    else      zblock_avx2<IB,2,false>(dimi, dimj, dimk, ldb, c+4*v, a, b+2*v);
+                }
+                else {
+                    if (tail) zblock_avx2<IB,1,true >(dimi, dimj, dimk, ldb, c+4*v, a, b+2*v);
+                    else      zblock_avx2<IB,1,false>(dimi, dimj, dimk, ldb, c+4*v, a, b+2*v);
+                }
+            }
+
+            __attribute__((target("avx2,fma")))
+            void zmTxmq_avx2(long dimi, long dimj, long dimk,
+                             double* MADNESS_RESTRICT c, const double* a, const double* b, long ldb) {
+                long i = 0;
+                for (; i+4<=dimi; i+=4) zrows_avx2<4>(dimi, dimj, dimk, ldb, c+2*i*dimj, a+2*i, b);
+                switch (dimi-i) {
+                case 3: zrows_avx2<3>(dimi, dimj, dimk, ldb, c+2*i*dimj, a+2*i, b); break;
+                case 2: zrows_avx2<2>(dimi, dimj, dimk, ldb, c+2*i*dimj, a+2*i, b); break;
+                case 1: zrows_avx2<1>(dimi, dimj, dimk, ldb, c+2*i*dimj, a+2*i, b); break;
+                default: break;
+                }
+            }
+
+            /// c[0:IB,0:4*JV] = a[:,0:IB]^T * b[:,0:4*JV] (complex*real) ... last vector masked
+            template <int IB, int JV>
+            __attribute__((target("avx512f")))
+            inline void zblock_avx512(long dimi, long dimj, long dimk, long ldb,
+                                      double* MADNESS_RESTRICT c, const double* a, const double* b,
+                                      __mmask8 bmask, __mmask8 cmask) {
+                const __m512i dup = _mm512_set_epi64(3, 3, 2, 2, 1, 1, 0, 0);
+                __m512d acc[IB][JV];
+                for (int i=0; i<IB; ++i)
+                    for (int v=0; v<JV; ++v) acc[i][v] = _mm512_setzero_pd();
+
+                long k = dimk;
+                do {
+                    __m512d bv[JV];
+                    for (int v=0; v<JV; ++v) {
+                        const __m512d b4 = (v==JV-1) ? _mm512_maskz_loadu_pd(bmask, b+4*v)
+                                                     : _mm512_maskz_loadu_pd(0x0f, b+4*v);
+                        // the zero-masked forms avoid gcc's uninitialized _mm512_undefined_pd passthrough
+                        bv[v] = _mm512_maskz_permutexvar_pd(0xff, dup, b4);
+                    }
+                    for (int i=0; i<IB; ++i) {
+                        const __m512d ai = _mm512_castps_pd(_mm512_maskz_broadcast_f32x4(0xffff, _mm_castpd_ps(_mm_loadu_pd(a+2*i))));
+                        for (int v=0; v<JV; ++v) acc[i][v] = _mm512_fmadd_pd(ai, bv[v], acc[i][v]);
+                    }
+                    a += 2*dimi;
+                    b += ldb;
+                } while (--k);
+
+                for (int i=0; i<IB; ++i, c+=2*dimj) {
+                    for (int v=0; v<JV-1; ++v) _mm512_storeu_pd(c+8*v, acc[i][v]);
+                    _mm512_mask_storeu_pd(c+8*(JV-1), cmask, acc[i][JV-1]);
+                }
+            }
+
+            template <int IB>
+            __attribute__((target("avx512f")))
+            inline void zrows_avx512(long dimi, long dimj, long dimk, long ldb,
+                                     double* MADNESS_RESTRICT c, const double* a, const double* b) {
+                const long nvec = (dimj+3)/4;
+                long v = 0;
+                for (; v+4<nvec; v+=4)
+                    zblock_avx512<IB,4>(dimi, dimj, dimk, ldb, c+8*v, a, b+4*v, 0x0f, 0xff);
+                const long rem = dimj - 4*(nvec-1);
+                const __mmask8 bmask = __mmask8((1u<<rem)-1u);
+                const __mmask8 cmask = __mmask8((1u<<(2*rem))-1u);
+                switch (nvec-v) {
+                case 4: zblock_avx512<IB,4>(dimi, dimj, dimk, ldb, c+8*v, a, b+4*v, bmask, cmask); break;
+                case 3: zblock_avx512<IB,3>(dimi, dimj, dimk, ldb, c+8*v, a, b+4*v, bmask, cmask); break;
+                case 2: zblock_avx512<IB,2>(dimi, dimj, dimk, ldb, c+8*v, a, b+4*v, bmask, cmask); break;
+                default: zblock_avx512<IB,1>(dimi, dimj, dimk, ldb, c+8*v, a, b+4*v, bmask, cmask); break;
+                }
+            }
+
+            __attribute__((target("avx512f")))
+            void zmTxmq_avx512(long dimi, long dimj, long dimk,
+                               double* MADNESS_RESTRICT c, const double* a, const double* b, long ldb) {
+                long i = 0;
+                for (; i+4<=dimi; i+=4) zrows_avx512<4>(dimi, dimj, dimk, ldb, c+2*i*dimj, a+2*i, b);
+                switch (dimi-i) {
+                case 3: zrows_avx512<3>(dimi, dimj, dimk, ldb, c+2*i*dimj, a+2*i, b); break;
+                case 2: zrows_avx512<2>(dimi, dimj, dimk, ldb, c+2*i*dimj, a+2*i, b); break;
+                case 1: zrows_avx512<1>(dimi, dimj, dimk, ldb, c+2*i*dimj, a+2*i, b); break;
+                default: break;
+                }
+            }
+
+            // ---------------------------------------------------------------- single precision
+
+            // Same blocking as the double kernels with twice as many elements
+            // per vector; used by the single-precision apply of operators.
+
+            typedef void (*smtxmq_x86_kernel)(long dimi, long dimj, long dimk,
+                                              float* MADNESS_RESTRICT c, const float* a,
+                                              const float* b, long ldb);
+
+            /// c[0:IB,0:8*JV] = a[:,0:IB]^T * b[:,0:8*JV] ... last vector masked if TAIL
+            template <int IB, int JV, bool TAIL>
+            __attribute__((target("avx2,fma")))
+            inline void sblock_avx2(long dimi, long dimj, long dimk, long ldb,
+                                    float* MADNESS_RESTRICT c, const float* a, const float* b,
+                                    __m256i mask) {
+                __m256 acc[IB][JV];
+                for (int i=0; i<IB; ++i)
+                    for (int v=0; v<JV; ++v) acc[i][v] = _mm256_setzero_ps();
+
+                long k = dimk;
+                do {
+                    __m256 bv[JV];
+                    for (int v=0; v<JV; ++v) {
+                        if (TAIL && v==JV-1) bv[v] = _mm256_maskload_ps(b+8*v, mask);
+                        else bv[v] = _mm256_loadu_ps(b+8*v);
+                    }
+                    for (int i=0; i<IB; ++i) {
+                        const __m256 ai = _mm256_broadcast_ss(a+i);
+                        for (int v=0; v<JV; ++v) acc[i][v] = _mm256_fmadd_ps(ai, bv[v], acc[i][v]);
+                    }
+                    a += dimi;
+                    b += ldb;
+                } while (--k);
+
+                for (int i=0; i<IB; ++i, c+=dimj) {
+                    for (int v=0; v<JV; ++v) {
+                        if (TAIL && v==JV-1) _mm256_maskstore_ps(c+8*v, mask, acc[i][v]);
+                        else _mm256_storeu_ps(c+8*v, acc[i][v]);
+                    }
+                }
+            }
+
+            template <int IB>
+            __attribute__((target("avx2,fma")))
+            inline void srows_avx2(long dimi, long dimj, long dimk, long ldb,
+                                   float* MADNESS_RESTRICT c, const float* a, const float* b,
+                                   __m256i mask) {
+                const long nvec = (dimj+7)/8;
+                const bool tail = (dimj%8) != 0;
+                long v = 0;
+                for (; v+3<nvec; v+=3)
+                    sblock_avx2<IB,3,false>(dimi, dimj, dimk, ldb, c+8*v, a, b+8*v, mask);
+                switch (nvec-v) {
+                case 3:
+                    if (tail) sblock_avx2<IB,3,true >(dimi, dimj, dimk, ldb, c+8*v, a, b+8*v, mask);
+                    else      sblock_avx2<IB,3,false>(dimi, dimj, dimk, ldb, c+8*v, a, b+8*v, mask);
+                    break;
+                case 2:
+                    if (tail) sblock_avx2<IB,2,true >(dimi, dimj, dimk, ldb, c+8*v, a, b+8*v, mask);
+                    else      sblock_avx2<IB,2,false>(dimi, dimj, dimk, ldb, c+8*v, a, b+8*v, mask);
+                    break;
+                default:
+                    if (tail) sblock_avx2<IB,1,true >(dimi, dimj, dimk, ldb, c+8*v, a, b+8*v, mask);
+                    else      sblock_avx2<IB,1,false>(dimi, dimj, dimk, ldb, c+8*v, a, b+8*v, mask);
+                    break;
+                }
+            }
+
+            __attribute__((target("avx2,fma")))
+            void smTxmq_avx2(long dimi, long dimj, long dimk,
+                             float* MADNESS_RESTRICT c, const float* a, const float* b, long ldb) {
+                const long rem = dimj%8;
+                const __m256i mask = _mm256_set_epi32(rem>7 ? -1 : 0, rem>6 ? -1 : 0, rem>5 ? -1 : 0,
+                                                      rem>4 ? -1 : 0, rem>3 ? -1 : 0, rem>2 ? -1 : 0,
+                                                      rem>1 ? -1 : 0, rem>0 ? -1 : 0);
+                long i = 0;
+                for (; i+4<=dimi; i+=4) srows_avx2<4>(dimi, dimj, dimk, ldb, c+i*dimj, a+i, b, mask);
+                switch (dimi-i) {
+                case 3: srows_avx2<3>(dimi, dimj, dimk, ldb, c+i*dimj, a+i, b, mask); break;
+                case 2: srows_avx2<2>(dimi, dimj, dimk, ldb, c+i*dimj, a+i, b, mask); break;
+                case 1: srows_avx2<1>(dimi, dimj, dimk, ldb, c+i*dimj, a+i, b, mask); break;
+                default: break;
+                }
+            }
+
+            /// c[0:IB,0:16*JV] = a[:,0:IB]^T * b[:,0:16*JV] ... last vector masked by mask
+            template <int IB, int JV>
+            __attribute__((target("avx512f")))
+            inline void sblock_avx512(long dimi, long dimj, long dimk, long ldb,
+                                      float* MADNESS_RESTRICT c, const float* a, const float* b,
+                                      __mmask16 mask) {
+                __m512 acc[IB][JV];
+                for (int i=0; i<IB; ++i)
+                    for (int v=0; v<JV; ++v) acc[i][v] = _mm512_setzero_ps();
+
+                long k = dimk;
+                do {
+                    __m512 bv[JV];
+                    for (int v=0; v<JV-1; ++v) bv[v] = _mm512_loadu_ps(b+16*v);
+                    bv[JV-1] = _mm512_maskz_loadu_ps(mask, b+16*(JV-1));
+                    for (int i=0; i<IB; ++i) {
+                        const __m512 ai = _mm512_set1_ps(a[i]);
+                        for (int v=0; v<JV; ++v) acc[i][v] = _mm512_fmadd_ps(ai, bv[v], acc[i][v]);
+                    }
+                    a += dimi;
+                    b += ldb;
+                } while (--k);
+
+                for (int i=0; i<IB; ++i, c+=dimj) {
+                    for (int v=0; v<JV-1; ++v) _mm512_storeu_ps(c+16*v, acc[i][v]);
+                    _mm512_mask_storeu_ps(c+16*(JV-1), mask, acc[i][JV-1]);
+                }
+            }
+
+            /// dimj<=32 fits in one panel of two vectors
+            template <int IB>
+            __attribute__((target("avx512f")))
+            inline void srows_avx512(long dimi, long dimj, long dimk, long ldb,
+                                     float* MADNESS_RESTRICT c, const float* a, const float* b) {
+                const long nvec = (dimj+15)/16;
+                const long rem = dimj - 16*(nvec-1);
+                const __mmask16 mask = __mmask16((1u<<rem)-1u);
+                if (nvec == 2) sblock_avx512<IB,2>(dimi, dimj, dimk, ldb, c, a, b, mask);
+                else sblock_avx512<IB,1>(dimi, dimj, dimk, ldb, c, a, b, mask);
+            }
+
+            __attribute__((target("avx512f")))
+            void smTxmq_avx512(long dimi, long dimj, long dimk,
+                               float* MADNESS_RESTRICT c, const float* a, const float* b, long ldb) {
+                long i = 0;
+                for (; i+6<=dimi; i+=6) srows_avx512<6>(dimi, dimj, dimk, ldb, c+i*dimj, a+i, b);
+                switch (dimi-i) {
+                case 5: srows_avx512<5>(dimi, dimj, dimk, ldb, c+i*dimj, a+i, b); break;
+                case 4: srows_avx512<4>(dimi, dimj, dimk, ldb, c+i*dimj, a+i, b); break;
+                case 3: srows_avx512<3>(dimi, dimj, dimk, ldb, c+i*dimj, a+i, b); break;
+                case 2: srows_avx512<2>(dimi, dimj, dimk, ldb, c+i*dimj, a+i, b); break;
+                case 1: srows_avx512<1>(dimi, dimj, dimk, ldb, c+i*dimj, a+i, b); break;
+                default: break;
+                }
+            }
+
+            // ---------------------------------------------------------------- dispatch
+
+            /// Fixed-size kernels for K = MTXMQ_FIXED_MINK ... MTXMQ_FIXED_MAXK
+            const int MTXMQ_FIXED_MINK = 4;
+            const int MTXMQ_FIXED_MAXK = 24;
+            const int MTXMQ_FIXED_NK = MTXMQ_FIXED_MAXK - MTXMQ_FIXED_MINK + 1;
+
+            template <int... I>
+            const mtxmq_fixed_kernel* fixed_avx2(std::integer_sequence<int, I...>) {
+                static const mtxmq_fixed_kernel table[] = {mTxmq_avx2_fixed<MTXMQ_FIXED_MINK+I>...};
+                return table;
+            }
+
+            template <int... I>
+            const mtxmq_fixed_kernel* fixed_avx512(std::integer_sequence<int, I...>) {
+                static const mtxmq_fixed_kernel table[] = {mTxmq_avx512_fixed<MTXMQ_FIXED_MINK+I>...};
+                return table;
+            }
+
+            struct mtxmq_x86_choice {
+                mtxmq_x86_kernel kernel;
+                zmtxmq_x86_kernel zkernel;
+                smtxmq_x86_kernel skernel;
+                const mtxmq_fixed_kernel* fixed;
+                const char* name;
+            };
+
+            mtxmq_x86_choice select_mtxmq_x86() {
+                __builtin_cpu_init();
+                const bool has_avx512 = __builtin_cpu_supports("avx512f");
+                const bool has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+
+                const std::make_integer_sequence<int, MTXMQ_FIXED_NK> ks;
+                const mtxmq_x86_choice blas = {nullptr, nullptr, nullptr, nullptr, "blas"};
+                const mtxmq_x86_choice avx2 = {mTxmq_avx2, zmTxmq_avx2, smTxmq_avx2, fixed_avx2(ks), "avx2"};
+                const mtxmq_x86_choice avx512 = {mTxmq_avx512, zmTxmq_avx512, smTxmq_avx512, fixed_avx512(ks), "avx512"};
+
+                const char* env = std::getenv("MAD_MTXMQ_KERNEL");
+                if (env) {
+                    if (std::strcmp(env,"blas") == 0) return blas;
+                    if (std::strcmp(env,"avx2") == 0 && has_avx2) return avx2;
+                    if (std::strcmp(env,"avx512") == 0 && has_avx512) return avx512;
+                }
+                if (has_avx512) return avx512;
+                if (has_avx2) return avx2;
+                return blas;
+            }
+
+            const mtxmq_x86_choice& mtxmq_x86() {
+                static const mtxmq_x86_choice choice = select_mtxmq_x86();
+                return choice;
+            }
+
+        } // namespace
+
+        bool mTxmq_x86(long dimi, long dimj, long dimk,
+                       double* MADNESS_RESTRICT c, const double* a, const double* b, long ldb) {
+            if (dimj < 1 || dimk < 1 || dimj > MTXMQ_X86_MAXDIM || dimk > MTXMQ_X86_MAXDIM) return false;
+            const mtxmq_x86_kernel kernel = mtxmq_x86().kernel;
+            if (!kernel) return false;
+            kernel(dimi, dimj, dimk, c, a, b, ldb);
+            return true;
+        }
+
+        bool mTxmq_x86(long dimi, long dimj, long dimk,
+                       std::complex<double>* MADNESS_RESTRICT c, const std::complex<double>* a,
+                       const double* b, long ldb) {
+            if (dimj < 1 || dimk < 1 || dimj > MTXMQ_X86_MAXDIM || dimk > MTXMQ_X86_MAXDIM) return false;
+            const zmtxmq_x86_kernel zkernel = mtxmq_x86().zkernel;
+            if (!zkernel) return false;
+            // std::complex<double> is layout-compatible with double[2]
+            zkernel(dimi, dimj, dimk, reinterpret_cast<double*>(c),
+                    reinterpret_cast<const double*>(a), b, ldb);
+            return true;
+        }
+
+        bool mTxmq_x86(long dimi, long dimj, long dimk,
+                       float* MADNESS_RESTRICT c, const float* a, const float* b, long ldb) {
+            if (dimj < 1 || dimk < 1 || dimj > MTXMQ_X86_MAXDIM || dimk > MTXMQ_X86_MAXDIM) return false;
+            const smtxmq_x86_kernel skernel = mtxmq_x86().skernel;
+            if (!skernel) return false;
+            skernel(dimi, dimj, dimk, c, a, b, ldb);
+            return true;
+        }
+
+        mtxmq_fixed_kernel mTxmq_x86_fixed(long K) {
+            if (K < MTXMQ_FIXED_MINK || K > MTXMQ_FIXED_MAXK) return nullptr;
+            const mtxmq_fixed_kernel* fixed = mtxmq_x86().fixed;
+            return fixed ? fixed[K-MTXMQ_FIXED_MINK] : nullptr;
+        }
+
+        const char* mTxmq_x86_kernel_name() {
+            return mtxmq_x86().name;
+        }
+
+    } // namespace detail
+} // namespace madness
+
+#endif // HAVE_X86_MTXMQ
@@ -36,6 +36,10 @@
 #define MADNESS_TENSOR_MXM_H__INCLUDED
 
 #include <madness/madness_config.h>
+#include <algorithm>
+#include <complex>
+#include <type_traits>
+#include <vector>
 
 // This just to check if config is actually working
 //#ifndef HAVE_MTXMQ
@@ -186,6 +190,40 @@ namespace madness {
     }
     
 
+#ifdef HAVE_X86_MTXMQ
+    namespace detail {
+        /// Runtime-dispatched AVX2/AVX-512 mTxmq for the small shapes used by MRA (mtxmq_x86.cc)
+
+        /// Computes \c C=AT*B exactly as mTxmq does.  Returns false without
+        /// touching \c c if the shape is too large or the host has no
+        /// suitable kernel, in which case the caller should fall back to BLAS.
+        bool mTxmq_x86(long dimi, long dimj, long dimk,
+                       double* MADNESS_RESTRICT c, const double* a, const double* b, long ldb);
+
+        /// Complex*real variant of the above, working on interleaved complex storage
+        bool mTxmq_x86(long dimi, long dimj, long dimk,
+                       std::complex<double>* MADNESS_RESTRICT c, const std::complex<double>* a,
+                       const double* b, long ldb);
+
+        /// Single-precision variant of the above
+        bool mTxmq_x86(long dimi, long dimj, long dimk,
+                       float* MADNESS_RESTRICT c, const float* a, const float* b, long ldb);
+
+        /// mTxmq kernel with dimj=dimk=ldb=K fixed at compile time
+        typedef void (*mtxmq_fixed_kernel)(long dimi, double* MADNESS_RESTRICT c, const double* a, const double* b);
+
+        /// Returns the fixed-size kernel for \c K (4<=K<=24) on this host, or NULL if there is none
+
+        /// The k loop of these kernels is fully unrolled and the j tail mask is
+        /// a constant, which pays off for the 1-d transforms of MRA where
+        /// the matrix is k x k or 2k x 2k.
+        mtxmq_fixed_kernel mTxmq_x86_fixed(long K);
+
+        /// Name of the kernel selected at startup ("avx512", "avx2" or "blas")
+        const char* mTxmq_x86_kernel_name();
+    }
+#endif
+
 #if defined(HAVE_FAST_BLAS) && !defined(HAVE_INTEL_MKL)
     // MKL provides support for mixed real/complex operations but most other libraries do not
     
@@ -263,38 +301,111 @@ namespace madness {
         if (dimk==0) {
             for (long i=0; i<dimi*dimj; i++) c[i] = 0.0;
         }
+
+#ifdef HAVE_X86_MTXMQ
+        if constexpr (std::is_same<T,double>::value || std::is_same<T,float>::value) {
+            if (detail::mTxmq_x86(dimi, dimj, dimk, c, a, b, ldb)) return;
+        }
+#endif
         
         const T one = 1.0;  // alpha in *gemm
         const T zero = 0.0; // beta  in *gemm
         cblas::gemm(cblas::NoTrans,cblas::Trans,dimj,dimi,dimk,one,b,ldb,a,dimi,zero,c,dimj);
     }  
 
+    namespace detail {
+        /// Per-thread scratch of at least \c n elements, grown as needed and never shrunk
+        template <typename T>
+        T* mTxmq_scratch(std::size_t n) {
+            thread_local std::vector<T> buf;
+            if (buf.size() < n) buf.resize(n);
+            return buf.data();
+        }
+
+        /// Complex*real mTxmq without the x86 kernels, as used on other hosts and for large shapes
+
+        /// Small products loop directly over the interleaved (real,imag)
+        /// storage of \c std::complex.  Larger ones view \c A as a real
+        /// (dimk,2*dimi) matrix, so that one real *GEMM yields the real and
+        /// imaginary rows of \c C, and interleave those from a per-thread
+        /// scratch block.  No memory is allocated once the scratch has grown
+        /// to the largest block.
+        template <typename T>
+        void mTxmq_portable(long dimi, long dimj, long dimk,
+                            std::complex<T>* MADNESS_RESTRICT c, const std::complex<T>* a, const T* b, long ldb) {
+            // std::complex<T> is layout-compatible with T[2]
+            T* MADNESS_RESTRICT cr = reinterpret_cast<T*>(c);
+            const T* ar = reinterpret_cast<const T*>(a);
+
+            // Below about 6x6 the call overhead of *GEMM outweighs its speed (benchmark_Zmtxmq)
+            if (dimj*dimk <= 36) {
+                for (long i=0; i<dimi; ++i, cr+=2*dimj, ar+=2) {
+                    for (long j=0; j<2*dimj; ++j) cr[j] = 0.0;
+                    const T* aki = ar;
+                    const T* bk = b;
+                    for (long k=0; k<dimk; ++k, aki+=2*dimi, bk+=ldb) {
+                        const T re = aki[0];
+                        const T im = aki[1];
+                        for (long j=0; j<dimj; ++j) {
+                            cr[2*j  ] += re*bk[j];
+                            cr[2*j+1] += im*bk[j];
+                        }
+                    }
+                }
+                return;
+            }
+
+            // Blocks of ib rows of C keep the scratch within 16K elements
+            const long ib = std::max(1L, 8192/dimj);
+            T* MADNESS_RESTRICT d = mTxmq_scratch<T>(2*std::min(ib,dimi)*dimj);
+            const T one = 1.0;  // alpha in *gemm
+            const T zero = 0.0; // beta  in *gemm
+            for (long i0=0; i0<dimi; i0+=ib) {
+                const long ni = std::min(ib, dimi-i0);
+                if (dimk == 0) {
+                    for (long i=0; i<2*ni*dimj; ++i) d[i] = 0.0;
+                }
+                else {
+                    cblas::gemm(cblas::NoTrans,cblas::Trans,dimj,2*ni,dimk,one,b,ldb,ar+2*i0,2*dimi,zero,d,dimj);
+                }
+                for (long i=0; i<ni; ++i, cr+=2*dimj) {
+                    const T* dre = d + 2*i*dimj;
+                    const T* dim = dre + dimj;
+                    for (long j=0; j<dimj; ++j) {
+                        cr[2*j  ] = dre[j];
+                        cr[2*j+1] = dim[j];
+                    }
+                }
+            }
+        }
+    }
+
+    /// Matrix = Matrix transpose * matrix ... complex*real version
+
+    /// Does \c C=AT*B for complex \c A and real \c B, as needed when a
+    /// real operator is applied to a complex function.  BLAS has no
+    /// mixed-type *GEMM, so this works on the interleaved (real,imag)
+    /// storage of \c std::complex without allocating scratch per call
+    /// (see detail::mTxmq_portable).
+    template <typename T>
+    void mTxmq(long dimi, long dimj, long dimk,
+               std::complex<T>* MADNESS_RESTRICT c, const std::complex<T>* a, const T* b, long ldb=-1) {
+        if (ldb == -1) ldb=dimj;
+        MADNESS_ASSERT(ldb>=dimj);
+        if (dimi==0 || dimj==0) return;
+
+#ifdef HAVE_X86_MTXMQ
+        if constexpr (std::is_same<T,double>::value) {
+            if (detail::mTxmq_x86(dimi, dimj, dimk, c, a, b, ldb)) return;
+        }
+#endif
+
+        detail::mTxmq_portable(dimi, dimj, dimk, c, a, b, ldb);
+    }
+
 #ifdef HAVE_MTXMQ
     template <>
     void mTxmq(long dimi, long dimj, long dimk, double* MADNESS_RESTRICT c, const double* a, const double* b, long ldb);
-
-    // Bootstrap complex*real from real*real
-    template <typename T>
-    void mTxmq(long dimi, long dimj, long dimk, std::complex<T>* MADNESS_RESTRICT c, const std::complex<T>* a, const T* b, long ldb) {
-      T* Rc = new T[dimi*dimj];
-      T* Ic = new T[dimi*dimj];
-      T* Ra = new T[dimi*dimk];
-      T* Ia = new T[dimi*dimk];
-
-      for (long i=0; i<dimi*dimk; i++) {
-	Ra[i] = a[i].real();
-	Ia[i] = a[i].imag();
-      }
-      mTxmq(dimi,dimj,dimk,Rc,Ra,b,ldb);
-      mTxmq(dimi,dimj,dimk,Ic,Ia,b,ldb);
-      for (long i=0; i<dimi*dimj; i++) c[i] = std::complex<T>(Rc[i],Ic[i]);
-      
-      delete[] Rc;
-      delete[] Ic;
-      delete[] Ra;
-      delete[] Ia;
-    }  
-  
 #endif
 
 #endif
@@ -374,6 +485,15 @@ namespace madness {
         if (dimk==0) {
             for (long i=0; i<dimi*dimj; i++) c[i] = 0.0;
         }
+
+#ifdef HAVE_X86_MTXMQ
+        if constexpr ((std::is_same<aT,double>::value && std::is_same<bT,double>::value
+                       && std::is_same<cT,double>::value) ||
+                      (std::is_same<aT,float>::value && std::is_same<bT,float>::value
+                       && std::is_same<cT,float>::value)) {
+            if (detail::mTxmq_x86(dimi, dimj, dimk, c, a, b, ldb)) return;
+        }
+#endif
         
         const cT one = 1.0;  // alpha in *gemm
         const cT zero = 0.0; // beta  in *gemm
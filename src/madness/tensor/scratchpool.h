@@ -0,0 +1,187 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+
+  $Id$
+*/
+
+#ifndef MADNESS_TENSOR_SCRATCHPOOL_H__INCLUDED
+#define MADNESS_TENSOR_SCRATCHPOOL_H__INCLUDED
+
+/// \file tensor/scratchpool.h
+/// \brief Per-thread pool of reusable scratch tensors
+
+#include <madness/tensor/tensor.h>
+
+#include <atomic>
+#include <vector>
+
+namespace madness {
+
+    namespace detail {
+        /// Switch shared by the scratch pools of all element types
+        inline std::atomic<bool>& scratch_pool_on() {
+            static std::atomic<bool> on{true};
+            return on;
+        }
+
+        /// Bumped to make every thread drop its pooled tensors on its next borrow
+        inline std::atomic<unsigned long>& scratch_pool_epoch() {
+            static std::atomic<unsigned long> epoch{0};
+            return epoch;
+        }
+
+        /// Most bytes pooled per thread and element type
+        inline std::atomic<std::size_t>& scratch_pool_max_bytes() {
+            static std::atomic<std::size_t> nbyte{std::size_t(64) << 20};
+            return nbyte;
+        }
+    }
+
+    /// Per-thread pool of reusable scratch tensors
+
+    /// borrow() returns a tensor sharing its data with an entry of the calling
+    /// thread's pool.  An entry is free again as soon as every tensor sharing
+    /// its data is gone, so a borrowed tensor may be copied, stored or sent
+    /// like any other; doing so merely keeps its entry busy for longer.
+    /// Entries are matched by total size, with at most \c max_entries per
+    /// size, and at most max_bytes() pooled per thread; beyond that borrow()
+    /// falls back to a new tensor.  clear() frees the entries of the calling
+    /// thread; release() and enable(false) make every thread free its entries
+    /// on its next call to borrow(), so the buffers of an idle thread are kept
+    /// until it borrows again.  After enable(false) borrow() always returns a
+    /// new tensor.
+    template <typename T>
+    class ScratchTensorPool {
+    public:
+        static const std::size_t max_entries = 8;
+
+    private:
+        struct Pool {
+            std::vector< Tensor<T> > entries;
+            std::size_t nbyte = 0;      ///< Bytes held by the entries
+            unsigned long epoch = 0;    ///< Value of the epoch when last synchronized
+        };
+
+        static Pool& pool() {
+            static thread_local Pool p;
+            return p;
+        }
+
+        /// Returns the pool of the calling thread, emptied if release() was called since its last use
+        static Pool& synced_pool() {
+            Pool& p = pool();
+            const unsigned long epoch = detail::scratch_pool_epoch().load(std::memory_order_relaxed);
+            if (p.epoch != epoch) {
+                p.entries.clear();
+                p.nbyte = 0;
+                p.epoch = epoch;
+            }
+            return p;
+        }
+
+        /// Frees pooled entries that are not in use until \c nbyte more bytes fit under max_bytes()
+        static bool make_room(Pool& p, std::size_t nbyte) {
+            const std::size_t maxbyte = max_bytes();
+            if (nbyte > maxbyte) return false;
+            for (std::size_t i=0; i<p.entries.size() && p.nbyte+nbyte > maxbyte; ) {
+                if (p.entries[i].use_count() == 1) {
+                    p.nbyte -= p.entries[i].size()*sizeof(T);
+                    p.entries.erase(p.entries.begin()+i);
+                }
+                else {
+                    ++i;
+                }
+            }
+            return p.nbyte+nbyte <= maxbyte;
+        }
+
+    public:
+        /// True if borrow() reuses pooled tensors
+        static bool enabled() { return detail::scratch_pool_on().load(std::memory_order_relaxed); }
+
+        /// Turns the pools of all element types on or off (borrowed tensors remain valid)
+
+        /// Switching them off also releases the pooled tensors of all threads
+        static void enable(bool value) {
+            detail::scratch_pool_on().store(value, std::memory_order_relaxed);
+            if (!value) release();
+        }
+
+        /// Most bytes pooled per thread and element type
+        static std::size_t max_bytes() { return detail::scratch_pool_max_bytes().load(std::memory_order_relaxed); }
+
+        /// Sets the most bytes pooled per thread and element type (default 64 MB) for all element types
+        static void set_max_bytes(std::size_t nbyte) { detail::scratch_pool_max_bytes().store(nbyte, std::memory_order_relaxed); }
+
+        /// Frees the pooled tensors of the calling thread (borrowed tensors remain valid)
+        static void clear() {
+            Pool& p = synced_pool();
+            p.entries.clear();
+            p.nbyte = 0;
+        }
+
+        /// Makes every thread free the pooled tensors of all element types on its next borrow()
+        static void release() { detail::scratch_pool_epoch().fetch_add(1, std::memory_order_relaxed); }
+
+        /// Returns a tensor of dimensions \c dims, zeroed if \c dozero
+        static Tensor<T> borrow(const std::vector<long>& dims, bool dozero=true) {
+            Pool& p = synced_pool();
+            if (!enabled()) return Tensor<T>(dims, dozero);
+            long size = 1;
+            for (long d : dims) size *= d;
+
+            std::size_t nsame = 0;
+            for (const Tensor<T>& t : p.entries) {
+                if (t.size() != size) continue;
+                ++nsame;
+                if (t.use_count() == 1) {
+                    Tensor<T> result = t.reshape(dims);
+                    if (dozero) result.fill(T(0));
+                    return result;
+                }
+            }
+            if (nsame == max_entries) return Tensor<T>(dims, dozero);
+            if (!make_room(p, size*sizeof(T))) return Tensor<T>(dims, dozero);
+
+            p.entries.push_back(Tensor<T>(std::vector<long>(1,size), dozero));
+            p.nbyte += size*sizeof(T);
+            return p.entries.back().reshape(dims);
+        }
+
+        /// Number of pooled tensors of the calling thread
+        static std::size_t size() { return synced_pool().entries.size(); }
+
+        /// Bytes pooled by the calling thread
+        static std::size_t nbytes() { return synced_pool().nbyte; }
+    };
+
+}
+
+#endif // MADNESS_TENSOR_SCRATCHPOOL_H__INCLUDED
@@ -0,0 +1,168 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+
+  $Id$
+*/
+
+/// \file tensor/slaballoc.cc
+/// \brief Size-class slab allocator for the data of Tensor
+
+#include <madness/tensor/slaballoc.h>
+#include <madness/world/thread.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+
+namespace madness {
+
+    std::atomic<bool> TensorSlabAllocator::on{false};
+    std::atomic<int> TensorSlabAllocator::nclass{0};
+    std::atomic<std::size_t> TensorSlabAllocator::sizes[TensorSlabAllocator::max_classes];
+
+    namespace {
+        const std::size_t alignment = 64;
+        const std::size_t slab_nbyte = 2ul<<20;     // target slab size
+        const std::size_t max_local = 256;          // thread-local list length before spilling half to the pool
+
+        struct Pool {
+            std::mutex lock;
+            std::vector<void*> free;
+        };
+
+        // One set of pools per NUMA domain, so that blocks first touched in
+        // one domain are not handed to threads of another.  Leaked on purpose
+        // so that threads exiting during static destruction can still give
+        // blocks back
+        const int max_domains = 8;
+        Pool* all_pools = new Pool[max_domains*TensorSlabAllocator::max_classes];
+
+        Pool& pool_of(int c) {
+            const int d = std::max(ThreadBinder::this_domain(), 0) % max_domains;
+            return all_pools[d*TensorSlabAllocator::max_classes + c];
+        }
+        std::atomic<std::size_t> reserved{0};
+        std::mutex class_lock;
+
+        std::size_t round_up(std::size_t nbyte) { return (nbyte + alignment - 1) & ~(alignment - 1); }
+
+        // 0 = not yet constructed, 1 = alive, 2 = destroyed (tensors in other
+        // thread_locals may be freed after the lists of their thread are gone)
+        thread_local int local_state = 0;
+
+        struct LocalLists {
+            std::vector<void*> free[TensorSlabAllocator::max_classes];
+            LocalLists() { local_state = 1; }
+            ~LocalLists() {
+                local_state = 2;
+                for (int c=0; c<TensorSlabAllocator::max_classes; ++c) {
+                    if (free[c].empty()) continue;
+                    Pool& pool = pool_of(c);
+                    std::lock_guard<std::mutex> guard(pool.lock);
+                    pool.free.insert(pool.free.end(), free[c].begin(), free[c].end());
+                }
+            }
+        };
+
+        thread_local LocalLists local;
+
+        // refills the local list of class c from the pool or from a new slab
+        void refill(int c, std::size_t nbyte) {
+            std::vector<void*>& list = local.free[c];
+            {
+                Pool& p = pool_of(c);
+                std::lock_guard<std::mutex> guard(p.lock);
+                std::vector<void*>& pool = p.free;
+                const std::size_t n = std::min(pool.size(), max_local/2);
+                list.insert(list.end(), pool.end()-n, pool.end());
+                pool.resize(pool.size()-n);
+            }
+            if (!list.empty()) return;
+
+            const std::size_t stride = round_up(nbyte);
+            const std::size_t nblock = std::max<std::size_t>(1, std::min<std::size_t>(64, slab_nbyte/stride));
+            void* slab;
+            if (posix_memalign(&slab, alignment, nblock*stride)) return;
+            reserved += nblock*stride;
+            char* p = static_cast<char*>(slab);
+            for (std::size_t i=0; i<nblock; ++i) list.push_back(p + i*stride);
+        }
+    }
+
+    void TensorSlabAllocator::add_size(std::size_t nbyte) {
+        if (nbyte == 0 || nbyte > max_nbyte) return;
+        std::lock_guard<std::mutex> guard(class_lock);
+        const int n = nclass.load(std::memory_order_relaxed);
+        for (int c=0; c<n; ++c) if (sizes[c].load(std::memory_order_relaxed) == nbyte) return;
+        if (n == max_classes) return;
+        sizes[n].store(nbyte, std::memory_order_relaxed);
+        nclass.store(n+1, std::memory_order_release);
+    }
+
+    void* TensorSlabAllocator::allocate(std::size_t nbyte, int& cls) {
+        if (local_state == 2) return nullptr;
+        const int n = nclass.load(std::memory_order_acquire);
+        for (int c=0; c<n; ++c) {
+            if (sizes[c].load(std::memory_order_relaxed) != nbyte) continue;
+            std::vector<void*>& list = local.free[c];
+            if (list.empty()) refill(c, nbyte);
+            if (list.empty()) return nullptr;
+            void* p = list.back();
+            list.pop_back();
+            cls = c;
+            return p;
+        }
+        return nullptr;
+    }
+
+    void TensorSlabAllocator::deallocate(void* p, int cls) {
+        if (local_state == 2) {
+            Pool& pool = pool_of(cls);
+            std::lock_guard<std::mutex> guard(pool.lock);
+            pool.free.push_back(p);
+            return;
+        }
+        std::vector<void*>& list = local.free[cls];
+        list.push_back(p);
+        if (list.size() > max_local) {
+            const std::size_t n = list.size()/2;
+            Pool& pool = pool_of(cls);
+            std::lock_guard<std::mutex> guard(pool.lock);
+            pool.free.insert(pool.free.end(), list.end()-n, list.end());
+            list.resize(list.size()-n);
+        }
+    }
+
+    std::size_t TensorSlabAllocator::nbyte_reserved() {
+        return reserved.load(std::memory_order_relaxed);
+    }
+
+}
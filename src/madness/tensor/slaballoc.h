@@ -0,0 +1,98 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+
+  $Id$
+*/
+
+#ifndef MADNESS_TENSOR_SLABALLOC_H__INCLUDED
+#define MADNESS_TENSOR_SLABALLOC_H__INCLUDED
+
+/// \file tensor/slaballoc.h
+/// \brief Size-class slab allocator for the data of Tensor
+
+#include <atomic>
+#include <cstddef>
+
+namespace madness {
+
+    /// Size-class slab allocator for Tensor data
+
+    /// MRA allocates and frees huge numbers of tensors of a handful of sizes
+    /// (k^NDIM and (2k)^NDIM coefficients).  When enabled, Tensor data whose
+    /// size in bytes exactly matches a registered class is taken from a
+    /// thread-local free list instead of posix_memalign.  Lists are refilled
+    /// from (and overflow into) a locked per-class pool of the thread's NUMA
+    /// domain, which in turn is refilled by carving 64-byte aligned blocks
+    /// out of larger slabs that are first touched by the thread using them.
+    ///
+    /// Memory is never returned to the system, so the footprint is the peak
+    /// number of live blocks of each class.  Classes are append-only, so a
+    /// block freed after the set of classes changed still goes back to the
+    /// right list.  Normally driven by FunctionDefaults::set_tensor_slab().
+    class TensorSlabAllocator {
+    public:
+        static const int max_classes = 16;                  ///< max number of size classes
+        static const std::size_t max_nbyte = 8ul<<20;       ///< larger blocks are never pooled
+
+    private:
+        static std::atomic<bool> on;
+        static std::atomic<int> nclass;
+        static std::atomic<std::size_t> sizes[max_classes];
+
+    public:
+        /// Frees a block back to the free list of its class
+        struct Deleter {
+            int cls;
+            template <typename T>
+            void operator()(T* p) const { deallocate(p, cls); }
+        };
+
+        /// True if tensors should try the slab allocator
+        static bool enabled() { return on.load(std::memory_order_relaxed); }
+
+        /// Turns the allocator on or off (blocks already handed out remain valid)
+        static void enable(bool value) { on.store(value, std::memory_order_relaxed); }
+
+        /// Registers a size class of \c nbyte bytes (no-op if present, too big or the table is full)
+        static void add_size(std::size_t nbyte);
+
+        /// Returns a 64-byte aligned block of \c nbyte bytes and its class, or NULL if no class matches
+        static void* allocate(std::size_t nbyte, int& cls);
+
+        /// Returns block \c p of class \c cls to the free list of the calling thread
+        static void deallocate(void* p, int cls);
+
+        /// Total bytes obtained from the system so far
+        static std::size_t nbyte_reserved();
+    };
+
+}
+
+#endif // MADNESS_TENSOR_SLABALLOC_H__INCLUDED
@@ -57,6 +57,7 @@
 // #include <madness/tensor/vector_factory.h>
 #include <madness/tensor/basetensor.h>
 #include <madness/tensor/aligned.h>
+#include <madness/tensor/slaballoc.h>
 #include <madness/tensor/mxm.h>
 #include <madness/tensor/tensorexcept.h>
 #include <madness/tensor/tensoriter.h>
@@ -304,6 +305,7 @@ namespace madness {
                 return *this;
             }
             void reset() {dec(); p = 0;}
+            long use_count() const {return p ? long(*cnt) : 0;}
             ~SharedAlignedArray() {dec();}
         };
     }
@@ -362,8 +364,15 @@ namespace madness {
                     _p = new T[_size];
                     _shptr = std::shared_ptr<T>(_p);
 #else
-                    if (posix_memalign((void **) &_p, TENSOR_ALIGNMENT, sizeof(T)*_size)) throw 1;
-                    _shptr.reset(_p, &free);
+                    int cls;
+                    if (TensorSlabAllocator::enabled() &&
+                        (_p = (T*) TensorSlabAllocator::allocate(sizeof(T)*_size, cls))) {
+                        _shptr.reset(_p, TensorSlabAllocator::Deleter{cls});
+                    }
+                    else {
+                        if (posix_memalign((void **) &_p, TENSOR_ALIGNMENT, sizeof(T)*_size)) throw 1;
+                        _shptr.reset(_p, &free);
+                    }
 #endif
                 }
                 catch (...) {
@@ -1821,6 +1830,11 @@ MADNESS_PRAGMA_GCC(diagnostic pop)
             return *this;
         }
 
+        /// Returns the number of tensors (including this one) sharing the underlying data
+        long use_count() const {
+            return _shptr.use_count();
+        }
+
         /// Returns a pointer to the internal data
         T* ptr() {
             return _p;
@@ -1894,12 +1908,21 @@ MADNESS_PRAGMA_GCC(diagnostic pop)
 
     namespace archive {
         /// Serialize a tensor
+
+        /// The data of a contiguous tensor goes through store_external(), so
+        /// an archive may keep a shallow copy and read the data later.  For
+        /// active messages this happens with MAD_AM_ZEROCOPY set (see
+        /// new_am_arg()).  Such a tensor must then not be modified in place
+        /// until the send completes or the next fence.
         template <class Archive, typename T>
         struct ArchiveStoreImpl< Archive, Tensor<T> > {
             static void store(const Archive& s, const Tensor<T>& t) {
                 if (t.iscontiguous()) {
                     s & t.size() & t.id();
-                    if (t.size()) s & t.ndim() & wrap(t.dims(),TENSOR_MAXDIM) & wrap(t.ptr(),t.size());
+                    if (t.size()) {
+                        s & t.ndim() & wrap(t.dims(),TENSOR_MAXDIM);
+                        store_external(s, t.ptr(), t.size(), t); // Large data may be sent in place
+                    }
                 }
                 else {
                     s & copy(t);
@@ -170,7 +170,10 @@ int main(int argc, char * argv[]) {
     if (getenv("MAD_SMALL_TESTS")) smalltest=true;
     for (int iarg=1; iarg<argc; iarg++) if (strcmp(argv[iarg],"--small")==0) smalltest=true;
     std::cout << "small test : " << smalltest << std::endl;
-    
+#ifdef HAVE_X86_MTXMQ
+    std::cout << "x86 kernel : " << detail::mTxmq_x86_kernel_name() << std::endl;
+#endif
+
     const long nimax=!smalltest ? 30*30 : 8*8;
     const long njmax=!smalltest ? 100 : 20;
     const long nkmax=!smalltest ? 100 : 20;
@@ -225,6 +228,78 @@ int main(int argc, char * argv[]) {
     }
     printf("... OK!\n");
 
+#ifdef HAVE_X86_MTXMQ
+    printf("Testing fixed-size kernels ... \n");
+    for (nk=1; nk<=std::min(32L,nkmax); ++nk) {
+        detail::mtxmq_fixed_kernel kernel = detail::mTxmq_x86_fixed(nk);
+        if (!kernel) continue;
+        for (ni=1; ni<std::min(60L,nimax); ni+=1) {
+            for (i=0; i<ni*nk; ++i) d[i] = c[i] = 0.0;
+            mTxm (ni,nk,nk,c,a,b);
+            kernel(ni,d,a,b);
+            for (i=0; i<ni*nk; ++i) {
+                double err = std::abs(d[i]-c[i]);
+                if (err > 1e-13) {
+                    printf("test_mtxmq: fixed error %ld %ld %e\n",ni,nk,err);
+                    exit(1);
+                }
+            }
+        }
+    }
+    printf("... OK!\n");
+#endif
+
+    printf("Testing single precision ... \n");
+    {
+        std::vector<float> af(nkmax*nimax), bf(nkmax*njmax), cf(nimax*njmax);
+        for (i=0; i<nkmax*nimax; ++i) af[i] = a[i];
+        for (i=0; i<nkmax*njmax; ++i) bf[i] = b[i];
+        for (ni=1; ni<std::min(60L,nimax); ni+=3) {
+            for (nj=1; nj<std::min(40L,njmax); nj+=1) {
+                for (nk=1; nk<std::min(40L,nkmax); nk+=1) {
+                    for (i=0; i<ni*nj; ++i) c[i] = 0.0;
+                    mTxm (ni,nj,nk,c,a,b);
+                    mTxmq(ni,nj,nk,cf.data(),af.data(),bf.data());
+                    for (i=0; i<ni*nj; ++i) {
+                        double err = std::abs(cf[i]-c[i]);
+                        if (err > 1e-5*nk) {
+                            printf("test_mtxmq: single error %ld %ld %ld %e\n",ni,nj,nk,err);
+                            exit(1);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    printf("... OK!\n");
+
+    printf("Testing complex*real ... \n");
+    {
+        // odd dimensions and a padded b exercise the masked tails of the vector kernels
+        std::vector<double_complex> az(nkmax*nimax), cz(nimax*njmax);
+        for (i=0; i<nkmax*nimax; ++i) az[i] = double_complex(a[i], a[nkmax*nimax-1-i]);
+        for (ni=1; ni<std::min(60L,nimax); ni+=2) {
+            for (nj=1; nj<std::min(40L,njmax); nj+=2) {
+                for (nk=1; nk<std::min(40L,nkmax); nk+=2) {
+                    const long ldb = (nk*(nj+3) <= nkmax*njmax) ? nj+3 : nj;
+                    mTxmq(ni,nj,nk,cz.data(),az.data(),b,ldb);
+                    for (i=0; i<ni; ++i) {
+                        for (long j=0; j<nj; ++j) {
+                            double_complex sum = 0.0;
+                            for (long k=0; k<nk; ++k) sum += az[k*ni+i]*b[k*ldb+j];
+                            double err = std::abs(cz[i*nj+j]-sum);
+                            if (err > 1e-13) {
+                                printf("test_mtxmq: complex*real error %ld %ld %ld %e\n",ni,nj,nk,err);
+                                exit(1);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    printf("... OK!\n");
+
     if (!smalltest) {
         printf("%20s %3s %3s %3s %8s %8s (GF/s)\n", "type", "M", "N", "K", "LOOP", "BLAS");
         for (ni=2; ni<60; ni+=2) timer("(m*m)T*(m*m)", ni,ni,ni,a,b,c);
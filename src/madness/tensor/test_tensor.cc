@@ -33,6 +33,7 @@
 /// \brief New test code for Tensor class using Google unit test
 
 #include <madness/tensor/tensor.h>
+#include <madness/tensor/scratchpool.h>
 #include <madness/world/print.h>
 
 #ifdef MADNESS_HAS_GOOGLE_TEST
@@ -45,6 +46,7 @@ using madness::___;
 using madness::_reverse;
 
 #include <iostream>
+#include <thread>
 #include <gtest/gtest.h>
 
 namespace {
@@ -415,6 +417,142 @@ namespace {
         ITERATOR3(b,ASSERT_EQ(b(_i,_j,_k), a(_j,_i,_k)));
     }
 
+    TEST(TensorSlabAllocator, SizeClasses) {
+        typedef madness::TensorSlabAllocator allocT;
+        const std::size_t nbyte = 1000;            // rounded up to a 1024 byte stride
+        allocT::add_size(nbyte);
+        int c1 = -1, c2 = -1;
+        char* p1 = static_cast<char*>(allocT::allocate(nbyte, c1));
+        char* p2 = static_cast<char*>(allocT::allocate(nbyte, c2));
+        ASSERT_TRUE(p1 && p2);
+        EXPECT_EQ(c1, c2);
+        EXPECT_EQ(reinterpret_cast<std::uintptr_t>(p1) % 64, 0u);
+        EXPECT_EQ(reinterpret_cast<std::uintptr_t>(p2) % 64, 0u);
+        EXPECT_EQ(std::abs(p1 - p2), 1024);     // neighbours in the same slab
+
+        // the most recently freed block is handed out first
+        const std::size_t reserved = allocT::nbyte_reserved();
+        allocT::deallocate(p2, c2);
+        int c3 = -1;
+        EXPECT_EQ(allocT::allocate(nbyte, c3), p2);
+        EXPECT_EQ(c3, c2);
+        EXPECT_EQ(allocT::nbyte_reserved(), reserved);
+        allocT::deallocate(p1, c1);
+        allocT::deallocate(p2, c2);
+
+        // sizes without a class are left to the heap
+        int c4 = -1;
+        EXPECT_EQ(allocT::allocate(nbyte+8, c4), nullptr);
+        EXPECT_EQ(allocT::allocate(allocT::max_nbyte+64, c4), nullptr);
+        allocT::add_size(allocT::max_nbyte+64);
+        EXPECT_EQ(allocT::allocate(allocT::max_nbyte+64, c4), nullptr);
+    }
+
+    TEST(TensorSlabAllocator, CrossThreadFree) {
+        typedef madness::TensorSlabAllocator allocT;
+        const std::size_t nbyte = 3000;
+        allocT::add_size(nbyte);
+        int cls = -1;
+        void* p = allocT::allocate(nbyte, cls);
+        ASSERT_NE(p, nullptr);
+        const std::size_t reserved = allocT::nbyte_reserved();
+
+        // the freeing thread keeps the block until it exits, then gives it to the shared pool
+        std::thread([p, cls]() {allocT::deallocate(p, cls);}).join();
+
+        // drain the rest of the slab, the next block must be the one freed by the other thread
+        std::vector<void*> blocks;
+        void* q = nullptr;
+        for (std::size_t i=0; i<=reserved/nbyte && q!=p; ++i) {
+            int c = -1;
+            q = allocT::allocate(nbyte, c);
+            ASSERT_EQ(c, cls);
+            blocks.push_back(q);
+        }
+        EXPECT_EQ(q, p);
+        EXPECT_EQ(allocT::nbyte_reserved(), reserved);
+        for (void* b : blocks) allocT::deallocate(b, cls);
+    }
+
+    TEST(TensorSlabAllocator, Tensors) {
+        typedef madness::TensorSlabAllocator allocT;
+        allocT::add_size(6*sizeof(double));
+        allocT::enable(true);
+        {
+            madness::Tensor<double> a(6), b(7);     // pooled and heap allocated
+            a.fill(1.0);
+            b.fill(2.0);
+            EXPECT_EQ(reinterpret_cast<std::uintptr_t>(a.ptr()) % 64, 0u);
+            EXPECT_EQ(a.sum(), 6.0);
+            EXPECT_EQ(b.sum(), 14.0);
+
+            // freed on another thread, still valid until then
+            madness::Tensor<double> c = a;
+            a = madness::Tensor<double>();
+            std::thread([&c]() {c = madness::Tensor<double>();}).join();
+            EXPECT_EQ(c.size(), 0);
+        }
+        allocT::enable(false);
+    }
+
+    TEST(ScratchTensorPool, Reuse) {
+        typedef madness::ScratchTensorPool<double> poolT;
+        const std::vector<long> dims = {3, 5};
+        const std::size_t n0 = poolT::size();
+
+        madness::Tensor<double> a = poolT::borrow(dims);
+        const double* pa = a.ptr();
+        madness::Tensor<double> keep = a;
+        a = madness::Tensor<double>();
+
+        // still referenced by keep, so the entry must not be handed out again
+        madness::Tensor<double> b = poolT::borrow(dims);
+        EXPECT_NE(b.ptr(), pa);
+        EXPECT_EQ(poolT::size(), n0 + 2);
+
+        // once the last reference is gone the entry is reused, zeroed and reshaped
+        keep.fill(1.0);
+        keep = madness::Tensor<double>();
+        madness::Tensor<double> c = poolT::borrow(std::vector<long>{15});
+        EXPECT_EQ(c.ptr(), pa);
+        EXPECT_EQ(c.ndim(), 1);
+        EXPECT_EQ(c.normf(), 0.0);
+
+        // clear() frees the entries, tensors still sharing them remain valid
+        c = madness::Tensor<double>();
+        EXPECT_EQ(poolT::nbytes(), poolT::size()*15*sizeof(double));
+        poolT::clear();
+        EXPECT_EQ(poolT::size(), 0u);
+        EXPECT_EQ(poolT::nbytes(), 0u);
+        b.fill(2.0);
+        EXPECT_EQ(b.sum(), 30.0);
+
+        // switched off, borrow neither reuses nor grows the pool, which is released
+        madness::Tensor<double> e = poolT::borrow(dims);
+        EXPECT_EQ(poolT::size(), 1u);
+        const double* pe = e.ptr();
+        e = madness::Tensor<double>();
+        poolT::enable(false);
+        madness::Tensor<double> d = poolT::borrow(dims);
+        EXPECT_NE(d.ptr(), pe);
+        EXPECT_EQ(d.normf(), 0.0);
+        EXPECT_EQ(poolT::size(), 0u);
+        poolT::enable(true);
+
+        // entries beyond max_bytes() are not pooled, free ones are evicted to make room
+        const std::size_t maxbyte = poolT::max_bytes();
+        poolT::set_max_bytes(16*sizeof(double));
+        madness::Tensor<double> f = poolT::borrow(dims);
+        madness::Tensor<double> g = poolT::borrow(dims);
+        EXPECT_EQ(poolT::size(), 1u);
+        f = madness::Tensor<double>();
+        madness::Tensor<double> h = poolT::borrow(std::vector<long>{4});
+        EXPECT_EQ(poolT::size(), 1u);
+        EXPECT_EQ(poolT::nbytes(), 4*sizeof(double));
+        poolT::set_max_bytes(maxbyte);
+        poolT::clear();
+    }
+
 //     TYPED_TEST(TensorTest, Container) {
 //         typedef madness::ConcurrentHashMap< int, Tensor<TypeParam> > containerT;
 //         static const int N = 100;
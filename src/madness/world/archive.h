@@ -937,6 +937,24 @@ namespace madness {
         }
 
 
+        /// Serialize an array that the archive may leave in place rather than copy.
+
+        /// Equivalent to \c ar \c & \c wrap(t,n); archives able to send or
+        /// write the array from where it lives (e.g., \c BufferOutputArchive)
+        /// overload this and keep a copy of \c owner to hold the data alive.
+        /// \tparam Archive The archive type.
+        /// \tparam T The data type.
+        /// \tparam ownerT Type of the object owning the data.
+        /// \param[in] ar The archive.
+        /// \param[in] t The pointer.
+        /// \param[in] n The number of data elements in the array.
+        /// \param[in] owner The object owning the data (unused here).
+        template <class Archive, class T, class ownerT>
+        inline void store_external(const Archive& ar, const T* t, long n, const ownerT& /*owner*/) {
+            ar & wrap(t,n);
+        }
+
+
         /// Serialize a function pointer.
 
         /// \tparam Archive The archive type.
@@ -42,6 +42,8 @@
 #include <madness/world/archive.h>
 #include <madness/world/print.h>
 #include <cstring>
+#include <memory>
+#include <vector>
 
 namespace madness {
     namespace archive {
@@ -56,24 +58,64 @@ namespace madness {
         /// \throw madness::MadnessException in case of buffer overflow.
         ///
         /// The default constructor can also be used to count stuff.
+        ///
+        /// Large arrays stored with \c store_external() may optionally be
+        /// left where they are instead of being copied into the buffer,
+        /// recording their position in the output stream and holding a
+        /// reference to their owner.  The buffer then holds only the
+        /// remaining data and the stream is reassembled by whoever consumes
+        /// the external list (e.g., the active message layer sends the
+        /// pieces with one gathered MPI send).
         class BufferOutputArchive : public BaseOutputArchive {
+        public:
+            /// An array left outside of the buffer
+            struct External {
+                std::size_t offset; ///< Position in the buffer before which the array belongs
+                const void* ptr; ///< The array
+                std::size_t nbyte; ///< Size of the array in bytes
+                std::shared_ptr<const void> owner; ///< Keeps the array alive
+            };
+
         private:
             unsigned char * const ptr; ///< The memory buffer.
             const std::size_t nbyte; ///< Buffer size.
             mutable std::size_t i; /// Current output location.
             bool countonly; ///< If true just count, don't copy.
+            std::vector<External>* external; ///< Where to record external arrays, or null.
+            std::size_t min_external; ///< Arrays at least this big (bytes) are external, 0 for none.
+            mutable std::size_t nexternal; ///< Bytes stored (counted) as external.
 
         public:
             /// Default constructor; the buffer will only count data.
             BufferOutputArchive()
-                    : ptr(nullptr), nbyte(0), i(0), countonly(true) {}
+                    : ptr(nullptr), nbyte(0), i(0), countonly(true)
+                    , external(nullptr), min_external(0), nexternal(0) {}
+
+            /// Counting constructor that also counts the data which would be external.
+
+            /// \param[in] min_external Arrays of at least this many bytes would be external (0 for none).
+            explicit BufferOutputArchive(std::size_t min_external)
+                    : ptr(nullptr), nbyte(0), i(0), countonly(true)
+                    , external(nullptr), min_external(min_external), nexternal(0) {}
 
             /// Constructor that assigns a buffer.
 
             /// \param[in] ptr Pointer to the buffer.
             /// \param[in] nbyte Size of the buffer.
             BufferOutputArchive(void* ptr, std::size_t nbyte)
-                    : ptr((unsigned char *) ptr), nbyte(nbyte), i(0), countonly(false) {}
+                    : ptr((unsigned char *) ptr), nbyte(nbyte), i(0), countonly(false)
+                    , external(nullptr), min_external(0), nexternal(0) {}
+
+            /// Constructor that assigns a buffer and leaves large arrays outside of it.
+
+            /// \param[in] ptr Pointer to the buffer.
+            /// \param[in] nbyte Size of the buffer (excluding external arrays).
+            /// \param[out] external Where external arrays are recorded.
+            /// \param[in] min_external Arrays of at least this many bytes are external (0 for none).
+            BufferOutputArchive(void* ptr, std::size_t nbyte,
+                                std::vector<External>* external, std::size_t min_external)
+                    : ptr((unsigned char *) ptr), nbyte(nbyte), i(0), countonly(false)
+                    , external(external), min_external(external ? min_external : 0), nexternal(0) {}
 
             /// Stores (counts) data into the memory buffer.
 
@@ -87,22 +129,52 @@ namespace madness {
             typename std::enable_if< madness::is_trivially_serializable<T>::value, void >::type
             store(const T* t, long n) const {
                 std::size_t m = n*sizeof(T);
+                const std::size_t j = i - nexternal; // Location in the buffer
                 if (countonly) {
                     i += m;
                 }
-                else if (i+m > nbyte) {
-                    madness::print("BufferOutputArchive:ptr,nbyte,i,n,m,i+m:",(void *)ptr,nbyte,i,n,m,i+m);
-                    MADNESS_ASSERT(i+m<=nbyte);
+                else if (j+m > nbyte) {
+                    madness::print("BufferOutputArchive:ptr,nbyte,i,n,m,i+m:",(void *)ptr,nbyte,j,n,m,j+m);
+                    MADNESS_ASSERT(j+m<=nbyte);
                 }
                 else {
 MADNESS_PRAGMA_GCC(diagnostic push)
 MADNESS_PRAGMA_GCC(diagnostic ignored "-Wmaybe-uninitialized")
-		  memcpy(ptr+i, t, m);
+		  memcpy(ptr+j, t, m);
 MADNESS_PRAGMA_GCC(diagnostic pop)
                     i += m;
                 }
             }
 
+            /// Stores (counts) an array that may be left outside of the buffer.
+
+            /// Produces the same stream as \c store(t,n).  If the array is at
+            /// least \c min_external bytes it is recorded as external, with a
+            /// copy of \c owner (typically a shallow copy of the container)
+            /// keeping it alive, otherwise it is copied into the buffer.
+            /// \tparam T Type of the data to be stored (counted).
+            /// \tparam ownerT Type of the object owning the data.
+            /// \param[in] t Pointer to the data to be stored (counted).
+            /// \param[in] n Size of data to be stored (counted).
+            /// \param[in] owner Object that keeps the data alive while copied.
+            template <typename T, typename ownerT>
+            inline
+            typename std::enable_if< madness::is_trivially_serializable<T>::value, void >::type
+            store_external(const T* t, long n, const ownerT& owner) const {
+                std::size_t m = n*sizeof(T);
+                if (!min_external || m < min_external) {
+                    store(t, n);
+                }
+                else {
+                    if (!countonly) {
+                        external->push_back(External{i - nexternal, t, m,
+                                    std::make_shared<const ownerT>(owner)});
+                    }
+                    i += m;
+                    nexternal += m;
+                }
+            }
+
             /// Open a buffer with a specific size.
             void open(std::size_t /*hint*/) {}
 
@@ -123,6 +195,13 @@ MADNESS_PRAGMA_GCC(diagnostic pop)
             inline std::size_t size() const {
                 return i;
             };
+
+            /// Return the amount of data stored (counted) as external arrays.
+
+            /// \return The amount of data stored (counted) outside of the buffer.
+            inline std::size_t nbyte_external() const {
+                return nexternal;
+            }
         };
 
 
@@ -181,6 +260,13 @@ MADNESS_PRAGMA_GCC(diagnostic pop)
             void close() {}
         };
 
+        /// Stores an array that a \c BufferOutputArchive may leave in place (see \c store_external()).
+        template <typename T, typename ownerT>
+        inline std::enable_if_t<madness::is_trivially_serializable<T>::value>
+        store_external(const BufferOutputArchive& ar, const T* t, long n, const ownerT& owner) {
+            ar.store_external(t, n, owner);
+        }
+
         /// Implement pre/postamble storage routines for a \c BufferOutputArchive.
 
         /// \note No type checking over the buffer stream, for efficiency.
@@ -16,8 +16,12 @@
 
 
 #include <madness/world/parallel_dc_archive.h>
+#include <madness/world/shared_record_store.h>
+#include <madness/world/units.h>
 #include<any>
 #include<iomanip>
+#include<mutex>
+#include<set>
 
 
 /*!
@@ -144,10 +148,36 @@ struct Recordlist {
 ///      do work
 ///  }
 ///  subworld.gop.fence();
+///
+/// Before the records are loaded in the subworlds, start_replication() makes them available to
+/// all processes according to the ReplicationPolicy, which defaults to the value of the environment
+/// variable MAD_CLOUD_REPLICATION (upfront, pipelined or on_demand). In on_demand mode the cache of
+/// loaded objects is bounded by MAD_CLOUD_CACHE_SIZE (e.g. 2GB, default unbounded). With
+/// MAD_CLOUD_NODE_SHARED=1 upfront replication keeps a single copy of the records per node in
+/// shared memory instead of one per process; the loaded objects are still cached per process,
+/// since they belong to the process's subworld.
+///
+/// With MAD_CLOUD_VERSIONED=1 the records are versioned by a hash of their content and kept
+/// across runs: storing an object whose record is unchanged rewrites and replicates nothing,
+/// so a cloud reused in an iteration only moves the objects that changed. Records that were
+/// not stored again since the last run are removed by clear_stale(). Since records are keyed
+/// by object id, objects that are modified in place are detected by their content hash.
+/// Together with MAD_CLOUD_NODE_SHARED=1 every replication rebuilds the node-shared store from
+/// the current records, so superseded and stale versions do not accumulate in shared memory.
 class Cloud {
 
+public:
+    /// how the records of the container are made available to all processes
+    enum ReplicationPolicy {
+        replicate_upfront,      ///< copy all records to all processes before any task starts
+        replicate_pipelined,    ///< push records down a broadcast tree while tasks already run
+        fetch_on_demand         ///< fetch records from their owner on first access, cache with LRU eviction
+    };
+
+private:
     bool debug = false;       ///< prints debug output
     bool is_replicated=false;   ///< if contents of the container are replicated
+    bool is_pipelined=false;    ///< if records are being pushed to all processes
     bool dofence = true;      ///< fences after load/store
     bool force_load_from_cache = false;       ///< forces load from cache (mainly for debugging)
 
@@ -158,12 +188,64 @@ public:
     using valueT = std::vector<unsigned char>;
     typedef std::map<keyT, cached_objT> cacheT;
     typedef Recordlist<keyT> recordlistT;
+    static_assert(std::is_same_v<keyT, SharedRecordStore::keyT>, "record keys of the node-shared store differ");
 
 private:
+    /// receives the records pushed down the broadcast tree in pipelined replication
+    class Replicator : public WorldObject<Replicator> {
+        Cloud& cloud;
+    public:
+        Replicator(World& world, Cloud& cloud) : WorldObject<Replicator>(world), cloud(cloud) {
+            this->process_pending();
+        }
+
+        void receive(const ProcessID owner, const keyT& key, const valueT& data) {
+            cloud.receive_record(owner, key, data);
+        }
+    };
+
     mutable madness::WorldContainer<keyT, valueT> container;
     cacheT cached_objects;
     recordlistT local_list_of_container_keys;   // a world-local list of keys occupied in container
 
+    ReplicationPolicy replication_policy=initial_replication_policy();
+    std::size_t cache_budget=initial_cache_budget();    ///< max bytes of cached objects in on_demand mode, 0: unbounded
+    std::shared_ptr<Replicator> replicator;
+    bool node_shared=initial_node_shared();    ///< replicate upfront into a node-shared store
+    std::shared_ptr<SharedRecordStore> node_store;
+    bool versioned=initial_versioned();     ///< keep records across runs, rewrite only changed ones
+    std::map<keyT, hashT> versions;         ///< content hash of the current version of each record
+    std::map<keyT, ProcessID> changed;      ///< records written since the last replication, and their holder
+    std::set<keyT> restored;                ///< records stored since the last clear_stale()
+    mutable std::mutex replica_mutex;
+    mutable std::map<keyT, valueT> replica;     ///< records received through the broadcast tree
+    mutable std::set<keyT> loaded;              ///< records loaded and dropped from replica in this run
+    mutable std::list<keyT> lru;                ///< cached records, most recently used first
+    mutable std::map<keyT, std::pair<std::list<keyT>::iterator, std::size_t>> lru_entry;
+    mutable std::size_t cached_bytes=0;         ///< size of the cached records in on_demand mode
+
+    static ReplicationPolicy initial_replication_policy() {
+        const char* policy = std::getenv("MAD_CLOUD_REPLICATION");
+        if (policy && std::string(policy) == "pipelined") return replicate_pipelined;
+        if (policy && std::string(policy) == "on_demand") return fetch_on_demand;
+        return replicate_upfront;
+    }
+
+    static bool initial_node_shared() {
+        const char* shared = std::getenv("MAD_CLOUD_NODE_SHARED");
+        return shared && std::string(shared) == "1";
+    }
+
+    static bool initial_versioned() {
+        const char* versioned = std::getenv("MAD_CLOUD_VERSIONED");
+        return versioned && std::string(versioned) == "1";
+    }
+
+    static std::size_t initial_cache_budget() {
+        const char* budget = std::getenv("MAD_CLOUD_CACHE_SIZE");
+        return budget ? cstr_to_memory_size(budget) : 0;
+    }
+
 public:
     template <typename T>
     using member_cloud_serialize_t = decltype(std::declval<T>().cloud_store(std::declval<World&>(), std::declval<Cloud&>()));
@@ -174,8 +256,8 @@ public:
 public:
 
     /// @param[in]	universe	the universe world
-    Cloud(madness::World &universe) : container(universe), reading_time(0l), writing_time(0l),
-        cache_reads(0l), cache_stores(0l) {
+    Cloud(madness::World &universe) : container(universe), replicator(new Replicator(universe, *this)),
+        reading_time(0l), writing_time(0l), cache_reads(0l), cache_stores(0l) {
     }
 
     void set_debug(bool value) {
@@ -190,6 +272,33 @@ public:
         force_load_from_cache = value;
     }
 
+    void set_replication_policy(const ReplicationPolicy policy) {
+        replication_policy = policy;
+    }
+
+    ReplicationPolicy get_replication_policy() const {
+        return replication_policy;
+    }
+
+    /// keep one copy of the replicated records per node in shared memory (upfront replication only)
+    void set_node_shared(const bool value) {
+        node_shared = value;
+    }
+
+    /// keep the records across runs and rewrite only those whose content changed
+    void set_versioned(const bool value) {
+        versioned = value;
+    }
+
+    bool is_versioned() const {
+        return versioned;
+    }
+
+    /// bound the memory of the cached objects in on_demand mode, measured by their record size (0: unbounded)
+    void set_cache_budget(const std::size_t nbyte) {
+        cache_budget = nbyte;
+    }
+
     void print_size(World& universe) {
 
         std::size_t memsize=0;
@@ -223,6 +332,7 @@ public:
             print("min/max of node");
             print("  memory in GBytes:         ",min_memsize*byte2gbyte,max_memsize*byte2gbyte);
             print("  max record size in GBytes:",max_record_size*byte2gbyte);
+            if (node_store) print("  shared per node in GBytes: ",node_store->size()*byte2gbyte);
 
         }
     }
@@ -236,8 +346,14 @@ public:
         universe.gop.sum(ptime);
         long creads = long(cache_reads);
         long cstores = long(cache_stores);
+        long cevictions = long(cache_evictions);
+        long unchanged = long(unchanged_stores);
+        long nreplicated = long(replicated_records);
         universe.gop.sum(creads);
         universe.gop.sum(cstores);
+        universe.gop.sum(cevictions);
+        universe.gop.sum(unchanged);
+        universe.gop.sum(nreplicated);
         if (universe.rank() == 0) {
             auto precision = std::cout.precision();
             std::cout << std::fixed << std::setprecision(1);
@@ -247,16 +363,66 @@ public:
             std::cout << std::setprecision(precision) << std::scientific;
             print("cloud cache stores    ", long(cstores));
             print("cloud cache loads     ", long(creads));
+            if (cevictions>0) print("cloud cache evictions ", cevictions);
+            if (versioned) {
+                print("cloud unchanged stores", unchanged);
+                print("cloud records replicated", nreplicated);
+            }
         }
     }
     void clear_cache(World &subworld) {
         cached_objects.clear();
+        lru.clear();
+        lru_entry.clear();
+        cached_bytes=0;
         local_list_of_container_keys.list.clear();
         subworld.gop.fence();
     }
 
     void clear() {
         container.clear();
+        node_store.reset();
+        versions.clear();
+        changed.clear();
+        restored.clear();
+        is_pipelined=false;
+        std::lock_guard<std::mutex> lock(replica_mutex);
+        replica.clear();
+        loaded.clear();
+    }
+
+    /// remove the records that have not been stored again since the last call
+
+    /// Called by all processes of the universe at the end of a run. Without versioning
+    /// all records are stale: the cloud is cleared and, if it was replicated, gets a new
+    /// distributed container, so that it can be stored to again in the next run.
+    void clear_stale() {
+        if (not versioned) {
+            clear();
+            if (is_replicated) {
+                World& world=container.get_world();
+                container=madness::WorldContainer<keyT, valueT>(world);
+                is_replicated=false;
+                world.gop.fence();
+            }
+            return;
+        }
+        World& world=container.get_world();
+        world.gop.fence();
+        for (auto it=versions.begin(); it!=versions.end();) {
+            if (restored.count(it->first)==0) {
+                // after replication every process holds a copy, before only the owner
+                if (is_replicated or world.rank()==0) container.erase(it->first);
+                std::lock_guard<std::mutex> lock(replica_mutex);
+                replica.erase(it->first);
+                it=versions.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        restored.clear();
+        is_pipelined=false;
+        world.gop.fence();
     }
 
     void clear_timings() {
@@ -266,6 +432,25 @@ public:
         replication_time=0l;
         cache_stores=0l;
         cache_reads=0l;
+        cache_evictions=0l;
+        unchanged_stores=0l;
+        replicated_records=0l;
+    }
+
+    /// size in bytes of the node-shared store of the replicated records, 0 if there is none
+    std::size_t get_node_store_size() const {
+        return node_store ? node_store->size() : 0;
+    }
+
+    /// number of records pushed to this process in pipelined mode that it has not loaded yet
+    std::size_t get_replica_size() const {
+        std::lock_guard<std::mutex> lock(replica_mutex);
+        return replica.size();
+    }
+
+    /// number of records this process has sent to the others during replication
+    long get_replicated_records() const {
+        return replicated_records;
     }
 
     /// @param[in]  world the subworld the objects are loaded to
@@ -312,7 +497,7 @@ public:
     /// @param[in]  world presumably the universe
     template<typename T>
     recordlistT store(madness::World &world, const T &source) {
-        if (is_replicated) {
+        if (is_replicated and not versioned) {
             print("Cloud contents are replicated and read-only!");
             MADNESS_EXCEPTION("cloud error",1);
         }
@@ -334,6 +519,33 @@ public:
         return recordlist;
     }
 
+    /// make the records available to all processes according to the replication policy
+
+    /// Must be called by all processes of the universe after the last store. Only in
+    /// replicate_upfront mode all records are present everywhere on return; in pipelined mode
+    /// they are still travelling down the broadcast tree, and loads of records that have not yet
+    /// arrived fetch them from their owner, as in on_demand mode.
+    void start_replication() {
+        if (replication_policy==replicate_upfront) {
+            replicate();
+        } else if (replication_policy==replicate_pipelined) {
+            World& world=container.get_world();
+            world.gop.fence();
+            cloudtimer t(world,replication_time);
+            is_pipelined=true;
+            {
+                std::lock_guard<std::mutex> lock(replica_mutex);
+                loaded.clear();
+            }
+            for (auto it=container.begin(); it!=container.end(); ++it) {
+                if (versioned and not is_changed_here(it->first)) continue;
+                push_record(world.rank(),it->first,it->second);
+                replicated_records++;
+            }
+        }
+        changed.clear();
+    }
+
     void replicate(const std::size_t chunk_size=INT_MAX) {
 
         double cpu0=cpu_time();
@@ -343,11 +555,52 @@ public:
         container.reset_pmap_to_local();
         is_replicated=true;
 
+        // with versioning only the records written since the last replication are sent, by their holder
         std::list<keyT> keylist;
+        std::size_t nbyte=0;
         for (auto it=container.begin(); it!=container.end(); ++it) {
+            if (versioned and not is_changed_here(it->first)) continue;
             keylist.push_back(it->first);
+            nbyte+=it->second.size();
         }
 
+        // a versioned cloud rebuilds its node-shared store: the current records that have not changed
+        // are carried over from the old store (or the container, if an earlier rebuild failed), and the
+        // old store is dropped with the stale and superseded records; all processes find the same ones
+        std::set<keyT> retained;
+        std::size_t retained_nbyte=0;
+        if (node_shared and node_store and versioned) {
+            std::vector<keyT> keys=node_store->keys();
+            for (auto it=container.begin(); it!=container.end(); ++it) keys.push_back(it->first);
+            for (const keyT& key : keys) {
+                if (versions.count(key)==0 or changed.count(key)>0) continue;
+                if (retained.insert(key).second) retained_nbyte+=current_record(key).second;
+            }
+        }
+        changed.clear();
+
+        // with a node-shared store only its writer keeps the records, the others receive into scratch;
+        // if no new store can be created the records are replicated into the container
+        bool fill_store=false;
+        if (node_shared and (not node_store or versioned)) {
+            std::size_t nrecord=keylist.size();
+            world.gop.sum(nrecord);
+            world.gop.sum(nbyte);
+            auto store=SharedRecordStore::create(world.mpi.comm(),nrecord+retained.size(),nbyte+retained_nbyte);
+            if (store and store->is_writer()) {
+                for (const keyT& key : retained) {
+                    const auto [data,sz]=current_record(key);
+                    std::copy(data,data+sz,store->append(key,sz));
+                }
+            }
+            if (store) {
+                node_store=store;
+                fill_store=true;
+            }
+        }
+        const bool write_shared=fill_store and node_store->is_writer();
+        valueT scratch;
+
         for (ProcessID rank=0; rank<world.size(); rank++) {
             if (rank == world.rank()) {
                 std::size_t keylistsize = keylist.size();
@@ -362,6 +615,8 @@ public:
 
                     world.mpi.Bcast(&key,sizeof(key),MPI_BYTE,rank);
                     world.mpi.Bcast(&sz,sizeof(sz),MPI_BYTE,rank);
+                    replicated_records++;
+                    if (write_shared) std::copy(data.begin(),data.end(),node_store->append(key,sz));
 
                     // if data is too large for MPI_INT break it into pieces to avoid integer overflow
                     for (std::size_t start=0; start<sz; start+=chunk_size) {
@@ -379,6 +634,20 @@ public:
                     world.mpi.Bcast(&key,sizeof(key),MPI_BYTE,rank);
                     std::size_t sz;
                     world.mpi.Bcast(&sz,sizeof(sz),MPI_BYTE,rank);
+                    if (fill_store) {
+                        unsigned char* dest=nullptr;
+                        if (write_shared) {
+                            dest=node_store->append(key,sz);
+                        } else {
+                            scratch.resize(sz);
+                            dest=scratch.data();
+                        }
+                        for (std::size_t start=0; start<sz; start+=chunk_size) {
+                            std::size_t remainder=std::min(sz-start,chunk_size);
+                            world.mpi.Bcast(dest+start,remainder,MPI_BYTE,rank);
+                        }
+                        continue;
+                    }
                     valueT data(sz);
 //                    world.mpi.Bcast(&data[0],sz,MPI_BYTE,rank);
                     for (std::size_t start=0; start<sz; start+=chunk_size) {
@@ -390,6 +659,10 @@ public:
                 }
             }
         }
+        if (fill_store) {
+            if (write_shared) node_store->seal();
+            container.clear();
+        }
         world.gop.fence();
         double cpu1=cpu_time();
         if (debug and (world.rank()==0)) print("replication ended after ",cpu1-cpu0," seconds");
@@ -403,6 +676,9 @@ private:
     mutable std::atomic<long> replication_time=0l;    // in ms
     mutable std::atomic<long> cache_reads=0l;
     mutable std::atomic<long> cache_stores=0l;
+    mutable std::atomic<long> cache_evictions=0l;
+    mutable std::atomic<long> unchanged_stores=0l;
+    mutable std::atomic<long> replicated_records=0l;
 
     template<typename> struct is_tuple : std::false_type { };
     template<typename ...T> struct is_tuple<std::tuple<T...>> : std::true_type { };
@@ -434,9 +710,75 @@ private:
         }
     };
 
+    /// send a record to the children of this process in the binary tree rooted at its owner
+    void push_record(const ProcessID owner, const keyT& key, const valueT& data) const {
+        const int nproc=replicator->get_world().size();
+        const int me=(replicator->get_world().rank()-owner+nproc)%nproc;
+        for (int child=2*me+1; child<=std::min(2*me+2,nproc-1); ++child) {
+            replicator->send((child+owner)%nproc, &Replicator::receive, owner, key, data);
+        }
+    }
+
+    /// keep a pushed record unless it has already been loaded from its owner, and pass it on
+    void receive_record(const ProcessID owner, const keyT& key, const valueT& data) {
+        {
+            std::lock_guard<std::mutex> lock(replica_mutex);
+            if (loaded.count(key)==0) replica[key]=data;
+        }
+        push_record(owner,key,data);
+    }
+
+    /// the data and size of a record that is in the local container or in the node-shared store
+    std::pair<const unsigned char*, std::size_t> current_record(const keyT& key) const {
+        madness::WorldContainer<keyT, valueT>::const_accessor acc;
+        if (container.find(acc,key)) return {acc->second.data(), acc->second.size()};
+        std::size_t sz=0;
+        const unsigned char* data=node_store->find(key,sz);
+        MADNESS_CHECK(data);
+        return {data, sz};
+    }
+
+    /// get a record from the local replica if it has arrived, else from the container
+    valueT fetch_record(const keyT& record) const {
+        if (node_store) {
+            // records changed after the node-shared store was filled live in the (local) container
+            auto it=container.find(record).get();
+            if (it!=container.end()) return it->second;
+            std::size_t nbyte=0;
+            const unsigned char* data=node_store->find(record,nbyte);
+            if (data) return valueT(data,data+nbyte);
+        }
+        if (is_pipelined) {
+            std::lock_guard<std::mutex> lock(replica_mutex);
+            auto it=replica.find(record);
+            if (it!=replica.end()) return it->second;
+        }
+        auto it=container.find(record).get();
+        if (it==container.end()) {
+            print("record",record,"not found in cloud container");
+            MADNESS_EXCEPTION("record not found", record);
+        }
+        return it->second;
+    }
+
     template<typename T>
-    void cache(madness::World &world, const T &obj, const keyT &record) const {
+    void cache(madness::World &world, const T &obj, const keyT &record, std::size_t nbyte) const {
         const_cast<cacheT &>(cached_objects).insert({record,std::make_any<T>(obj)});
+
+        // in on_demand mode evicted records can be fetched again, the record size is known on rank 0 only
+        if (replication_policy!=fetch_on_demand or cache_budget==0) return;
+        world.gop.broadcast(nbyte,0);
+        lru.push_front(record);
+        lru_entry[record]={lru.begin(),nbyte};
+        cached_bytes+=nbyte;
+        while (cached_bytes>cache_budget and lru.size()>1) {
+            const keyT victim=lru.back();
+            cached_bytes-=lru_entry[victim].second;
+            lru_entry.erase(victim);
+            lru.pop_back();
+            const_cast<cacheT &>(cached_objects).erase(victim);
+            if (world.rank()==0) cache_evictions++;
+        }
     }
 
     /// load an object from the cache, record is unchanged
@@ -444,6 +786,8 @@ private:
     T load_from_cache(madness::World &world, const keyT &record) const {
         if (world.rank()==0) cache_reads++;
         if (debug) print("loading", typeid(T).name(), "from cache record", record, "to world", world.id());
+        auto entry = lru_entry.find(record);
+        if (entry != lru_entry.end()) lru.splice(lru.begin(), lru, entry->second.first);
         if (auto obj = std::any_cast<T>(&cached_objects.find(record)->second)) return *obj;
         MADNESS_EXCEPTION("failed to load from cloud-cache", 1);
         T target = allocator<T>(world);
@@ -464,6 +808,12 @@ private:
         return it!=local_list_of_container_keys.list.end();
     }
 
+    /// checks if a record has been written since the last replication and this process holds it
+    bool is_changed_here(const keyT &key) const {
+        auto it = changed.find(key);
+        return it!=changed.end() and it->second==container.get_world().rank();
+    }
+
     template<typename T>
     T allocator(World &world) const {
         if constexpr (is_world_constructible<T>::value) {
@@ -496,12 +846,39 @@ private:
             madness::archive::ContainerRecordOutputArchive ar(world, container, record);
             madness::archive::ParallelOutputArchive<madness::archive::ContainerRecordOutputArchive> par(world, ar);
             par & source;
+            if (versioned and not update_version(world, ar, record)) {
+                // the parallel archive writes through its own copy of the record archive
+                ar.discard();
+                if (world.rank()==0) par.local_archive().discard();
+            }
             local_list_of_container_keys+=record;
         }
         if (dofence) world.gop.fence();
         return recordlistT{record};
     }
 
+    /// compare the content of a freshly serialized record with its current version
+
+    /// A changed record is remembered for replication together with the process it is written to.
+    /// @return if the record has changed
+    bool update_version(World& world, const madness::archive::ContainerRecordOutputArchive& ar, const keyT& record) {
+        MADNESS_CHECK(world.id()==container.get_world().id());
+        hashT hash = (world.rank()==0) ? ar.content_hash() : 0;
+        world.gop.broadcast(hash,0);
+        restored.insert(record);
+        auto it=versions.find(record);
+        if (it!=versions.end() and it->second==hash) {
+            if (world.rank()==0) unchanged_stores++;
+            return false;
+        }
+        versions[record]=hash;
+        // after replication the pmap is local and rank 0 writes the record into its own container
+        changed[record]= is_replicated ? 0 : container.owner(record);
+        std::lock_guard<std::mutex> lock(replica_mutex);
+        replica.erase(record);
+        return true;
+    }
+
 public:
     /// load a vector from the cloud, pop records from recordlist
     ///
@@ -531,13 +908,22 @@ public:
         if (is_cached(record)) return load_from_cache<T>(world, record);
         if (debug) print("loading", typeid(T).name(), "from container record", record, "to world", world.id());
         T target = allocator<T>(world);
-        madness::archive::ContainerRecordInputArchive ar(world, container, record);
+        valueT data;
+        if (world.rank()==0) data=fetch_record(record);
+        const std::size_t nbyte=data.size();
+        madness::archive::ContainerRecordInputArchive ar(world, std::move(data));
         madness::archive::ParallelInputArchive<madness::archive::ContainerRecordInputArchive> par(world, ar);
         par & target;
 
-        if (is_replicated) container.erase(record);
+        if (is_replicated and not versioned) container.erase(record);
+        if (is_pipelined and not versioned) {
+            // a push that arrives after the record was fetched from its owner must not be kept
+            std::lock_guard<std::mutex> lock(replica_mutex);
+            replica.erase(record);
+            loaded.insert(record);
+        }
 
-        cache(world, target, record);
+        cache(world, target, record, nbyte);
         return target;
     }
 
@@ -62,9 +62,12 @@ namespace madness {
         uint64_t npop_front;    ///< #calls to pop_front
         uint64_t ngrow;         ///< #calls to grow
         uint64_t nmax;          ///< Lifetime max. entries in the queue
+        uint64_t npush_local;   ///< #tasks pushed on ThreadPool per-thread deques
+        uint64_t nsteal;        ///< #tasks stolen from ThreadPool per-thread deques
 
         DQStats()
-                : npush_back(0), npush_front(0), npop_front(0), ngrow(0), nmax(0) {}
+                : npush_back(0), npush_front(0), npop_front(0), ngrow(0), nmax(0)
+                , npush_local(0), nsteal(0) {}
     };
 
 
@@ -0,0 +1,58 @@
+//
+// Node-shared memory segments, see node_shared_segment.h
+//
+
+#include <madness/world/node_shared_segment.h>
+
+#include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace madness {
+
+unsigned char* map_node_shared_segment(const SafeMPI::Intracomm& node, const SafeMPI::Intracomm& agree,
+                                       const std::string& kind, const std::size_t len, const bool writable) {
+    const int me = node.Get_rank();
+
+    long id = getpid();
+    node.Bcast(&id, 1, MPI_LONG, 0);
+    std::stringstream ss;
+    ss << "/madness_" << kind << "_" << id;
+    const std::string name = ss.str();
+
+    void* base = MAP_FAILED;
+    auto attach = [&](int flags) {
+        const int fd = shm_open(name.c_str(), flags, 0600);
+        if (fd < 0) return;
+        bool sized = true;
+        if (flags & O_CREAT) {
+            sized = (ftruncate(fd, len) == 0);
+#ifdef __linux__
+            // Reserve the pages now rather than fault on a full /dev/shm later
+            sized = sized && (posix_fallocate(fd, 0, len) == 0);
+#endif
+        }
+        const int prot = (flags & O_RDWR) ? (PROT_READ | PROT_WRITE) : PROT_READ;
+        if (sized) base = mmap(nullptr, len, prot, MAP_SHARED, fd, 0);
+        close(fd);
+    };
+    if (me == 0) attach(O_CREAT | O_EXCL | O_RDWR);
+    node.Barrier();
+    if (me != 0) attach(writable ? O_RDWR : O_RDONLY);
+
+    int ok = (base != MAP_FAILED), allok = 0;
+    agree.Allreduce(&ok, &allok, 1, MPI_INT, MPI_MIN);
+    if (me == 0) shm_unlink(name.c_str()); // Everyone is attached, or has given up
+    if (!allok) {
+        if (base != MAP_FAILED) munmap(base, len);
+        return nullptr;
+    }
+    return static_cast<unsigned char*>(base);
+}
+
+void unmap_node_shared_segment(unsigned char* base, const std::size_t len) {
+    munmap(base, len);
+}
+
+} // namespace madness
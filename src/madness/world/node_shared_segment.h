@@ -0,0 +1,36 @@
+/**
+ \file node_shared_segment.h
+ \brief Maps POSIX shared memory onto all processes of a node
+ \ingroup world
+*/
+
+#ifndef MADNESS_WORLD_NODE_SHARED_SEGMENT_H__INCLUDED
+#define MADNESS_WORLD_NODE_SHARED_SEGMENT_H__INCLUDED
+
+#include <madness/world/safempi.h>
+#include <cstddef>
+#include <string>
+
+namespace madness {
+
+/// map one shared-memory segment of \c len bytes onto every process of a node
+
+/// The first process of \c node creates the segment, named after \c kind and its pid, then
+/// the others attach to it. The segment is unlinked once all of them are attached, so it goes
+/// away with the last mapping. Collective over \c node and \c agree, where \c agree contains
+/// \c node and is the communicator whose processes must all succeed.
+/// \param[in] node the processes on this node, from \c Split_type(SHARED_SPLIT_TYPE)
+/// \param[in] agree the processes that must all have mapped their segment
+/// \param[in] kind distinguishes segments that exist at the same time, e.g. "rmi"
+/// \param[in] len the size of the segment in bytes
+/// \param[in] writable whether processes other than the first one map it read-write
+/// \return the address of the segment, or nullptr on all processes of \c agree if any of them failed
+unsigned char* map_node_shared_segment(const SafeMPI::Intracomm& node, const SafeMPI::Intracomm& agree,
+                                       const std::string& kind, const std::size_t len, const bool writable);
+
+/// unmap a segment returned by map_node_shared_segment()
+void unmap_node_shared_segment(unsigned char* base, const std::size_t len);
+
+} // namespace madness
+
+#endif // MADNESS_WORLD_NODE_SHARED_SEGMENT_H__INCLUDED
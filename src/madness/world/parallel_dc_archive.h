@@ -21,6 +21,7 @@ namespace madness {
             containerT& dc; // lifetime???
             std::vector<unsigned char> v;
             VectorOutputArchive ar;
+            bool discarded=false;
             
         public:
 
@@ -52,8 +53,18 @@ namespace madness {
             
             void flush() {}
             
+            /// hash of the serialized record, valid on rank 0 after the object has been stored
+            hashT content_hash() const {
+                return hash_range(v.data(), v.size());
+            }
+
+            /// do not write the record into the container on close
+            void discard() {
+                discarded=true;
+            }
+
             void close() {
-                if (subworld.rank() == 0) dc.replace(key,v);
+                if (subworld.rank() == 0 and not discarded) dc.replace(key,v);
             }
         };
         
@@ -83,6 +94,13 @@ namespace madness {
                 }
             }
             
+            /// read a record that has already been fetched, only rank 0 of the subworld reads it
+            ContainerRecordInputArchive(World& subworld, std::vector<unsigned char>&& record)
+                : rank(subworld.rank())
+                , v(std::move(record))
+                , ar(v)
+            {}
+
             ~ContainerRecordInputArchive()
             {}
             
@@ -964,6 +964,29 @@ namespace SafeMPI {
       MADNESS_MPI_TEST(MPI_Op_free(&op));
     }
 
+    /// Analogous to MPI_Get_address
+    inline MPI_Aint Get_address(const void* location) {
+      MPI_Aint result;
+      MADNESS_MPI_TEST(MPI_Get_address(location, &result));
+      return result;
+    }
+
+    /// Analogous to MPI_Type_create_hindexed followed by MPI_Type_commit
+    inline MPI_Datatype Type_create_hindexed(int count, const int* blocklengths,
+                                             const MPI_Aint* displacements, MPI_Datatype oldtype) {
+      SAFE_MPI_GLOBAL_MUTEX;
+      MPI_Datatype result;
+      MADNESS_MPI_TEST(MPI_Type_create_hindexed(count, blocklengths, displacements, oldtype, &result));
+      MADNESS_MPI_TEST(MPI_Type_commit(&result));
+      return result;
+    }
+
+    /// Analogous to MPI_Type_free
+    inline void Type_free(MPI_Datatype datatype) {
+      SAFE_MPI_GLOBAL_MUTEX;
+      MADNESS_MPI_TEST(MPI_Type_free(&datatype));
+    }
+
 } // namespace SafeMPI
 
 #endif // MADNESS_WORLD_SAFEMPI_H__INCLUDED
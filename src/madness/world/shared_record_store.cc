@@ -0,0 +1,81 @@
+//
+// Node-shared record store of the cloud, see shared_record_store.h
+//
+
+#include <madness/world/shared_record_store.h>
+#include <madness/world/node_shared_segment.h>
+#include <madness/world/madness_exception.h>
+#include <madness/world/print.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <string>
+
+namespace madness {
+
+std::shared_ptr<SharedRecordStore> SharedRecordStore::create(const SafeMPI::Intracomm& comm,
+                                                             const std::size_t nrecord, const std::size_t nbyte) {
+    // Segments of successive stores must have different names
+    static std::atomic<long> nstore{0};
+    const long istore = nstore++;
+
+    SafeMPI::Intracomm node = comm.Split_type(SafeMPI::Intracomm::SHARED_SPLIT_TYPE, comm.Get_rank());
+    const int me = node.Get_rank();
+    const std::size_t len = (nrecord + 1)*sizeof(Entry) + nbyte;
+
+    // All processes must agree, since the store changes how records are replicated
+    unsigned char* base = map_node_shared_segment(node, comm, "cloud_" + std::to_string(istore), len, false);
+    if (!base) {
+        if (comm.Get_rank() == 0)
+            print_error("!!! WARNING: could not map ", len, " bytes of shared memory for MAD_CLOUD_NODE_SHARED.\n",
+                        "!!! WARNING: The cloud will keep a copy of the records on each process.\n");
+        return std::shared_ptr<SharedRecordStore>();
+    }
+
+    std::shared_ptr<SharedRecordStore> store(
+        new SharedRecordStore(base, len, nrecord, me == 0));
+    if (store->writer) store->nentry() = 0;
+    return store;
+}
+
+SharedRecordStore::~SharedRecordStore() {
+    unmap_node_shared_segment(base, len);
+}
+
+unsigned char* SharedRecordStore::append(const keyT key, const std::size_t nbyte) {
+    MADNESS_ASSERT(writer);
+    MADNESS_CHECK(nentry() < capacity);
+    Entry* e = entries();
+    const std::size_t n = nentry();
+    const std::size_t offset = (n == 0) ? 0 : e[n-1].offset + e[n-1].nbyte;
+    MADNESS_CHECK(data() + offset + nbyte <= base + len);
+    e[n] = Entry{key, offset, nbyte};
+    nentry() = n + 1;
+    return data() + offset;
+}
+
+void SharedRecordStore::seal() {
+    MADNESS_ASSERT(writer);
+    std::sort(entries(), entries() + nentry(),
+              [](const Entry& a, const Entry& b) { return a.key < b.key; });
+}
+
+const unsigned char* SharedRecordStore::find(const keyT key, std::size_t& nbyte) const {
+    const Entry* begin = entries();
+    const Entry* end = begin + nentry();
+    const Entry* e = std::lower_bound(begin, end, key,
+                                      [](const Entry& a, const keyT k) { return a.key < k; });
+    if (e == end || e->key != key) return nullptr;
+    nbyte = e->nbyte;
+    return data() + e->offset;
+}
+
+std::vector<SharedRecordStore::keyT> SharedRecordStore::keys() const {
+    std::vector<keyT> result;
+    result.reserve(nentry());
+    for (const Entry* e = entries(); e != entries() + nentry(); ++e) result.push_back(e->key);
+    return result;
+}
+
+} // namespace madness
@@ -0,0 +1,78 @@
+/**
+ \file shared_record_store.h
+ \brief Declares the \c SharedRecordStore class, which keeps the records of a Cloud once per node
+ \ingroup world
+*/
+
+#ifndef MADNESS_WORLD_SHARED_RECORD_STORE_H__INCLUDED
+#define MADNESS_WORLD_SHARED_RECORD_STORE_H__INCLUDED
+
+#include <madness/world/safempi.h>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace madness {
+
+/// serialized records stored once per node in POSIX shared memory
+
+/// One process per node writes the records, after a fence all processes on the node read them
+/// in place. The segment is unlinked right after all processes attached, the mapping lives as
+/// long as the store (or a copy of the shared pointer to it) exists.
+class SharedRecordStore {
+public:
+    using keyT = long;      ///< same as the record keys of the cloud
+
+    /// create a store on every node for \c nrecord records with \c nbyte bytes in total
+
+    /// Collective over \c comm.
+    /// \return the store, or an empty pointer on all processes if shared memory is not available
+    static std::shared_ptr<SharedRecordStore> create(const SafeMPI::Intracomm& comm,
+                                                     const std::size_t nrecord, const std::size_t nbyte);
+
+    ~SharedRecordStore();
+
+    SharedRecordStore(const SharedRecordStore&) = delete;
+    SharedRecordStore& operator=(const SharedRecordStore&) = delete;
+
+    /// the process on this node that writes the records
+    bool is_writer() const {return writer;}
+
+    /// reserve space for a record (writer only) and return where to put its data
+    unsigned char* append(const keyT key, const std::size_t nbyte);
+
+    /// sort the index after the last record was appended (writer only)
+    void seal();
+
+    /// find a record, nullptr if it is not in the store
+    const unsigned char* find(const keyT key, std::size_t& nbyte) const;
+
+    /// the keys of all records in the store
+    std::vector<keyT> keys() const;
+
+    /// size of the segment in bytes
+    std::size_t size() const {return len;}
+
+private:
+    struct Entry {
+        keyT key;
+        std::size_t offset;
+        std::size_t nbyte;
+    };
+
+    unsigned char* base;    ///< the segment: number of entries, the entries, the data
+    std::size_t len;
+    std::size_t capacity;   ///< max number of entries
+    bool writer;
+
+    SharedRecordStore(unsigned char* base, std::size_t len, std::size_t capacity, bool writer)
+        : base(base), len(len), capacity(capacity), writer(writer) {}
+
+    std::size_t& nentry() const {return *reinterpret_cast<std::size_t*>(base);}
+    Entry* entries() const {return reinterpret_cast<Entry*>(base+sizeof(Entry));}
+    unsigned char* data() const {return base+(capacity+1)*sizeof(Entry);}
+};
+
+} // namespace madness
+
+#endif // MADNESS_WORLD_SHARED_RECORD_STORE_H__INCLUDED
@@ -1,4 +1,7 @@
 #include <madness/world/MADworld.h>
+#include <madness/world/wsdeque.h>
+#include <atomic>
+#include <thread>
 
 // This program is used to do a simple test of the task queue.
 
@@ -62,11 +65,44 @@ public:
     static bool finished() {return total_count==(NGEN*NTASK);}
 };
 
+// Owner pushes and pops while thieves steal; every value must be taken exactly once
+void test_wsdeque(const int nthief, const long nvalue) {
+    madness::WorkStealingDeque<long*> dq(2); // Small initial size to exercise grow
+    std::vector<long> values(nvalue), taken(nvalue, 0);
+    for (long i=0; i<nvalue; ++i) values[i] = i;
+    std::atomic<bool> done(false);
+
+    std::vector<std::thread> thieves;
+    for (int t=0; t<nthief; ++t) {
+        thieves.emplace_back([&]() {
+            long* p;
+            while (!done.load() || !dq.empty()) {
+                if (dq.steal(p)) ++taken[*p];
+            }
+        });
+    }
+
+    long* p;
+    for (long i=0; i<nvalue; ++i) {
+        dq.push(&values[i]);
+        if (i%3 == 0 && dq.pop(p)) ++taken[*p];
+    }
+    while (dq.pop(p)) ++taken[*p];
+    done = true;
+    for (auto& t : thieves) t.join();
+
+    for (long i=0; i<nvalue; ++i) MADNESS_CHECK(taken[i] == 1);
+    std::cout << "WorkStealingDeque: " << dq.get_npush() << " pushed, "
+              << dq.get_nsteal() << " stolen\n";
+}
+
 int main(int argc, char** argv) {
     bool smalltest = false;
     if (getenv("MAD_SMALL_TESTS")) smalltest=true;
     for (int iarg=1; iarg<argc; iarg++) if (strcmp(argv[iarg],"--small")==0) smalltest=true;
     std::cout << "small test : " << smalltest << std::endl;
+
+    test_wsdeque(3, smalltest ? 100000 : 10000000);
     if (smalltest) return 0;
 
     madness::initialize(argc, argv);
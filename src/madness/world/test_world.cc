@@ -80,6 +80,24 @@ void test0(World& world) {
     if (world.rank() == 0) print("test0 (serialization to/from buf) seems to be working");
 }
 
+void test_am_arg_pool(World& world) {
+    // A freed message buffer is reused for the next one of similar size
+    AmArg* a = alloc_am_arg(200);
+    free_am_arg(a);
+    const std::uint64_t nreuse = detail::AmArgPool::get_nreuse();
+    AmArg* b = alloc_am_arg(150);
+    MADNESS_CHECK(b == a);
+    MADNESS_CHECK(detail::AmArgPool::get_nreuse() == nreuse+1);
+
+    // Buffers beyond the largest class are not kept
+    AmArg* c = alloc_am_arg(1<<20);
+    c->buf()[(1<<20)-1] = 1;
+    free_am_arg(c);
+    free_am_arg(b);
+
+    if (world.rank() == 0) print("test_am_arg_pool OK");
+}
+
 class B {
     long b;
 public:
@@ -1228,6 +1246,335 @@ void test15(World& world) {
   world.gop.fence();
 }
 
+std::atomic<int> am_agg_count{0};
+std::atomic<bool> am_agg_ordered{true};
+
+void am_agg_handler(const AmArg& arg) {
+    int i;
+    std::vector<double> pad;
+    arg & i & pad;
+    if (i != am_agg_count) am_agg_ordered = false;
+    ++am_agg_count;
+}
+
+void test_am_aggregation(World& world) {
+  if (world.size() > 1) {
+    // Aggregation is configured when a world is made
+    setenv("MAD_AM_AGGREGATE", "4KB", 1);
+    {
+        SafeMPI::Intracomm comm = world.mpi.comm().Split(0, world.rank());
+        World aggworld(comm);
+        unsetenv("MAD_AM_AGGREGATE");
+
+        const std::uint64_t nagg = WorldAmInterface::get_nmsg_aggregated();
+        const int n = 1000;
+        const ProcessID dest = (aggworld.rank()+1)%aggworld.size();
+        for (int i=0; i<n; ++i) {
+            std::vector<double> pad(i%100 == 99 ? 1000 : 1); // Some too big to aggregate
+            aggworld.am.send(dest, am_agg_handler, new_am_arg(i, pad));
+        }
+        aggworld.gop.fence();
+
+        MADNESS_CHECK(am_agg_count == n);
+        MADNESS_CHECK(am_agg_ordered);
+        MADNESS_CHECK(WorldAmInterface::get_nmsg_aggregated() - nagg == std::uint64_t(n - n/100));
+    }
+    print("test_am_aggregation OK");
+  }
+  world.gop.fence();
+}
+
+// Array serialized with store_external, as the data of a Tensor is
+struct zerocopy_block {
+    std::shared_ptr<std::vector<double>> v;
+};
+
+namespace madness {
+    namespace archive {
+        template <class Archive>
+        struct ArchiveStoreImpl<Archive, zerocopy_block> {
+            static void store(const Archive& ar, const zerocopy_block& b) {
+                ar & long(b.v->size());
+                store_external(ar, b.v->data(), b.v->size(), b.v);
+            }
+        };
+
+        template <class Archive>
+        struct ArchiveLoadImpl<Archive, zerocopy_block> {
+            static void load(const Archive& ar, zerocopy_block& b) {
+                long n = 0;
+                ar & n;
+                b.v = std::make_shared<std::vector<double>>(n);
+                ar & wrap(b.v->data(), n);
+            }
+        };
+    }
+}
+
+std::atomic<int> am_zerocopy_count{0};
+
+void am_zerocopy_handler(const AmArg& arg) {
+    int i;
+    zerocopy_block b;
+    long n;
+    arg & i & b & n;
+    bool ok = (long(b.v->size()) == n);
+    for (long k=0; ok && k<n; ++k) ok = ((*b.v)[k] == double(i+k));
+    if (ok) ++am_zerocopy_count;
+}
+
+void test_am_zerocopy(World& world) {
+    // Leaving an array in place must not change the stream
+    zerocopy_block b{std::make_shared<std::vector<double>>(4096)};
+    std::iota(b.v->begin(), b.v->end(), 0.0);
+
+    archive::BufferOutputArchive count;
+    count & 1 & b & 2;
+    std::vector<unsigned char> plain(count.size());
+    archive::BufferOutputArchive(plain.data(), plain.size()) & 1 & b & 2;
+
+    archive::BufferOutputArchive xcount(1024);
+    xcount & 1 & b & 2;
+    MADNESS_CHECK(xcount.size() == count.size());
+    MADNESS_CHECK(xcount.nbyte_external() == 4096*sizeof(double));
+
+    std::vector<unsigned char> buf(xcount.size() - xcount.nbyte_external());
+    std::vector<archive::BufferOutputArchive::External> external;
+    archive::BufferOutputArchive(buf.data(), buf.size(), &external, 1024) & 1 & b & 2;
+    MADNESS_CHECK(external.size() == 1);
+    MADNESS_CHECK(external[0].ptr == b.v->data());
+    MADNESS_CHECK(b.v.use_count() == 2); // The record keeps the data alive
+
+    const unsigned char* p = static_cast<const unsigned char*>(external[0].ptr);
+    std::vector<unsigned char> joined(buf.begin(), buf.begin() + external[0].offset);
+    joined.insert(joined.end(), p, p + external[0].nbyte);
+    joined.insert(joined.end(), buf.begin() + external[0].offset, buf.end());
+    MADNESS_CHECK(joined == plain);
+
+    if (world.size() > 1 && RMI::zerocopy_min() > 0) {
+        // Sizes on both sides of the threshold, the last one huge
+        const int n = 20;
+        const ProcessID dest = (world.rank()+1)%world.size();
+        for (int i=0; i<n; ++i) {
+            const long sz = (i == n-1) ? long(RMI::max_msg_len()/sizeof(double) + 1000) : 1000l*(i+1);
+            zerocopy_block blk{std::make_shared<std::vector<double>>(sz)};
+            std::iota(blk.v->begin(), blk.v->end(), double(i));
+            world.am.send(dest, am_zerocopy_handler, new_am_arg(i, blk, sz));
+        } // Only the messages now hold the data
+        world.gop.fence();
+        MADNESS_CHECK(am_zerocopy_count == n);
+    }
+    print("test_am_zerocopy OK");
+    world.gop.fence();
+}
+
+std::atomic<int> fence_async_count{0};
+
+void fence_async_handler(const AmArg& arg) {
+    ++fence_async_count;
+}
+
+void fence_async_task() {
+    ++fence_async_count;
+}
+
+void test_fence_async(World& world) {
+    const int n = 1000;
+    const ProcessID dest = (world.rank()+1)%world.size();
+    for (int pass=0; pass<2; ++pass) {
+        for (int i=0; i<n; ++i) {
+            world.taskq.add(fence_async_task);
+            if (world.size() > 1) world.am.send(dest, fence_async_handler, new_am_arg(i));
+        }
+        Future<bool> first = world.gop.fence_async();
+        Future<bool> second = world.gop.fence_async(); // May be outstanding together
+        MADNESS_CHECK(first.get() && second.get());
+        MADNESS_CHECK(fence_async_count == (world.size() > 1 ? 2*n : n));
+        fence_async_count = 0;
+        world.gop.fence(); // Others must check and reset before the next pass
+    }
+    print("test_fence_async OK");
+}
+
+void test_node_tree(World& world) {
+    // Uneven nodes: {0,1,2} {3} {4,5,6,7} {8,9}
+    const std::vector<std::vector<int>> node_ranks = {{0,1,2}, {3}, {4,5,6,7}, {8,9}};
+    const int np = 10;
+    std::vector<int> node_of(np);
+    for (std::size_t n=0; n<node_ranks.size(); ++n)
+        for (int p : node_ranks[n]) node_of[p] = n;
+
+    for (ProcessID root=0; root<np; ++root) {
+        std::vector<ProcessID> parent(np);
+        std::vector<std::vector<ProcessID>> child(np);
+        for (ProcessID p=0; p<np; ++p)
+            WorldMpiInterface::node_tree_info(node_of, node_ranks, p, root, parent[p], child[p]);
+
+        // Each child names its parent, and only root has none
+        int nedge = 0, ninter = 0;
+        for (ProcessID p=0; p<np; ++p) {
+            MADNESS_CHECK((parent[p] == -1) == (p == root));
+            for (ProcessID c : child[p]) {
+                MADNESS_CHECK(parent[c] == p);
+                ++nedge;
+                if (node_of[c] != node_of[p]) ++ninter;
+            }
+        }
+        MADNESS_CHECK(nedge == np-1); // So the tree spans all processes
+        MADNESS_CHECK(ninter == int(node_ranks.size())-1); // One message into each other node
+    }
+
+    // The collectives still agree with whatever tree this world uses
+    double x = world.rank()+1;
+    world.gop.sum(x);
+    MADNESS_CHECK(x == 0.5*world.size()*(world.size()+1));
+
+    if (world.rank() == 0) print("test_node_tree OK, using", world.mpi.nnode(), "node(s)");
+}
+
+std::vector<int> rmi_shm_next; // Next message expected from each process
+std::atomic<int> rmi_shm_bad{0};
+
+void rmi_shm_handler(const AmArg& arg) {
+    int i;
+    std::vector<char> pad;
+    arg & i & pad;
+    int& next = rmi_shm_next[arg.get_src()];
+    const std::size_t sz = (i%5 == 4) ? 48*1024 : i%64;
+    if (i != next || pad.size() != sz || std::count(pad.begin(), pad.end(), char(i)) != long(sz)) ++rmi_shm_bad;
+    ++next;
+}
+
+void test_rmi_shm(World& world) {
+    // With MAD_RMI_SHM set, messages to processes on the same node go
+    // through shared memory unless they are too big for a ring (or the
+    // ring is full).  Order must be kept across both paths.
+    rmi_shm_next.assign(world.size(), 0);
+    world.gop.fence();
+    const std::uint64_t nshm = RMI::get_stats().nmsg_shm_sent;
+
+    const int n = 500;
+    for (int i=0; i<n; ++i) {
+        std::vector<char> pad((i%5 == 4) ? 48*1024 : i%64, char(i));
+        for (ProcessID p=0; p<world.size(); ++p)
+            if (p != world.rank()) world.am.send(p, rmi_shm_handler, new_am_arg(i, pad));
+    }
+    world.gop.fence();
+
+    MADNESS_CHECK(rmi_shm_bad == 0);
+    for (ProcessID p=0; p<world.size(); ++p)
+        MADNESS_CHECK(rmi_shm_next[p] == (p == world.rank() ? 0 : n));
+    if (RMI::shm_size() == 0) MADNESS_CHECK(RMI::get_stats().nmsg_shm_sent == nshm);
+
+    double nshm_sent = RMI::get_stats().nmsg_shm_sent - nshm;
+    world.gop.sum(nshm_sent);
+    // Processes sharing a node must have used the rings
+    if (RMI::shm_size() > 0) MADNESS_CHECK(nshm_sent > 0);
+    if (world.rank() == 0) print("test_rmi_shm OK,", nshm_sent, "messages through shared memory");
+}
+
+std::atomic<int> fence_relay_count{0};
+
+// Passes itself on to the next process until hops runs out, so processes
+// become busy again after they have already taken part in termination detection
+void fence_relay_handler(const AmArg& arg) {
+    int hops;
+    arg & hops;
+    myusleep(1000);
+    ++fence_relay_count;
+    if (hops > 0) {
+        World& world = *arg.get_world();
+        world.am.send((world.rank()+1)%world.size(), fence_relay_handler, new_am_arg(hops-1));
+    }
+}
+
+void test_fence_mode(World& world) {
+    // Both ways of detecting termination must see the same work done
+    const WorldGopInterface::FenceMode mode0 = world.gop.fence_mode();
+    for (auto mode : {WorldGopInterface::FenceMode::tree, WorldGopInterface::FenceMode::wave}) {
+        world.gop.set_fence_mode(mode);
+        world.gop.reset_fence_stats();
+
+        const int n = 1000;
+        const ProcessID dest = (world.rank()+1)%world.size();
+        for (int i=0; i<n; ++i) {
+            world.taskq.add(fence_async_task);
+            if (world.size() > 1) world.am.send(dest, fence_async_handler, new_am_arg(i));
+        }
+        world.gop.fence();
+        MADNESS_CHECK(fence_async_count == (world.size() > 1 ? 2*n : n));
+        fence_async_count = 0;
+
+        if (world.size() > 1) {
+            const int nhop = 10*world.size();
+            if (world.rank() == 0) world.am.send(1, fence_relay_handler, new_am_arg(nhop));
+            world.gop.fence();
+            int nrelay = fence_relay_count;
+            fence_relay_count = 0;
+            world.gop.sum(nrelay);
+            MADNESS_CHECK(nrelay == nhop + 1);
+        }
+        else {
+            world.gop.fence();
+        }
+
+        // Detecting termination must not send active messages
+        const std::uint64_t nmsg = RMI::get_stats().nmsg_sent;
+        const int nempty = 100;
+        for (int i=0; i<nempty; ++i) world.gop.fence();
+        MADNESS_CHECK(RMI::get_stats().nmsg_sent == nmsg);
+
+        // The tree needs two agreeing passes, an idle world one wave
+        const FenceStats stats = world.gop.get_fence_stats();
+        MADNESS_CHECK(stats.nfence == std::uint64_t(nempty + 2));
+        if (mode == WorldGopInterface::FenceMode::tree) MADNESS_CHECK(stats.npass >= 2*stats.nfence);
+        else MADNESS_CHECK(stats.npass >= stats.nfence);
+        if (world.rank() == 0)
+            print("test_fence_mode", (mode == WorldGopInterface::FenceMode::wave ? "wave" : "tree"),
+                  "OK, average fence", stats.wall/stats.nfence, "s and", double(stats.npass)/stats.nfence, "passes");
+    }
+    world.gop.set_fence_mode(mode0);
+}
+
+std::atomic<int> numa_ran{0};
+std::atomic<int> numa_ran_home{0};
+
+void numa_task(int domain) {
+    myusleep(100); // Long enough for the pool threads to take part even on one core
+    ++numa_ran;
+    if (ThreadBinder::this_domain() == domain) ++numa_ran_home;
+}
+
+void test_numa_placement(World& world) {
+    // The domain must survive the flag word, next to the other attributes
+    for (int d=-1; d<255; ++d) {
+        TaskAttributes attr = TaskAttributes::hipri();
+        attr.set_numa_domain(d);
+        attr.set_nthread(3);
+        MADNESS_CHECK(attr.get_numa_domain() == d);
+        MADNESS_CHECK(attr.is_high_priority() && attr.get_nthread() == 3 && !attr.is_stealable());
+        attr.set_numa_domain(-1);
+        MADNESS_CHECK(attr.get_numa_domain() == -1 && attr.is_high_priority());
+    }
+
+    // With several domains (e.g. emulated with MAD_NUMA=2) tasks placed in
+    // a domain go through its inbox and should mostly run on its threads
+    const bool numa = ThreadPool::numa_domain(0) >= 0;
+    const int n = 1000;
+    numa_ran = numa_ran_home = 0;
+    for (int i=0; i<n; ++i) {
+        const int d = ThreadPool::numa_domain(i);
+        world.taskq.add(numa_task, d, TaskAttributes().set_numa_domain(d));
+    }
+    world.taskq.fence();
+    MADNESS_CHECK(numa_ran == n);
+    if (numa) MADNESS_CHECK(numa_ran_home > 0);
+    if (world.rank() == 0) {
+        if (numa) print("test_numa_placement OK,", numa_ran_home.load(), "of", n, "tasks ran in their domain");
+        else print("test_numa_placement OK, single domain");
+    }
+}
+
 inline bool is_odd(int i) {
     return i & 0x1;
 }
@@ -1387,6 +1734,7 @@ int main(int argc, char** argv) {
         PROFILE_BLOCK(main_program);
 
         test0(world);
+        test_am_arg_pool(world);
         test5(world);
         test6(world);
         test6a(world);
@@ -1399,6 +1747,13 @@ int main(int argc, char** argv) {
         test13(world);
         test14(world);
         test15(world);
+        test_am_aggregation(world);
+        test_am_zerocopy(world);
+        test_fence_async(world);
+        test_node_tree(world);
+        test_rmi_shm(world);
+        test_fence_mode(world);
+        test_numa_placement(world);
 
         for (int i=0; i<10; ++i) {
           print("REPETITION",i);
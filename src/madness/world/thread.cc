@@ -43,8 +43,10 @@
 #include <madness/world/worldpapi.h>
 #include <madness/world/safempi.h>
 #include <madness/world/atomicint.h>
+#include <algorithm>
 #include <cstring>
 #include <fstream>
+#include <string>
 
 #if defined(HAVE_IBMBGQ) and defined(HPM)
 extern "C" unsigned int HPM_Prof_init_thread(void);
@@ -70,6 +72,7 @@ extern "C" void HPM_Prof_stop(unsigned int);
 namespace madness {
     ThreadBinder binder;
     thread_local bool ThreadBinder::bound = false;
+    thread_local int ThreadBinder::domain = -1;
     pthread_key_t ThreadBase::thread_key;
 
     ThreadPool* ThreadPool::instance_ptr = 0;
@@ -89,6 +92,48 @@ namespace madness {
     int ThreadBase::hpm_thread_id;
 #endif
 
+    void ThreadBinder::read_numa_topology() {
+        ndomain = 1;
+        for (size_t i=0; i<ncpu; i++) cpu_domain[i] = 0;
+#ifndef ON_A_MAC
+        const char* snuma = getenv("MAD_NUMA");
+        if (snuma && (std::string(snuma)=="OFF" || std::string(snuma)=="0")) return;
+
+        // MAD_NUMA=<n> with n>1 deals the cpus round-robin into n emulated
+        // domains, so that NUMA placement can be tested on any machine
+        const int nemulate = snuma ? atoi(snuma) : 0;
+        if (nemulate > 1) {
+            ndomain = std::min(nemulate, 255);
+            for (size_t i=0; i<ncpu; i++) cpu_domain[i] = i % ndomain;
+            return;
+        }
+
+        // node directories may be numbered sparsely; renumber those holding our cpus
+        int nfound = 0;
+        for (int node=0; node<256; node++) {
+            std::ifstream f("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            if (!f) continue;
+            bool used = false;
+            std::string range;
+            while (std::getline(f, range, ',')) {
+                size_t lo, hi;
+                const int n = sscanf(range.c_str(), "%zu-%zu", &lo, &hi);
+                if (n < 1) continue;
+                if (n == 1) hi = lo;
+                for (size_t i=0; i<ncpu; i++) {
+                    if (cpus[i] >= lo && cpus[i] <= hi) {
+                        cpu_domain[i] = nfound;
+                        used = true;
+                    }
+                }
+            }
+            if (used) nfound++;
+        }
+        if (nfound > 1) ndomain = nfound;
+        else for (size_t i=0; i<ncpu; i++) cpu_domain[i] = 0;
+#endif
+    }
+
     void* ThreadBase::main(void* self) {
 #ifdef HAVE_PAPI
         begin_papi_measurement();
@@ -269,8 +314,14 @@ namespace madness {
     ThreadPool::ThreadPool(int nthread)
     : threads(nullptr)
     , main_thread()
+    , deques(nullptr)
+    , inboxes(nullptr)
+    , ndomain(0)
+    , deque_domain(nullptr)
     , nthreads(nthread)
     , finish(false)
+    , wait_policy(WaitPolicy::Busy)
+    , wait_usleep(0)
     {
         nfinished = 0;
         instance_ptr = this;
@@ -313,6 +364,26 @@ namespace madness {
             MADNESS_EXCEPTION("memory allocation failed", 0);
         }
 
+        // Pool threads keep the tasks they spawn in their own deque unless
+        // MAD_WORK_STEALING=0
+        const char* mad_work_stealing = getenv("MAD_WORK_STEALING");
+        if (nthreads > 0 && !(mad_work_stealing && strcmp(mad_work_stealing, "0") == 0))
+            deques = new WorkStealingDeque<PoolTaskInterface*>[nthreads];
+
+        // With several NUMA domains, pool threads not bound to a cpu are
+        // confined round-robin to a domain and tasks may be placed by domain
+        if (deques && binder.get_ndomain() > 1) {
+            ndomain = binder.get_do_bind() ? binder.get_ndomain() : std::min(binder.get_ndomain(), nthreads);
+            if (ndomain > 1) {
+                inboxes = new NumaInbox[ndomain];
+                deque_domain = new std::atomic<int>[nthreads];
+                for (int i=0; i<nthreads; ++i) deque_domain[i] = -1;
+            }
+            else {
+                ndomain = 0;
+            }
+        }
+
         for (int i=0; i<nthreads; ++i) {
             threads[i].set_pool_thread_index(i);
             threads[i].start(pool_thread_main, (void *)(threads+i));
@@ -351,6 +422,13 @@ namespace madness {
 	binder.bind();
 
 #if !HAVE_PARSEC
+        if (deques) local_deque = deques + thread->get_pool_thread_index();
+        if (inboxes) {
+            binder.bind_domain(thread->get_pool_thread_index() % ndomain);
+            local_domain = ThreadBinder::this_domain();
+            if (local_domain >= ndomain) local_domain = -1;
+            deque_domain[thread->get_pool_thread_index()] = local_domain;
+        }
 #define MULTITASK
 #ifdef  MULTITASK
         while (!finish) {
@@ -463,8 +541,16 @@ namespace madness {
     }
 
     // Returns queue statistics
-    const DQStats& ThreadPool::get_stats() {
-        return instance()->queue.get_stats();
+    DQStats ThreadPool::get_stats() {
+        ThreadPool* pool = instance();
+        DQStats stats = pool->queue.get_stats();
+        if (pool->deques) {
+            for (int i=0; i<pool->nthreads; ++i) {
+                stats.npush_local += pool->deques[i].get_npush();
+                stats.nsteal += pool->deques[i].get_nsteal();
+            }
+        }
+        return stats;
     }
 
 } // namespace madness
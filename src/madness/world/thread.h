@@ -40,10 +40,15 @@
 
 #include <madness/world/thread_info.h>
 #include <madness/world/dqueue.h>
+#include <madness/world/wsdeque.h>
 #include <madness/world/function_traits.h>
 #include <vector>
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
 #include <cstdio>
+#include <deque>
+#include <thread>
 #include <pthread.h>
 
 #include <functional>
@@ -106,8 +111,17 @@ namespace madness {
       size_t ncpu = 0;
       bool do_bind = true;
       size_t cpus[maxncpu];
+      int cpu_domain[maxncpu] = {0}; ///< NUMA domain of each entry of \c cpus
+      int ndomain = 1;               ///< Number of NUMA domains holding any of \c cpus
       std::atomic<size_t> nextcpu = 0;
       static thread_local bool bound;
+      static thread_local int domain;
+
+      /// Reads the NUMA domain of each cpu from sysfs (one domain if unavailable)
+
+      /// \c MAD_NUMA=OFF (or 0) disables NUMA placement, \c MAD_NUMA=<n>
+      /// emulates \c n domains.
+      void read_numa_topology();
       
     public:
       
@@ -130,6 +144,7 @@ namespace madness {
 	  std::cout << std::endl;
 	}
 	nextcpu = ncpu/2;
+	read_numa_topology();
 #endif
           if (this->print) { };
       }
@@ -139,6 +154,14 @@ namespace madness {
       const size_t* get_cpus() const { return cpus; }
       
       const size_t get_ncpu() const { return ncpu; }
+
+      bool get_do_bind() const { return do_bind; }
+
+      /// Number of NUMA domains available to this process
+      int get_ndomain() const { return ndomain; }
+
+      /// NUMA domain the calling thread is confined to, or -1 if none
+      static int this_domain() { return domain; }
       
       void bind() {
 #ifndef ON_A_MAC
@@ -146,11 +169,30 @@ namespace madness {
 	  bound = true;
 	  cpu_set_t mask;
 	  CPU_ZERO(&mask);
-	  size_t cpu = cpus[nextcpu++ % ncpu];
+	  size_t i = nextcpu++ % ncpu;
+	  size_t cpu = cpus[i];
 	  CPU_SET(cpu, &mask);
 	  sched_setaffinity(0, sizeof(mask), &mask);
+	  domain = cpu_domain[i];
 	  if (print) std::cout << "bound thread to " << cpu << std::endl;
 	}
+#endif
+      }
+
+      /// Confines the calling thread to the cpus of NUMA domain \c d, unless already bound to a cpu
+      void bind_domain(int d) {
+#ifndef ON_A_MAC
+	if (!bound && d >= 0 && d < ndomain) {
+	  bound = true;
+	  cpu_set_t mask;
+	  CPU_ZERO(&mask);
+	  for (size_t i=0; i<ncpu; i++) {
+	    if (cpu_domain[i] == d) CPU_SET(int(cpus[i]), &mask);
+	  }
+	  sched_setaffinity(0, sizeof(mask), &mask);
+	  domain = d;
+	  if (print) std::cout << "bound thread to domain " << d << std::endl;
+	}
 #endif
       }
     };
@@ -326,6 +368,8 @@ namespace madness {
     /// - \c nthread : indicates number of threads. 0 threads is interpreted
     ///   as 1 thread for backward compatibility and ease of specifying
     ///   defaults. The default value is 0 (==1).
+    /// - \c numa_domain : NUMA domain whose threads should preferably run
+    ///   the task. The default value is -1 (any).
     class TaskAttributes {
         unsigned long flags; ///< Byte-string storing the specified attributes.
 
@@ -334,6 +378,7 @@ namespace madness {
         static const unsigned long GENERATOR = 1ul<<8; ///< Mask for generator bit.
         static const unsigned long STEALABLE = GENERATOR<<1; ///< Mask for stealable bit.
         static const unsigned long HIGHPRIORITY = GENERATOR<<2; ///< Mask for priority bit.
+        static const unsigned long NUMADOMAIN = 0xfful<<12; ///< Mask for NUMA domain byte (domain+1, 0 if none).
 
         /// Sets the attributes to the desired values.
 
@@ -432,6 +477,22 @@ namespace madness {
         	return n;
         }
 
+        /// Sets the preferred NUMA domain.
+
+        /// \param[in] domain The domain, or -1 for none.
+        TaskAttributes& set_numa_domain(int domain) {
+            MADNESS_ASSERT(domain>=-1 && domain<255);
+            flags = (flags & (~NUMADOMAIN)) | ((unsigned long)(domain+1) << 12);
+            return *this;
+        }
+
+        /// Get the preferred NUMA domain.
+
+        /// \return The domain, or -1 for none.
+        int get_numa_domain() const {
+            return int((flags & NUMADOMAIN) >> 12) - 1;
+        }
+
         /// Serializes the attributes for I/O.
 
         /// tparam Archive The archive type.
@@ -1183,9 +1244,26 @@ namespace madness {
         ThreadPoolThread *threads; ///< Array of threads.
         ThreadPoolThread main_thread; ///< Placeholder for main thread tls.
         DQueue<PoolTaskInterface*> queue; ///< Queue of tasks.
+        WorkStealingDeque<PoolTaskInterface*>* deques; ///< Per-thread deques if work stealing, else null.
+
+        /// Tasks waiting for a thread of a given NUMA domain
+        struct NumaInbox : public Spinlock {
+            std::deque<PoolTaskInterface*> tasks;
+            std::atomic<std::size_t> n{0}; ///< Size of \c tasks, readable without the lock
+        };
+        NumaInbox* inboxes; ///< One per NUMA domain if NUMA placement, else null.
+        int ndomain; ///< Number of entries in \c inboxes.
+        std::atomic<int>* deque_domain; ///< NUMA domain of the owner of each deque.
         int nthreads; ///< Number of threads.
         volatile bool finish; ///< Set to true when time to stop.
         AtomicInt nfinished; ///< Thread pool exit counter.
+        WaitPolicy wait_policy; ///< How idle threads wait when work stealing.
+        int wait_usleep; ///< Sleep duration for \c WaitPolicy::Sleep.
+
+        // Thread local data
+        inline static thread_local WorkStealingDeque<PoolTaskInterface*>* local_deque = nullptr; ///< Deque owned by this pool thread.
+        inline static thread_local unsigned int steal_seed = 0; ///< Victim selection state.
+        inline static thread_local int local_domain = -1; ///< NUMA domain of this pool thread.
 
         // Static data
         static ThreadPool* instance_ptr; ///< Singleton pointer.
@@ -1201,6 +1279,86 @@ namespace madness {
         /// \param[in] nthread Description needed.
         ThreadPool(int nthread=-1);
 
+        /// Take a task from a randomly chosen pool thread's deque.
+
+        /// With NUMA placement, threads of the own domain are tried first.
+        /// \param[out] task The stolen task.
+        /// \return True if a task was stolen.
+        bool steal(PoolTaskInterface*& task) {
+            if (!steal_seed) steal_seed = 2654435761u*(unsigned(reinterpret_cast<std::uintptr_t>(&steal_seed)) | 1u);
+            steal_seed ^= steal_seed << 13;
+            steal_seed ^= steal_seed >> 17;
+            steal_seed ^= steal_seed << 5;
+            const int first = steal_seed % nthreads;
+            const int npass = (inboxes && local_domain >= 0) ? 2 : 1;
+            for (int pass=0; pass<npass; ++pass) {
+                for (int i=0; i<nthreads; ++i) {
+                    const int v = (first+i) % nthreads;
+                    if (npass == 2 && ((deque_domain[v].load(std::memory_order_relaxed) == local_domain) != (pass == 0))) continue;
+                    WorkStealingDeque<PoolTaskInterface*>& victim = deques[v];
+                    if (&victim != local_deque && victim.steal(task)) return true;
+                }
+            }
+            return false;
+        }
+
+        /// Take up to \c nmax tasks from the inbox of NUMA domain \c d.
+
+        /// \return The number of tasks put in \c taskbuf.
+        int pop_inbox(int d, int nmax, PoolTaskInterface** taskbuf) {
+            NumaInbox& inbox = inboxes[d];
+            if (inbox.n.load(std::memory_order_relaxed) == 0) return 0;
+            ScopedMutex<Spinlock> obolus(inbox);
+            int ntask = 0;
+            while (ntask < nmax && !inbox.tasks.empty()) {
+                taskbuf[ntask++] = inbox.tasks.front();
+                inbox.tasks.pop_front();
+            }
+            inbox.n.store(inbox.tasks.size(), std::memory_order_relaxed);
+            return ntask;
+        }
+
+        /// Find tasks when work stealing.
+
+        /// The shared queue comes first since it holds high-priority and
+        /// multi-threaded tasks and those submitted from outside the pool,
+        /// then tasks placed in this thread's NUMA domain, then this
+        /// thread's own deque (newest first), then other threads' deques
+        /// (oldest first), and finally tasks placed in other domains.
+        /// \param[in] nmax Size of \c taskbuf.
+        /// \param[out] taskbuf The tasks to run.
+        /// \param[in] wait Keep looking until a task is found or the pool finishes.
+        /// \return The number of tasks put in \c taskbuf.
+        int next_tasks(int nmax, PoolTaskInterface** taskbuf, bool wait) {
+            MutexWaiter waiter;
+            while (true) {
+                queue.lock_and_flush_prebuf();
+                if (queue.size()) {
+                    const int ntask = queue.pop_front(nmax, taskbuf, false);
+                    if (ntask) return ntask;
+                }
+                if (inboxes && local_domain >= 0) {
+                    const int ntask = pop_inbox(local_domain, 16, taskbuf);
+                    if (ntask) return ntask;
+                }
+                if (local_deque && local_deque->pop(taskbuf[0])) return 1;
+                if (steal(taskbuf[0])) return 1;
+                if (inboxes) {
+                    for (int d=0; d<ndomain; ++d) {
+                        const int ntask = pop_inbox(d, 1, taskbuf);
+                        if (ntask) return ntask;
+                    }
+                }
+                if (!wait || finish) return 0;
+
+                switch (wait_policy) {
+                case WaitPolicy::Yield: std::this_thread::yield(); break;
+                case WaitPolicy::Sleep: std::this_thread::sleep_for(std::chrono::microseconds(wait_usleep)); break;
+                default: waiter.wait();
+                }
+            }
+        }
+
        /// Run the next task.
 
         /// \todo Verify and complete this documentation.
@@ -1212,6 +1370,7 @@ namespace madness {
             MADNESS_EXCEPTION("run_task should not be called when using Intel TBB", 1);
 #else
 
+            if (deques) return run_tasks(wait, this_thread);
             if (!wait && queue.empty()) return false;
             std::pair<PoolTaskInterface*,bool> t = queue.pop_front(wait);
 #ifdef MADNESS_TASK_PROFILING
@@ -1252,7 +1411,7 @@ namespace madness {
 #else
 
             PoolTaskInterface* taskbuf[nmax];
-            int ntask = queue.pop_front(nmax, taskbuf, wait);
+            int ntask = deques ? next_tasks(nmax, taskbuf, wait) : queue.pop_front(nmax, taskbuf, wait);
 #ifdef MADNESS_TASK_PROFILING
             profiling::TaskEventList* event_list =
                     this_thread->profiler().new_list(ntask);
@@ -1365,6 +1524,16 @@ namespace madness {
             if (task->is_high_priority() && (task_threads == 1)) {
                 instance()->queue.push_front(task);
             }
+            else if (instance()->inboxes && (task_threads == 1) && task->get_numa_domain() >= 0 &&
+                     (task->get_numa_domain() % instance()->ndomain) != local_domain) {
+                NumaInbox& inbox = instance()->inboxes[task->get_numa_domain() % instance()->ndomain];
+                ScopedMutex<Spinlock> obolus(inbox);
+                inbox.tasks.push_back(task);
+                inbox.n.store(inbox.tasks.size(), std::memory_order_relaxed);
+            }
+            else if (local_deque && (task_threads == 1)) {
+                local_deque->push(task);
+            }
             else {
                 instance()->queue.push_back(task, task_threads);
             }
@@ -1373,7 +1542,7 @@ namespace madness {
 
         /// \todo Brief description needed.
 
-        /// \todo Descriptions needed.
+        /// Only the shared queue is scanned, not the per-thread deques.
         /// \tparam opT Description needed.
         /// \param[in,out] op Description needed.
         template <typename opT>
@@ -1424,13 +1593,29 @@ namespace madness {
 
         /// \return The number of tasks in the queue.
         static std::size_t queue_size() {
-            return instance()->queue.size();
+            std::size_t n = instance()->queue.size();
+            if (instance()->deques) {
+                for (int i=0; i<instance()->nthreads; ++i)
+                    n += instance()->deques[i].size();
+            }
+            for (int d=0; d<instance()->ndomain; ++d)
+                n += instance()->inboxes[d].n.load(std::memory_order_relaxed);
+            return n;
+        }
+
+        /// NUMA domain in which to run tasks for data with hash \c hash.
+
+        /// \return A domain for \c TaskAttributes::set_numa_domain(), or -1
+        /// if NUMA placement is not in use.
+        static int numa_domain(std::size_t hash) {
+            const int n = instance()->ndomain;
+            return n > 1 ? int(hash % n) : -1;
         }
 
-        /// Returns queue statistics.
+        /// Returns queue statistics, including those of the per-thread deques.
 
-        /// \return Queue statistics.
-        static const DQStats& get_stats();
+        /// \return A snapshot of the queue statistics.
+        static DQStats get_stats();
 
         /// Access the pool thread array
         /// \return ptr to the pool thread array, its size is given by \c size()
@@ -1513,6 +1698,9 @@ namespace madness {
 #elif HAVE_INTEL_TBB
 #else
             delete[] threads;
+            delete[] deques;
+            delete[] inboxes;
+            delete[] deque_domain;
 #endif
         }
 
@@ -1523,6 +1711,8 @@ namespace madness {
 #if !HAVE_INTEL_TBB && !HAVE_PARSEC
           instance()->queue.set_wait_policy(policy,
                                             sleep_duration_in_microseconds);
+          instance()->wait_policy = policy;
+          instance()->wait_usleep = sleep_duration_in_microseconds;
 #endif
         }
 
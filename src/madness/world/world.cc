@@ -276,66 +276,91 @@ namespace madness {
         double nbyte_sent = rmi.nbyte_sent;
         double nbyte_recv = rmi.nbyte_recv;
         double server_q = rmi.max_serv_send_q;
+        double nmsg_agg = WorldAmInterface::get_nmsg_aggregated();
+        double nmsg_shm = rmi.nmsg_shm_sent;
+        const FenceStats fence_stats = world.gop.get_fence_stats();
+        double nfence = fence_stats.nfence;
+        double nfence_pass = fence_stats.npass;
+        double fence_wall = fence_stats.wall;
+        double max_fence_wall = fence_stats.wall_max;
         world.gop.sum(nmsg_sent);
         world.gop.sum(nmsg_recv);
         world.gop.sum(nbyte_sent);
         world.gop.sum(nbyte_recv);
         world.gop.sum(server_q);
+        world.gop.sum(nmsg_agg);
+        world.gop.sum(nmsg_shm);
+        world.gop.sum(fence_wall);
+        world.gop.max(max_fence_wall);
 
         double max_nmsg_sent = rmi.nmsg_sent;
         double max_nmsg_recv = rmi.nmsg_recv;
         double max_nbyte_sent = rmi.nbyte_sent;
         double max_nbyte_recv = rmi.nbyte_recv;
         double max_server_q = rmi.max_serv_send_q;
+        double max_nmsg_agg = WorldAmInterface::get_nmsg_aggregated();
+        double max_nmsg_shm = rmi.nmsg_shm_sent;
         world.gop.max(max_nmsg_sent);
         world.gop.max(max_nmsg_recv);
         world.gop.max(max_nbyte_sent);
         world.gop.max(max_nbyte_recv);
         world.gop.max(max_server_q);
+        world.gop.max(max_nmsg_agg);
+        world.gop.max(max_nmsg_shm);
 
         double min_nmsg_sent = rmi.nmsg_sent;
         double min_nmsg_recv = rmi.nmsg_recv;
         double min_nbyte_sent = rmi.nbyte_sent;
         double min_nbyte_recv = rmi.nbyte_recv;
         double min_server_q = rmi.max_serv_send_q;
+        double min_nmsg_agg = WorldAmInterface::get_nmsg_aggregated();
+        double min_nmsg_shm = rmi.nmsg_shm_sent;
         world.gop.min(min_nmsg_sent);
         world.gop.min(min_nmsg_recv);
         world.gop.min(min_nbyte_sent);
         world.gop.min(min_nbyte_recv);
         world.gop.min(min_server_q);
+        world.gop.min(min_nmsg_agg);
+        world.gop.min(min_nmsg_shm);
 
         double npush_back = q.npush_back;
         double npush_front = q.npush_front;
         double npop_front = q.npop_front;
-        double ntask = q.npush_back + q.npush_front;
+        double ntask = q.npush_back + q.npush_front + q.npush_local;
         double nmax = q.nmax;
+        double nsteal = q.nsteal;
         world.gop.sum(npush_back);
         world.gop.sum(npush_front);
         world.gop.sum(npop_front);
         world.gop.sum(ntask);
         world.gop.sum(nmax);
+        world.gop.sum(nsteal);
 
         double max_npush_back = q.npush_back;
         double max_npush_front = q.npush_front;
         double max_npop_front = q.npop_front;
-        double max_ntask = q.npush_back + q.npush_front;
+        double max_ntask = q.npush_back + q.npush_front + q.npush_local;
         double max_nmax = q.nmax;
+        double max_nsteal = q.nsteal;
         world.gop.max(max_npush_back);
         world.gop.max(max_npush_front);
         world.gop.max(max_npop_front);
         world.gop.max(max_ntask);
         world.gop.max(max_nmax);
+        world.gop.max(max_nsteal);
 
         double min_npush_back = q.npush_back;
         double min_npush_front = q.npush_front;
         double min_npop_front = q.npop_front;
-        double min_ntask = q.npush_back + q.npush_front;
+        double min_ntask = q.npush_back + q.npush_front + q.npush_local;
         double min_nmax = q.nmax;
+        double min_nsteal = q.nsteal;
         world.gop.min(min_npush_back);
         world.gop.min(min_npush_front);
         world.gop.min(min_npop_front);
         world.gop.min(min_ntask);
         world.gop.min(min_nmax);
+        world.gop.min(min_nsteal);
 
 #ifdef HAVE_PAPI
         double val[NUMEVENTS], max_val[NUMEVENTS], min_val[NUMEVENTS];
@@ -374,6 +399,15 @@ namespace madness {
                    min_nmsg_recv, nmsg_recv/world.size(), max_nmsg_recv);
             printf("    #bytes recv per node    %.2e / %.2e / %.2e\n",
                    min_nbyte_recv, nbyte_recv/world.size(), max_nbyte_recv);
+            printf(" #AM aggregated per node    %.2e / %.2e / %.2e\n",
+                   min_nmsg_agg, nmsg_agg/world.size(), max_nmsg_agg);
+            printf("  #msgs via shm per node    %.2e / %.2e / %.2e\n",
+                   min_nmsg_shm, nmsg_shm/world.size(), max_nmsg_shm);
+            printf("   #fences (passes each)    %.0f (%.2f) %s\n", nfence,
+                   nfence > 0 ? nfence_pass/nfence : 0.0,
+                   world.gop.fence_mode() == WorldGopInterface::FenceMode::wave ? "wave" : "tree");
+            printf(" fence latency avg / max    %.2e / %.2e s\n",
+                   nfence > 0 ? fence_wall/(nfence*world.size()) : 0.0, max_fence_wall);
             printf("        #msgs systemwide    %.2e\n", nmsg_sent);
             printf("       #bytes systemwide    %.2e\n", nbyte_sent);
             printf("\n");
@@ -385,6 +419,8 @@ namespace madness {
                    min_nmax, nmax/world.size(), max_nmax);
             printf("  #hi-pri tasks per node    %.2e / %.2e / %.2e\n",
                    min_npush_front, npush_front/world.size(), max_npush_front);
+            printf("  #stolen tasks per node    %.2e / %.2e / %.2e\n",
+                   min_nsteal, nsteal/world.size(), max_nsteal);
             printf("\n");
 #ifdef HAVE_PAPI
             printf("         PAPI statistics (min / avg / max)\n");
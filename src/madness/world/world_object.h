@@ -726,6 +726,11 @@ namespace madness {
         /// \param dest Description needed.
         /// \param memfn Verify: The member function to be invoked for the task.
         /// \return Description needed.
+        /// \warning With MAD_AM_ZEROCOPY set, contiguous \c Tensor arguments
+        /// of at least that many bytes are not copied when this returns but
+        /// sent later from their own storage.  Such a tensor must not be
+        /// modified in place (\c scale, \c gaxpy, \c +=, ...) until the
+        /// next fence.  This applies to all overloads.
         template <typename memfnT>
         typename detail::task_result_type<memfnT>::futureT
         send(ProcessID dest, memfnT memfn) const {
@@ -1000,6 +1005,11 @@ namespace madness {
         /// \param memfn Verify: The member function to be invoked for the task.
         /// \param attr Description needed.
         /// \return Description needed.
+        /// \warning With MAD_AM_ZEROCOPY set, contiguous \c Tensor arguments
+        /// of at least that many bytes are not copied when this returns but
+        /// sent later, if \c dest is remote, from their own storage.  Such a tensor must not be
+        /// modified in place (\c scale, \c gaxpy, \c +=, ...) until the
+        /// next fence.  This applies to all overloads.
         template <typename memfnT>
         typename detail::task_result_type<memfnT>::futureT
         task(ProcessID dest, memfnT memfn, const TaskAttributes& attr = TaskAttributes()) const {
@@ -32,10 +32,105 @@
 #include <madness/world/worldam.h>
 #include <madness/world/MADworld.h>
 #include <madness/world/worldmpi.h>
+#include <madness/world/units.h>
+#include <algorithm>
+#include <cstddef>
+#include <list>
 #include <sstream>
 
 namespace madness {
 
+    namespace detail {
+
+        namespace {
+
+            // Precedes each pooled buffer, keeping the user's part aligned
+            struct alignas(std::max_align_t) AmArgPrefix {
+                int cls; // Size class, or -1 if not pooled
+            };
+
+            struct AmArgCache {
+                std::vector<void*> free[AmArgPool::NCLASS];
+                std::uint64_t nreuse = 0;
+                ~AmArgCache();
+            };
+
+            // 0 before the cache of this thread is made, 1 while alive, 2 once destroyed
+            thread_local int am_arg_cache_state = 0;
+
+            AmArgCache::~AmArgCache() {
+                am_arg_cache_state = 2;
+                for (auto& v : free)
+                    for (void* p : v) ::operator delete(p);
+            }
+
+            AmArgCache* am_arg_cache() {
+                if (am_arg_cache_state == 2) return nullptr; // Thread is exiting
+                thread_local AmArgCache cache;
+                am_arg_cache_state = 1;
+                return &cache;
+            }
+
+        } // namespace
+
+        void* AmArgPool::allocate(std::size_t nbyte) {
+            const std::size_t total = nbyte + sizeof(AmArgPrefix);
+            int cls = 0;
+            while (cls < NCLASS && (MINSIZE << cls) < total) ++cls;
+
+            void* p = nullptr;
+            if (cls < NCLASS) {
+                AmArgCache* cache = am_arg_cache();
+                if (cache && !cache->free[cls].empty()) {
+                    p = cache->free[cls].back();
+                    cache->free[cls].pop_back();
+                    ++cache->nreuse;
+                }
+                else {
+                    p = ::operator new(MINSIZE << cls);
+                }
+            }
+            else {
+                cls = -1;
+                p = ::operator new(total);
+            }
+            static_cast<AmArgPrefix*>(p)->cls = cls;
+            return static_cast<char*>(p) + sizeof(AmArgPrefix);
+        }
+
+        void AmArgPool::deallocate(void* ptr) {
+            if (!ptr) return;
+            void* p = static_cast<char*>(ptr) - sizeof(AmArgPrefix);
+            const int cls = static_cast<AmArgPrefix*>(p)->cls;
+            if (cls >= 0) {
+                AmArgCache* cache = am_arg_cache();
+                if (cache && cache->free[cls].size() < MAXFREE) {
+                    cache->free[cls].push_back(p);
+                    return;
+                }
+            }
+            ::operator delete(p);
+        }
+
+        std::uint64_t AmArgPool::get_nreuse() {
+            AmArgCache* cache = am_arg_cache();
+            return cache ? cache->nreuse : 0;
+        }
+
+    } // namespace detail
+
+    std::atomic<std::uint64_t> WorldAmInterface::nmsg_aggregated{0};
+
+    namespace {
+        // Instances with aggregation enabled, visited by the RMI server thread
+        Mutex aggregating_mutex;
+        std::list<WorldAmInterface*> aggregating;
+    }
+
+    void WorldAmInterface::flush_stale_hook() {
+        ScopedMutex<Mutex> guard(aggregating_mutex);
+        for (WorldAmInterface* am : aggregating) am->flush_stale_aggregates();
+    }
 
 
     WorldAmInterface::WorldAmInterface(World& world)
@@ -48,6 +143,11 @@ namespace madness {
             , nsent(0)
             , nrecv(0)
             , map_to_comm_world(nproc)
+            , agg_size(0)
+            , agg_small(0)
+            , agg_timeout(1e-4)
+            , agg(nullptr)
+            , nagg_pending(0)
     {
         lock();
 
@@ -79,10 +179,44 @@ namespace madness {
         //     std::cout << "map " << i << " " << map_to_comm_world[i] << std::endl;
         // }
 
+        // Aggregation of small messages (off unless MAD_AM_AGGREGATE is set)
+        const char* mad_am_aggregate = getenv("MAD_AM_AGGREGATE");
+        if (mad_am_aggregate) {
+            agg_size = cstr_to_memory_size(mad_am_aggregate);
+            if (agg_size && agg_size < 8*sizeof(AmArg)) {
+                agg_size = 8*sizeof(AmArg);
+                if (rank == 0)
+                    print_error("!!! WARNING: MAD_AM_AGGREGATE must be 0 or at least ", agg_size, " bytes.\n",
+                                "!!! WARNING: Increasing MAD_AM_AGGREGATE to ", agg_size, ".\n");
+            }
+            agg_small = agg_size/8;
+        }
+        const char* mad_am_aggregate_us = getenv("MAD_AM_AGGREGATE_US");
+        if (mad_am_aggregate_us) {
+            double us = 100;
+            std::stringstream ss(mad_am_aggregate_us);
+            ss >> us;
+            agg_timeout = std::max(us,0.0)*1e-6;
+        }
+        if (agg_size) {
+            agg.reset(new Aggregate[nproc]);
+            ScopedMutex<Mutex> guard(aggregating_mutex);
+            aggregating.push_back(this);
+            RMI::set_poll_hook(flush_stale_hook);
+        }
+
         unlock();
     }
 
     WorldAmInterface::~WorldAmInterface() {
+        if (agg_size) {
+            {
+                ScopedMutex<Mutex> guard(aggregating_mutex);
+                aggregating.remove(this);
+            }
+            if(!SafeMPI::Is_finalized()) fence();
+            for (int p=0; p<nproc; ++p) if (agg[p].arg) free_am_arg(agg[p].arg);
+        }
         if(!SafeMPI::Is_finalized()) {
             while (free_managed_buffers() != nsend) myusleep(100);
         }
@@ -38,9 +38,13 @@
 #include <madness/world/buffer_archive.h>
 #include <madness/world/worldrmi.h>
 #include <madness/world/world.h>
+#include <madness/world/timers.h>
 #include <vector>
+#include <atomic>
 #include <cstddef>
+#include <cstring>
 #include <memory>
+#include <new>
 #include <pthread.h>
 
 namespace madness {
@@ -83,6 +87,11 @@ namespace madness {
         template <class Derived> friend class WorldObject;
 
         friend AmArg* alloc_am_arg(std::size_t nbyte);
+        friend AmArg* copy_am_arg(const AmArg& arg);
+        friend void free_am_arg(AmArg* arg);
+        template <typename... argT> friend AmArg* new_am_arg(const argT&... args);
+
+        typedef std::vector<archive::BufferOutputArchive::External> externalT;
 
         unsigned char header[RMI::HEADER_LEN]; // !!!!!!!!!  MUST BE FIRST !!!!!!!!!!
         std::size_t nbyte;      // Size of user payload
@@ -90,9 +99,10 @@ namespace madness {
         std::ptrdiff_t func;    // User function to call, as a relative fn ptr (see archive::to_rel_fn_ptr)
         ProcessID src;          // Rank of process sending the message
         unsigned int flags;     // Misc. bit flags
+        externalT* external;    // Payload left in place by the sender (see new_am_arg), or null
 
-        // On 32 bit machine AmArg is HEADER_LEN+4+4+4+4+4=84 bytes
-        // On 64 bit machine AmArg is HEADER_LEN+8+8+8+4+4=96 bytes
+        // On 32 bit machine AmArg is HEADER_LEN+4+4+4+4+4+4=88 bytes
+        // On 64 bit machine AmArg is HEADER_LEN+8+8+8+4+4+8=104 bytes
 
         // No copy constructor or assignment
         AmArg(const AmArg&);
@@ -115,6 +125,13 @@ namespace madness {
 
         void clear_flags() { flags = 0; }
 
+        /// Returns the part of the payload that is not in buf() (always 0 on receipt)
+        std::size_t nbyte_external() const {
+            std::size_t n = 0;
+            if (external) for (const auto& e : *external) n += e.nbyte;
+            return n;
+        }
+
         am_handlerT get_func() const { return archive::to_abs_fn_ptr<am_handlerT>(func); }
 
         archive::BufferInputArchive make_input_arch() const {
@@ -158,25 +175,58 @@ namespace madness {
     };
 
 
+    namespace detail {
+
+        /// Per-thread pools of size-classed buffers for active messages
+
+        /// A message is allocated by the thread sending it but freed by
+        /// whichever thread sees the send complete (a worker, the main
+        /// thread in a fence, or the RMI server thread), so every thread
+        /// keeps its own free lists and no lock is taken.  A buffer freed by
+        /// another thread joins the pool of that thread.  Requests larger
+        /// than the largest class go directly to the system allocator.
+        class AmArgPool {
+        public:
+            static const std::size_t MINSIZE = 256; ///< Size of the smallest class in bytes
+            static const int NCLASS = 9;            ///< Classes are MINSIZE*2^i bytes, up to 64 KB
+            static const std::size_t MAXFREE = 64;  ///< Max. no. of free buffers kept per class and thread
+
+            /// Returns a buffer of at least nbyte bytes aligned for AmArg
+            static void* allocate(std::size_t nbyte);
+
+            /// Returns a buffer obtained from allocate()
+            static void deallocate(void* p);
+
+            /// No. of allocations this thread satisfied from its pool
+            static std::uint64_t get_nreuse();
+        };
+
+    } // namespace detail
+
     /// Allocates a new AmArg with nbytes of user data ... delete with free_am_arg
     inline AmArg* alloc_am_arg(std::size_t nbyte) {
         std::size_t narg = 1 + (nbyte+sizeof(AmArg)-1)/sizeof(AmArg);
-        AmArg *arg = new AmArg[narg];
+        AmArg *arg = new (detail::AmArgPool::allocate(narg*sizeof(AmArg))) AmArg;
         arg->set_size(nbyte);
+        arg->external = nullptr;
         return arg;
     }
 
 
+    /// Copies an AmArg ... data left in place is shared with the original
     inline AmArg* copy_am_arg(const AmArg& arg) {
-        AmArg* r = alloc_am_arg(arg.size());
-        memcpy(reinterpret_cast<void*>(r), &arg, arg.size()+sizeof(AmArg));
+        const std::size_t nbyte = arg.size() - arg.nbyte_external();
+        AmArg* r = alloc_am_arg(nbyte);
+        memcpy(reinterpret_cast<void*>(r), &arg, nbyte+sizeof(AmArg));
+        if (arg.external) r->external = new AmArg::externalT(*arg.external);
         return r;
     }
 
     /// Frees an AmArg allocated with alloc_am_arg
     inline void free_am_arg(AmArg* arg) {
         //std::cout << " freeing amarg " << (void*)(arg) << " " << pthread_self() << std::endl;
-        delete [] arg;
+        delete arg->external; // Releases data left in place
+        detail::AmArgPool::deallocate(arg); // AmArg is otherwise trivially destructible
     }
 
     /// Terminate argument serialization
@@ -190,15 +240,36 @@ namespace madness {
     }
 
     /// Convenience template for serializing arguments into a new AmArg
+
+    /// If RMI::zerocopy_min() is nonzero (MAD_AM_ZEROCOPY, off by
+    /// default), contiguous arrays of at least that many bytes that are
+    /// serialized with archive::store_external() (e.g., the data of a
+    /// \c Tensor) are not copied into the message.  They are sent from
+    /// where they live, with a reference to their owner held until the
+    /// send completes.  The receiver therefore sees whatever the array
+    /// holds when MPI reads it, so the caller must not modify it in place
+    /// until the send has completed, which is certain after the next
+    /// fence.
     template <typename... argT>
     inline AmArg* new_am_arg(const argT&... args) {
         // compute size
-        archive::BufferOutputArchive count;
+        const std::size_t min_external = RMI::zerocopy_min();
+        archive::BufferOutputArchive count(min_external);
         serialize_am_args(count, args...);
 
-        // Serialize arguments
-        AmArg* am_args = alloc_am_arg(count.size());
-        serialize_am_args(*am_args, args...);
+        if (count.nbyte_external() == 0) {
+            // Serialize arguments
+            AmArg* am_args = alloc_am_arg(count.size());
+            serialize_am_args(*am_args, args...);
+            return am_args;
+        }
+
+        // Serialize arguments, leaving large arrays in place
+        AmArg* am_args = alloc_am_arg(count.size() - count.nbyte_external());
+        am_args->external = new AmArg::externalT;
+        serialize_am_args(archive::BufferOutputArchive(am_args->buf(), am_args->size(),
+                                                       am_args->external, min_external), args...);
+        am_args->set_size(count.size());
         return am_args;
     }
 
@@ -236,6 +307,14 @@ namespace madness {
             ~SendReq() {free();}
         };
 
+        /// Per-destination buffer packing small messages into one RMI message
+        struct Aggregate : public SPINLOCK_TYPE {
+            std::atomic<AmArg*> arg; ///< Aggregate being filled, or null ... atomic so that it can be tested without the lock
+            std::size_t used;        ///< Bytes of the payload of arg in use
+            double start;            ///< wall_time() when the first message was packed
+            Aggregate() : arg(nullptr), used(0), start(0.0) {}
+        };
+
         // Multiple threads are making their way thru here ... must be careful
         // to ensure updates are atomic and consistent
 
@@ -251,6 +330,19 @@ namespace madness {
 
         std::vector<int> map_to_comm_world; ///< Maps rank in current MPI communicator to SafeMPI::COMM_WORLD
 
+        std::size_t agg_size;               ///< Payload capacity of an aggregate, 0 if aggregation is off
+        std::size_t agg_small;              ///< Messages of at most this size (including AmArg) are aggregated
+        double agg_timeout;                 ///< Partly filled aggregates older than this (s) are sent by the server
+        std::unique_ptr<Aggregate []> agg;  ///< Aggregates indexed by destination rank in this world
+        std::atomic<int> nagg_pending;      ///< No. of non-empty aggregates
+
+        static std::atomic<std::uint64_t> nmsg_aggregated; ///< Counts AM sent inside an aggregate (all worlds)
+
+        /// Space taken in an aggregate by a message (keeps each AmArg aligned)
+        static std::size_t aggregate_stride(const AmArg* arg) {
+            return ((arg->size() + 2*sizeof(AmArg) - 1)/sizeof(AmArg))*sizeof(AmArg);
+        }
+
         /// This handles all incoming RMI messages for all instances
         static void handler(void *buf, std::size_t nbyte) {
             // It will be singled threaded since only the RMI receiver
@@ -262,36 +354,43 @@ namespace madness {
             MADNESS_ASSERT(arg->size() + sizeof(AmArg) == nbyte);
             MADNESS_ASSERT(w);
             MADNESS_ASSERT(func);
+            arg->external = nullptr; // The whole payload has arrived in buf
             func(*arg);
             w->am.nrecv++;  // Must be AFTER execution of the function
         }
 
-    public:
-        WorldAmInterface(World& world);
-
-        virtual ~WorldAmInterface();
-
-        /// Currently a noop
-        void fence() {}
-
-        /// Sends a managed non-blocking active message
-        void send(ProcessID dest, am_handlerT op, const AmArg* arg,
-                  const int attr=RMI::ATTR_ORDERED)
-        {
-            // Setup the header
-            {
-                AmArg* argx = const_cast<AmArg*>(arg);
-
-                argx->set_worldid(worldid);
-                argx->set_src(rank);
-                argx->set_func(op);
-                argx->clear_flags(); // Is this the right place for this?
+        /// Unpacks an aggregate, invoking each message in the order it was packed
+        static void aggregate_handler(const AmArg& arg) {
+            World* w = arg.get_world();
+            unsigned char* p = arg.buf();
+            unsigned char* const end = p + arg.size();
+            while (p < end) {
+                AmArg* sub = reinterpret_cast<AmArg*>(p);
+                am_handlerT func = sub->get_func();
+                MADNESS_ASSERT(func);
+                func(*sub);
+                w->am.nrecv++;  // The aggregate itself is counted by handler()
+                p += aggregate_stride(sub);
             }
+        }
 
-            // Sanity check
-            MADNESS_ASSERT(arg->get_world());
-            MADNESS_ASSERT(arg->get_func());
+        /// Starts the RMI send of an AmArg, gathering any data left in place
+        static RMI::Request rmi_isend(const AmArg* arg, ProcessID dest, const int attr) {
+            if (!arg->external)
+                return RMI::isend(arg, arg->size()+sizeof(AmArg), dest, handler, attr);
+
+            const AmArg::externalT& external = *arg->external;
+            std::vector<RMI::Insert> insert(external.size());
+            std::size_t nbyte = arg->size() + sizeof(AmArg);
+            for (std::size_t k=0; k<external.size(); ++k) {
+                insert[k] = RMI::Insert{external[k].offset + sizeof(AmArg), external[k].ptr, external[k].nbyte};
+                nbyte -= external[k].nbyte;
+            }
+            return RMI::isend(arg, nbyte, insert.data(), insert.size(), dest, handler, attr);
+        }
 
+        /// Sends an AmArg whose header is already set up
+        void send_arg(ProcessID dest, const AmArg* arg, const int attr) {
             // Map dest from world's communicator to comm_world
             dest = map_to_comm_world[dest];
 
@@ -310,7 +409,7 @@ namespace madness {
 
                 lock(); nsent++; unlock(); // This world must still keep track of messages
 
-                RMI::send_req.emplace_back(std::make_unique<SendReq>((AmArg*)(arg), RMI::isend(arg, arg->size()+sizeof(AmArg), dest, handler, attr)));
+                RMI::send_req.emplace_back(std::make_unique<SendReq>((AmArg*)(arg), rmi_isend(arg, dest, attr)));
 
                 //std::cout << "sending message from server " << (void*)(arg) << " " << pthread_self() << " " << p <<  std::endl;
 
@@ -346,10 +445,127 @@ namespace madness {
             }
 
             // Buffer is now free but still locked by me
-            send_req[i].set((AmArg*)(arg), RMI::isend(arg, arg->size()+sizeof(AmArg), dest, handler, attr));
+            send_req[i].set((AmArg*)(arg), rmi_isend(arg, dest, attr));
             send_req[i].unlock(); // << matches try_lock above
         }
 
+        /// Sends the aggregate for dest ... caller holds its lock and it must be non-empty
+        void send_aggregate(ProcessID dest) {
+            Aggregate& a = agg[dest];
+            AmArg* arg = a.arg.exchange(nullptr);
+            --nagg_pending;
+            arg->set_size(a.used);
+            arg->set_worldid(worldid);
+            arg->set_src(rank);
+            arg->set_func(aggregate_handler);
+            arg->clear_flags();
+            send_arg(dest, arg, RMI::ATTR_ORDERED);
+        }
+
+        /// Packs a small message into the aggregate for dest, taking ownership of arg
+        void aggregate(ProcessID dest, const AmArg* arg) {
+            const std::size_t nbyte = arg->size() + sizeof(AmArg);
+            const std::size_t stride = aggregate_stride(arg);
+            const std::size_t cap = std::min(agg_size, RMI::max_msg_len() - sizeof(AmArg));
+            Aggregate& a = agg[dest];
+            a.lock();
+            if (a.arg && a.used + stride > cap) send_aggregate(dest);
+            if (!a.arg) {
+                a.arg = alloc_am_arg(cap);
+                a.used = 0;
+                a.start = wall_time();
+                ++nagg_pending;
+            }
+            std::memcpy(a.arg.load()->buf() + a.used, static_cast<const void*>(arg), nbyte);
+            a.used += stride;
+            lock(); nsent++; unlock(); // Counted as sent now, received when unpacked
+            a.unlock();
+            nmsg_aggregated.fetch_add(1, std::memory_order_relaxed);
+            free_am_arg(const_cast<AmArg*>(arg));
+        }
+
+        /// Sends partly filled aggregates older than agg_timeout ... called by the RMI server thread
+        void flush_stale_aggregates() {
+            if (nagg_pending == 0) return;
+            const double now = wall_time();
+            for (int p=0; p<nproc; ++p) {
+                Aggregate& a = agg[p];
+                if (a.arg && a.try_lock()) { // Never block the server
+                    if (a.arg && now - a.start > agg_timeout) send_aggregate(p);
+                    a.unlock();
+                }
+            }
+        }
+
+        /// RMI poll hook flushing stale aggregates of all worlds
+        static void flush_stale_hook();
+
+    public:
+        WorldAmInterface(World& world);
+
+        virtual ~WorldAmInterface();
+
+        /// Sends all aggregated messages
+
+        /// Aggregation is enabled by setting \c MAD_AM_AGGREGATE to the
+        /// size of the per-destination buffer (e.g., "64KB"; the default is
+        /// off).  Messages from worker threads no larger than 1/8 of that
+        /// size are packed together and sent as one RMI message when the
+        /// buffer fills, when a larger message is sent to the same process,
+        /// when \c MAD_AM_AGGREGATE_US microseconds (default 100) have
+        /// passed, or at a fence.  The order of messages from a thread is
+        /// preserved.
+        void fence() {
+            if (!agg_size || nagg_pending == 0) return;
+            for (int p=0; p<nproc; ++p) {
+                Aggregate& a = agg[p];
+                if (a.arg) {
+                    a.lock();
+                    if (a.arg) send_aggregate(p);
+                    a.unlock();
+                }
+            }
+        }
+
+        /// Sends a managed non-blocking active message
+        void send(ProcessID dest, am_handlerT op, const AmArg* arg,
+                  const int attr=RMI::ATTR_ORDERED)
+        {
+            // Setup the header
+            {
+                AmArg* argx = const_cast<AmArg*>(arg);
+                argx->set_worldid(worldid);
+                argx->set_src(rank);
+                argx->set_func(op);
+                argx->clear_flags(); // Is this the right place for this?
+            }
+
+            // Sanity check
+            MADNESS_ASSERT(arg->get_world());
+            MADNESS_ASSERT(arg->get_func());
+
+            // The server thread neither aggregates nor flushes ... its
+            // messages are not ordered with respect to those of workers
+            if (agg_size && !RMI::get_this_thread_is_server()) {
+                if (arg->size() + sizeof(AmArg) <= agg_small && !arg->external) {
+                    aggregate(dest, arg);
+                    return;
+                }
+                // Earlier small messages to dest must go first
+                Aggregate& a = agg[dest];
+                a.lock();
+                if (a.arg) send_aggregate(dest);
+                a.unlock();
+            }
+
+            send_arg(dest, arg, attr);
+        }
+
+        /// Returns the number of active messages sent inside aggregates by this process
+        static std::uint64_t get_nmsg_aggregated() {
+            return nmsg_aggregated.load(std::memory_order_relaxed);
+        }
+
         /// Frees as many send buffers as possible, returning the number that are free
         int free_managed_buffers() {
             int nfree = 0;
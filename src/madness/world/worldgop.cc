@@ -29,6 +29,8 @@
   fax:   865-572-0680
 */
 
+#include <algorithm>
+#include <array>
 #include <limits>
 #include <madness/world/worldgop.h>
 #include <madness/world/MADworld.h>
@@ -46,18 +48,41 @@ namespace madness {
     /// Then globally checks that nsent=nrecv and that both are
     /// constant over two traversals.  We are then we are sure
     /// that all tasks and AM are processed and there no AM in
-    /// flight.
+    /// flight.  In wave mode Safra's algorithm is used instead, see
+    /// set_fence_mode().
     void WorldGopInterface::fence_impl(std::function<void()> epilogue,
                                    bool pause_during_epilogue,
                                    bool debug) {
         PROFILE_MEMBER_FUNC(WorldGopInterface);
         MADNESS_CHECK(not forbid_fence_);
-        unsigned long nsent_prev=0, nrecv_prev=1; // invalid initial condition
-        SafeMPI::Request req0, req1;
-        ProcessID parent, child0, child1;
-        world_.mpi.binary_tree_info(0, parent, child0, child1);
         Tag gfence_tag = world_.mpi.unique_tag();
         Tag bcast_tag = world_.mpi.unique_tag();
+        const double start = wall_time();
+        const int npass = (fence_mode_ == FenceMode::wave) ? await_termination_wave(gfence_tag, bcast_tag, debug)
+                                                            : await_termination(gfence_tag, bcast_tag, debug);
+        record_fence(npass, wall_time() - start);
+
+        // execute post-fence actions
+        MADNESS_ASSERT(pause_during_epilogue == false);
+        epilogue();
+        world_.am.free_managed_buffers(); // free up communication buffers
+        deferred_->do_cleanup();
+#ifdef MADNESS_HAS_GOOGLE_PERF_TCMALLOC
+        MallocExtension::instance()->ReleaseFreeMemory();
+//        print("clearing memory");
+#endif
+      if (debug)
+        madness::print(world_.rank(), ": WORLD.GOP.FENCE: done with fence in ", npass, (npass > 1 ? " loops" : " loop"));
+    }
+
+    int WorldGopInterface::await_termination(Tag gfence_tag, Tag bcast_tag, bool debug) {
+        unsigned long nsent_prev=0, nrecv_prev=1; // invalid initial condition
+        SafeMPI::Request req0;
+        ProcessID parent;
+        std::vector<ProcessID> child;
+        world_.mpi.tree_info(0, parent, child);
+        std::vector<SafeMPI::Request> reqc(child.size());
+        std::vector<std::array<uint64_t,2>> sumc(child.size());
         int npass = 0;
 
         //double start = wall_time();
@@ -66,44 +91,24 @@ namespace madness {
         madness::print(world_.rank(), ": WORLD.GOP.FENCE: entering fence loop, gfence_tag=", gfence_tag, " bcast_tag=", bcast_tag);
 
       while (1) {
-            uint64_t sum0[2]={0,0}, sum1[2]={0,0}, sum[2];
-            if (child0 != -1) req0 = world_.mpi.Irecv((void*) &sum0, sizeof(sum0), MPI_BYTE, child0, gfence_tag);
-            if (child1 != -1) req1 = world_.mpi.Irecv((void*) &sum1, sizeof(sum1), MPI_BYTE, child1, gfence_tag);
+            uint64_t sum[2];
+            for (std::size_t c = 0; c < child.size(); ++c)
+                reqc[c] = world_.mpi.Irecv((void*) sumc[c].data(), sizeof(sumc[c]), MPI_BYTE, child[c], gfence_tag);
             world_.taskq.fence();
-            if (child0 != -1) World::await(req0);
-            if (child1 != -1) World::await(req1);
-
-            if (debug && (child0 != -1 || child1 != -1))
-              madness::print(world_.rank(), ": WORLD.GOP.FENCE: npass=", npass, " received messages from children={", child0, ",", child1, "} gfence_tag=", gfence_tag);
-
-            bool finished;
-            uint64_t ntask1, nsent1, nrecv1, ntask2, nsent2, nrecv2;
-            do {
-                world_.taskq.fence();
-
-                // Since the number of outstanding tasks and number of AM sent/recv
-                // don't share a critical section read each twice and ensure they
-                // are unchanged to ensure that are consistent ... they don't have
-                // to be current.
-
-                ntask1 = world_.taskq.size();
-                nsent1 = world_.am.nsent;
-                nrecv1 = world_.am.nrecv;
+            for (std::size_t c = 0; c < child.size(); ++c) World::await(reqc[c]);
 
-                __asm__ __volatile__ (" " : : : "memory");
+            if (debug && !child.empty())
+              madness::print(world_.rank(), ": WORLD.GOP.FENCE: npass=", npass, " received messages from children=", child, " gfence_tag=", gfence_tag);
 
-                ntask2 = world_.taskq.size();
-                nsent2 = world_.am.nsent;
-                nrecv2 = world_.am.nrecv;
+            uint64_t nsent, nrecv;
+            await_local_quiescence(nsent, nrecv);
 
-                __asm__ __volatile__ (" " : : : "memory");
-
-                finished = (ntask2==0) && (ntask1==0) && (nsent1==nsent2) && (nrecv1==nrecv2);
+            sum[0] = nsent; // Must use values read above
+            sum[1] = nrecv;
+            for (const auto& s : sumc) {
+                sum[0] += s[0];
+                sum[1] += s[1];
             }
-            while (!finished);
-
-            sum[0] = sum0[0] + sum1[0] + nsent2; // Must use values read above
-            sum[1] = sum0[1] + sum1[1] + nrecv2;
 
             if (parent != -1) {
                 req0 = world_.mpi.Isend(&sum, sizeof(sum), MPI_BYTE, parent, gfence_tag);
@@ -145,23 +150,153 @@ namespace madness {
             nrecv_prev = sum[1];
 
         };
-        // execute post-fence actions
-        MADNESS_ASSERT(pause_during_epilogue == false);
-        epilogue();
-        world_.am.free_managed_buffers(); // free up communication buffers
-        deferred_->do_cleanup();
-#ifdef MADNESS_HAS_GOOGLE_PERF_TCMALLOC
-        MallocExtension::instance()->ReleaseFreeMemory();
-//        print("clearing memory");
-#endif
-      if (debug)
-        madness::print(world_.rank(), ": WORLD.GOP.FENCE: done with fence in ", npass, (npass > 1 ? " loops" : " loop"));
+        return npass;
+    }
+
+    int WorldGopInterface::await_termination_wave(Tag wave_tag, Tag bcast_tag, bool debug) {
+        // Safra's algorithm with the ring replaced by waves over the process
+        // tree.  A wave is {sum of nsent-nrecv, marked} and is summed up the
+        // tree; a process adds its own count once it is idle and its children
+        // have reported, and marks the wave if it received messages since it
+        // contributed to the previous wave (messages received before the
+        // first wave of this fence also count, which is conservative).
+        // Process 0 declares termination when an unmarked wave sums to zero
+        // and broadcasts the verdict, which also separates one wave from the
+        // next.  A process waiting for its children or for the verdict keeps
+        // running tasks.
+        ProcessID parent;
+        std::vector<ProcessID> child;
+        world_.mpi.tree_info(0, parent, child);
+        std::vector<SafeMPI::Request> reqc(child.size());
+        std::vector<std::array<std::int64_t,2>> wavec(child.size());
+        int npass = 0;
+
+        while (1) {
+            for (std::size_t c = 0; c < child.size(); ++c)
+                reqc[c] = world_.mpi.Irecv((void*) wavec[c].data(), sizeof(wavec[c]), MPI_BYTE, child[c], wave_tag);
+            world_.taskq.fence();
+            for (std::size_t c = 0; c < child.size(); ++c) World::await(reqc[c]);
+
+            std::uint64_t nsent, nrecv;
+            await_local_quiescence(nsent, nrecv);
+
+            std::array<std::int64_t,2> wave = {std::int64_t(nsent) - std::int64_t(nrecv), nrecv != wave_nrecv_};
+            wave_nrecv_ = nrecv;
+            for (const auto& w : wavec) {
+                wave[0] += w[0];
+                wave[1] |= w[1];
+            }
+
+            if (parent != -1) {
+                SafeMPI::Request req = world_.mpi.Isend(wave.data(), sizeof(wave), MPI_BYTE, parent, wave_tag);
+                World::await(req);
+            }
+
+            std::int64_t done = (wave[0] == 0 && !wave[1]);
+            broadcast(&done, sizeof(done), 0, true, bcast_tag);
+            ++npass;
+
+            if (debug)
+              madness::print(world_.rank(), ": WORLD.GOP.FENCE: wave=", npass, " count=", wave[0], " marked=", wave[1], " done=", done);
+
+            if (done) break;
+        }
+        return npass;
+    }
+
+    void WorldGopInterface::await_local_quiescence(std::uint64_t& nsent, std::uint64_t& nrecv) {
+        bool finished;
+        uint64_t ntask1, nsent1, nrecv1, ntask2;
+        do {
+            world_.taskq.fence();
+            world_.am.fence(); // Send any aggregated messages
+
+            // Since the number of outstanding tasks and number of AM sent/recv
+            // don't share a critical section read each twice and ensure they
+            // are unchanged to ensure that are consistent ... they don't have
+            // to be current.
+
+            ntask1 = world_.taskq.size();
+            nsent1 = world_.am.nsent;
+            nrecv1 = world_.am.nrecv;
+
+            __asm__ __volatile__ (" " : : : "memory");
+
+            ntask2 = world_.taskq.size();
+            nsent = world_.am.nsent;
+            nrecv = world_.am.nrecv;
+
+            __asm__ __volatile__ (" " : : : "memory");
+
+            finished = (ntask2==0) && (ntask1==0) && (nsent1==nsent) && (nrecv1==nrecv);
+        }
+        while (!finished);
+    }
+
+    void WorldGopInterface::record_fence(int npass, double wall) {
+        ScopedMutex<Mutex> obolus(fence_stats_mutex_);
+        ++fence_stats_.nfence;
+        fence_stats_.npass += npass;
+        fence_stats_.wall += wall;
+        fence_stats_.wall_max = std::max(fence_stats_.wall_max, wall);
     }
 
     void WorldGopInterface::fence(bool debug) {
       fence_impl([]{}, false, debug);
     }
 
+    Future<bool> WorldGopInterface::fence_async(bool debug) {
+        PROFILE_MEMBER_FUNC(WorldGopInterface);
+        MADNESS_CHECK(not forbid_fence_);
+
+        // Tags are taken by the calling thread so that every process
+        // agrees on them no matter how fences and async fences interleave
+        const Tag gfence_tag = world_.mpi.unique_tag();
+        const Tag bcast_tag = world_.mpi.unique_tag();
+
+        // Tasks held back by this thread must be visible to the detector
+        ThreadPool::instance()->flush_prebuf();
+
+        Future<bool> done;
+        ScopedMutex<PthreadConditionVariable> obolus(async_fence_cv_);
+        if (!async_fence_thread_.joinable())
+            async_fence_thread_ = std::thread([this]() { run_async_fences(); });
+        async_fence_queue_.push_back(AsyncFence{done, gfence_tag, bcast_tag, debug});
+        async_fence_cv_.signal();
+        return done;
+    }
+
+    void WorldGopInterface::run_async_fences() {
+        while (1) {
+            std::list<AsyncFence> next;
+            {
+                ScopedMutex<PthreadConditionVariable> obolus(async_fence_cv_);
+                while (async_fence_queue_.empty() && !async_fence_stop_) async_fence_cv_.wait();
+                if (async_fence_queue_.empty()) return;
+                next.splice(next.begin(), async_fence_queue_, async_fence_queue_.begin());
+            }
+
+            AsyncFence& f = next.front();
+            try {
+                const double start = wall_time();
+                const int npass = await_termination(f.gfence_tag, f.bcast_tag, f.debug);
+                record_fence(npass, wall_time() - start);
+                world_.am.free_managed_buffers();
+                if (f.debug)
+                  madness::print(world_.rank(), ": WORLD.GOP.FENCE_ASYNC: done with fence in ", npass, (npass > 1 ? " loops" : " loop"));
+            }
+            catch (const SafeMPI::Exception& e) {
+                print(e);
+                error("caught an MPI exception in fence_async");
+            }
+            catch (const madness::MadnessException& e) {
+                print(e);
+                error("caught a MADNESS exception in fence_async");
+            }
+            f.done.set(true);
+        }
+    }
+
     void WorldGopInterface::serial_invoke(std::function<void()> action) {
       // default implementation requires 2 fences since action may change global state visible to all tasks
       // fence_impl could be used if possible to pause thread pool after the fence
@@ -173,30 +308,26 @@ namespace madness {
     void WorldGopInterface::broadcast(void* buf, size_t nbyte, ProcessID root, bool dowork, Tag bcast_tag) {
       if (bcast_tag < 0)
         bcast_tag = world_.mpi.unique_tag();
-      ProcessID parent, child0, child1;
-      world_.mpi.binary_tree_info(root, parent, child0, child1);
+      ProcessID parent;
+      std::vector<ProcessID> child;
+      world_.mpi.tree_info(root, parent, child);
       const size_t max_msg_size =
           static_cast<size_t>(max_reducebcast_msg_size());
 
       auto broadcast_impl = [&, this](void *buf, int nbyte) {
-        SafeMPI::Request req0, req1;
-
         // print("BCAST TAG", bcast_tag);
 
         if (parent != -1) {
-          req0 = world_.mpi.Irecv(buf, nbyte, MPI_BYTE, parent, bcast_tag);
+          SafeMPI::Request req0 = world_.mpi.Irecv(buf, nbyte, MPI_BYTE, parent, bcast_tag);
           World::await(req0, dowork);
         }
 
-        if (child0 != -1)
-          req0 = world_.mpi.Isend(buf, nbyte, MPI_BYTE, child0, bcast_tag);
-        if (child1 != -1)
-          req1 = world_.mpi.Isend(buf, nbyte, MPI_BYTE, child1, bcast_tag);
-
-        if (child0 != -1)
-          World::await(req0, dowork);
-        if (child1 != -1)
-          World::await(req1, dowork);
+        // Inter-node children come first so the slowest links start earliest
+        std::vector<SafeMPI::Request> req(child.size());
+        for (std::size_t c = 0; c < child.size(); ++c)
+          req[c] = world_.mpi.Isend(buf, nbyte, MPI_BYTE, child[c], bcast_tag);
+        for (std::size_t c = 0; c < child.size(); ++c)
+          World::await(req[c], dowork);
       };
 
       while (nbyte) {
@@ -38,8 +38,13 @@
 /// If you can recall the Intel hypercubes, their comm lib used GOP as
 /// the abbreviation.
 
+#include <cstdint>
 #include <functional>
+#include <list>
+#include <string>
+#include <thread>
 #include <type_traits>
+#include <utility>
 #include <madness/world/worldtypes.h>
 #include <madness/world/buffer_archive.h>
 #include <madness/world/world.h>
@@ -139,16 +144,46 @@ namespace madness {
     };
 
 
+    /// Latency of the fences of a world, see WorldGopInterface::get_fence_stats()
+    struct FenceStats {
+        std::uint64_t nfence = 0; ///< No. of fences completed
+        std::uint64_t npass = 0;  ///< Total no. of termination-detection passes
+        double wall = 0.0;        ///< Total wall time (s) spent detecting termination
+        double wall_max = 0.0;    ///< Longest termination detection (s)
+    };
+
     /// Provides collectives that interoperate with the AM and task interfaces
 
     /// If native AM interoperates with MPI we probably should map these to MPI.
     class WorldGopInterface {
+    public:
+        /// How fence() detects global termination
+        enum class FenceMode {
+            tree, ///< Sum the message counts up the process tree, then broadcast them back down
+            wave ///< Sum the message counts and receive marks up the process tree once per wave (Safra's algorithm)
+        };
+
     private:
         World& world_; ///< World object that this is a part of
         std::shared_ptr<detail::DeferredCleanup> deferred_; ///< Deferred cleanup object.
         bool debug_; ///< Debug mode
         bool forbid_fence_=false; ///< forbid calling fence() in case of several active worlds
         int max_reducebcast_msg_size_ = std::numeric_limits<int>::max();  ///< maximum size of messages (in bytes) sent by reduce and broadcast
+        /// An async fence waiting for its termination detection
+        struct AsyncFence {
+            Future<bool> done; ///< Set when the fence completes
+            Tag gfence_tag;    ///< Tag used to sum the message counts up the tree
+            Tag bcast_tag;     ///< Tag used to broadcast the sums
+            bool debug;        ///< Print progress statistics
+        };
+        std::list<AsyncFence> async_fence_queue_; ///< Async fences not yet started, in the order of fence_async() calls
+        std::thread async_fence_thread_; ///< Runs the termination detection of async fences one after the other
+        bool async_fence_stop_=false; ///< Tells async_fence_thread_ to exit once the queue is empty
+        PthreadConditionVariable async_fence_cv_; ///< Protects the queue and the stop flag, signalled when they change
+        FenceMode fence_mode_; ///< How fence() detects termination
+        FenceStats fence_stats_; ///< Latency of fences so far
+        std::uint64_t wave_nrecv_=0; ///< No. of AM received when this process last contributed to a fence wave
+        mutable Mutex fence_stats_mutex_; ///< Protects fence_stats_
 
         friend class detail::DeferredCleanup;
 
@@ -626,6 +661,34 @@ namespace madness {
                         bool pause_during_epilogue = false,
                         bool debug = false);
 
+        /// Runs the termination detection of a fence
+
+        /// \param[in] gfence_tag tag used to sum the message counts up the tree
+        /// \param[in] bcast_tag tag used to broadcast the sums
+        /// \param[in] debug set to true to print progress statistics using madness::print()
+        /// \return the number of passes over the tree
+        int await_termination(Tag gfence_tag, Tag bcast_tag, bool debug);
+
+        /// Runs the termination detection of a fence by Safra's algorithm over the process tree
+
+        /// \param[in] wave_tag tag used to sum the waves up the tree
+        /// \param[in] bcast_tag tag used to broadcast the verdict of each wave
+        /// \param[in] debug set to true to print progress statistics using madness::print()
+        /// \return the number of waves
+        int await_termination_wave(Tag wave_tag, Tag bcast_tag, bool debug);
+
+        /// Waits until this process has no tasks and its message counts are stable
+
+        /// \param[out] nsent the number of active messages sent
+        /// \param[out] nrecv the number of active messages received
+        void await_local_quiescence(std::uint64_t& nsent, std::uint64_t& nrecv);
+
+        /// Adds a completed termination detection to the fence statistics
+        void record_fence(int npass, double wall);
+
+        /// Body of async_fence_thread_ ... runs queued async fences until told to stop
+        void run_async_fences();
+
         int initial_max_reducebcast_msg_size() {
           int result = std::numeric_limits<int>::max();
           const auto* initial_max_reducebcast_msg_size_cstr = std::getenv("MAD_MAX_REDUCEBCAST_MSG_SIZE");
@@ -650,14 +713,28 @@ namespace madness {
           return result;
         }
 
+        static FenceMode initial_fence_mode() {
+          const char* mad_fence_mode = std::getenv("MAD_FENCE_MODE");
+          if (mad_fence_mode && std::string(mad_fence_mode) == "wave")
+            return FenceMode::wave;
+          return FenceMode::tree;
+        }
+
     public:
 
         // In the World constructor can ONLY rely on MPI and MPI being initialized
         WorldGopInterface(World& world) :
-            world_(world), deferred_(new detail::DeferredCleanup()), debug_(false), max_reducebcast_msg_size_(initial_max_reducebcast_msg_size())
+            world_(world), deferred_(new detail::DeferredCleanup()), debug_(false), max_reducebcast_msg_size_(initial_max_reducebcast_msg_size()),
+            fence_mode_(initial_fence_mode())
         { }
 
         ~WorldGopInterface() {
+            {
+                ScopedMutex<PthreadConditionVariable> obolus(async_fence_cv_);
+                async_fence_stop_ = true;
+                async_fence_cv_.signal();
+            }
+            if (async_fence_thread_.joinable()) async_fence_thread_.join();
             deferred_->destroy(true);
             deferred_->do_cleanup();
         }
@@ -696,6 +773,46 @@ namespace madness {
           return max_reducebcast_msg_size_;
         }
 
+        /// Set how fence() detects termination and return the previous mode
+
+        /// The initial mode is \c FenceMode::tree unless environment
+        /// variable \c MAD_FENCE_MODE is "wave".  Every process must use
+        /// the same mode.  In wave mode the message counts go up the
+        /// process tree as in tree mode, together with a mark set by any
+        /// process that received messages since its part in the previous
+        /// wave.  An unmarked wave with as many messages received as sent
+        /// proves termination on its own, so process 0 only broadcasts a
+        /// yes/no verdict rather than the sums, and an idle world needs one
+        /// wave where the tree needs two agreeing passes.  A wave costs a
+        /// pass up and down the tree, logarithmic in the number of
+        /// processes.  fence_async() always uses the tree.
+        /// \param[in] mode the new mode
+        /// \return the previous mode
+        FenceMode set_fence_mode(FenceMode mode) {
+          std::swap(fence_mode_, mode);
+          return mode;
+        }
+
+        /// Returns how fence() detects termination
+        FenceMode fence_mode() const { return fence_mode_; }
+
+        /// Returns the latency statistics of the fences of this world
+
+        /// Passes and wall time are counted from entering termination
+        /// detection, after local work has been submitted, until this
+        /// process knows that all processes are done; the epilogue and
+        /// cleanup are not included.  Async fences are included.
+        FenceStats get_fence_stats() const {
+          ScopedMutex<Mutex> obolus(fence_stats_mutex_);
+          return fence_stats_;
+        }
+
+        /// Resets the fence statistics of this world
+        void reset_fence_stats() {
+          ScopedMutex<Mutex> obolus(fence_stats_mutex_);
+          fence_stats_ = FenceStats();
+        }
+
         /// Synchronizes all processes in communicator ... does NOT fence pending AM or tasks
         void barrier() {
             long i = world_.rank();
@@ -716,6 +833,24 @@ namespace madness {
         /// \param[in] debug set to true to print progress statistics using madness::print(); the default is false.
         void fence(bool debug = false);
 
+        /// Starts a fence and returns without waiting for it
+
+        /// The termination detection of fence() runs on a detector thread,
+        /// one per world that serves the async fences in order, while the
+        /// caller goes on, e.g., to submit the next independent
+        /// operation.  The returned future is set once all processes have
+        /// reached global quiescence.  Tasks and active messages submitted
+        /// before the call have completed by then, as have any submitted
+        /// after it, since the two cannot be told apart.  Every process
+        /// must call fence_async() and fence() in the same order.
+        ///
+        /// Unlike fence(), deferred cleanup is left to the next fence()
+        /// since objects released after the call may still be the target
+        /// of messages.
+        /// \param[in] debug set to true to print progress statistics using madness::print(); the default is false.
+        /// \return A future set to true when the fence completes
+        Future<bool> fence_async(bool debug = false);
+
         /// Executes an action on single (this) thread after ensuring all other work is done
 
         /// \param[in] action the action to execute (by the calling thread)
@@ -783,8 +918,9 @@ namespace madness {
             void reduce(T* buf, std::size_t nelem, opT op) {
           static_assert(madness::is_trivially_copyable_v<T>, "T must be trivially copyable");
 
-          ProcessID parent, child0, child1;
-          world_.mpi.binary_tree_info(0, parent, child0, child1);
+          ProcessID parent;
+          std::vector<ProcessID> child;
+          world_.mpi.tree_info(0, parent, child);
           const std::size_t nelem_per_maxmsg =
               max_reducebcast_msg_size() / sizeof(T);
 
@@ -816,41 +952,28 @@ namespace madness {
 #endif
           };
 
-          sptr_t buf0;
-          if (child0 != -1)
-            buf0 = sptr_t(aligned_buf_alloc(),
-                          free_dtor{});
-          sptr_t buf1(nullptr);
-          if (child1 != -1)
-            buf1 = sptr_t(aligned_buf_alloc(),
-                          free_dtor{});
+          std::vector<sptr_t> bufc;
+          for (std::size_t c = 0; c < child.size(); ++c)
+            bufc.emplace_back(aligned_buf_alloc(), free_dtor{});
 
           auto reduce_impl = [&,this](T* buf, size_t nelem) {
             MADNESS_ASSERT(nelem <= nelem_per_maxmsg);
-            SafeMPI::Request req0, req1;
+            std::vector<SafeMPI::Request> req(child.size());
             Tag gsum_tag = world_.mpi.unique_tag();
 
-            if (child0 != -1)
-              req0 = world_.mpi.Irecv(buf0.get(), nelem * sizeof(T), MPI_BYTE,
-                                      child0, gsum_tag);
-            if (child1 != -1)
-              req1 = world_.mpi.Irecv(buf1.get(), nelem * sizeof(T), MPI_BYTE,
-                                      child1, gsum_tag);
+            for (std::size_t c = 0; c < child.size(); ++c)
+              req[c] = world_.mpi.Irecv(bufc[c].get(), nelem * sizeof(T), MPI_BYTE,
+                                        child[c], gsum_tag);
 
-            if (child0 != -1) {
-              World::await(req0);
-              for (long i = 0; i < (long)nelem; ++i)
-                buf[i] = op(buf[i], buf0[i]);
-            }
-            if (child1 != -1) {
-              World::await(req1);
+            for (std::size_t c = 0; c < child.size(); ++c) {
+              World::await(req[c]);
               for (long i = 0; i < (long)nelem; ++i)
-                buf[i] = op(buf[i], buf1[i]);
+                buf[i] = op(buf[i], bufc[c][i]);
             }
 
             if (parent != -1) {
-              req0 = world_.mpi.Isend(buf, nelem * sizeof(T), MPI_BYTE, parent,
-                                      gsum_tag);
+              SafeMPI::Request req0 = world_.mpi.Isend(buf, nelem * sizeof(T), MPI_BYTE, parent,
+                                                       gsum_tag);
               World::await(req0);
             }
 
@@ -35,6 +35,9 @@
 */
 
 #include <madness/world/worldmpi.h>
+#include <algorithm>
+#include <map>
+#include <sstream>
 
 namespace madness {
     namespace detail {
@@ -49,6 +52,8 @@ namespace madness {
         /// \todo Verify the above brief description.
         bool WorldMpi::own_mpi = false;
 
+        std::vector<int> WorldMpi::node_leader;
+
 #ifdef MADNESS_USE_BSEND_ACKS
         /// MPI buffer.
         char* WorldMpi::mpi_ack_buffer[MADNESS_ACK_BUFF_SIZE];
@@ -57,4 +62,120 @@ namespace madness {
         /// @}
 
     } // namespace detail
+
+    namespace {
+        /// Ranks per node from \c MAD_GOP_NODE_SIZE, -1 to detect them
+        int gop_node_size() {
+            int node_size = -1;
+            const char* mad_gop_node_size = std::getenv("MAD_GOP_NODE_SIZE");
+            if (mad_gop_node_size) {
+                std::stringstream ss(mad_gop_node_size);
+                ss >> node_size;
+            }
+            return node_size;
+        }
+    } // namespace
+
+    void detail::WorldMpi::init_node_leader() {
+        const SafeMPI::Intracomm& world = SafeMPI::COMM_WORLD;
+        const int np = world.Get_size();
+        node_leader.clear();
+        if (np == 1 || gop_node_size() >= 0) return;
+
+        SafeMPI::Intracomm node_comm = world.Split_type(SafeMPI::Intracomm::SHARED_SPLIT_TYPE, world.Get_rank());
+        int my_leader = world.Get_rank();
+        node_comm.Bcast(&my_leader, 1, MPI_INT, 0);
+        std::vector<int> mine(np, 0);
+        node_leader.assign(np, 0);
+        mine[world.Get_rank()] = my_leader;
+        world.Allreduce(mine.data(), node_leader.data(), np, MPI_INT, MPI_SUM);
+    }
+
+    void WorldMpiInterface::init_node_layout() {
+        const int np = size();
+        if (np == 1) return;
+
+        const int node_size = gop_node_size();
+        if (node_size == 0) return;
+
+        // Label each rank by the lowest rank (in COMM_WORLD unless node_size
+        // is given) on its node
+        std::vector<int> leader(np, 0);
+        if (node_size > 0) {
+            for (int p=0; p<np; ++p) leader[p] = p - p%node_size;
+        }
+        else {
+            const std::vector<int>& world_leader = detail::WorldMpi::node_leaders();
+            if (world_leader.empty()) return;
+            std::vector<int> ranks(np);
+            for (int p=0; p<np; ++p) ranks[p] = p;
+            Get_group().Translate_ranks(np, ranks.data(), SafeMPI::COMM_WORLD.Get_group(), leader.data());
+            for (int p=0; p<np; ++p) {
+                MADNESS_ASSERT(leader[p] >= 0 && leader[p] < int(world_leader.size()));
+                leader[p] = world_leader[leader[p]];
+            }
+        }
+
+        std::vector<int> node_of(np);
+        std::vector<std::vector<int>> node_ranks;
+        std::map<int,int> index_of_leader;
+        for (int p=0; p<np; ++p) {
+            const int n = index_of_leader.emplace(leader[p], node_ranks.size()).first->second;
+            if (n == int(node_ranks.size())) node_ranks.emplace_back();
+            node_of[p] = n;
+            node_ranks[n].push_back(p);
+        }
+
+        // With one node, or one rank per node, the plain binary tree is the same thing
+        if (node_ranks.size() == 1 || int(node_ranks.size()) == np) return;
+
+        node_of_.swap(node_of);
+        node_ranks_.swap(node_ranks);
+    }
+
+    void WorldMpiInterface::node_tree_info(const std::vector<int>& node_of,
+                                           const std::vector<std::vector<int>>& node_ranks,
+                                           ProcessID me, ProcessID root,
+                                           ProcessID& parent, std::vector<ProcessID>& child) {
+        const int nn = node_ranks.size();
+        const int root_node = node_of[root];
+        const int my_node = node_of[me];
+        child.clear();
+
+        // The local root of a node is root on its node and the lowest rank elsewhere
+        auto local_root = [&](int node) {
+            return node == root_node ? root : node_ranks[node][0];
+        };
+
+        // Across nodes ... only local roots take part
+        parent = -1;
+        if (me == local_root(my_node)) {
+            const int j = (my_node - root_node + nn) % nn; // Renumber nodes so root's node is 0
+            if (j) parent = local_root(((j-1)/2 + root_node) % nn);
+            for (int c=2*j+1; c<=2*j+2 && c<nn; ++c)
+                child.push_back(local_root((c + root_node) % nn));
+        }
+
+        // Within the node
+        const std::vector<int>& ranks = node_ranks[my_node];
+        const int m = ranks.size();
+        const int r0 = std::lower_bound(ranks.begin(), ranks.end(), local_root(my_node)) - ranks.begin();
+        const int i = ((std::lower_bound(ranks.begin(), ranks.end(), me) - ranks.begin()) - r0 + m) % m;
+        if (i) parent = ranks[((i-1)/2 + r0) % m];
+        for (int c=2*i+1; c<=2*i+2 && c<m; ++c)
+            child.push_back(ranks[(c + r0) % m]);
+    }
+
+    void WorldMpiInterface::tree_info(ProcessID root, ProcessID& parent, std::vector<ProcessID>& child) {
+        if (node_ranks_.empty()) {
+            ProcessID child0, child1;
+            binary_tree_info(root, parent, child0, child1);
+            child.clear();
+            if (child0 != -1) child.push_back(child0);
+            if (child1 != -1) child.push_back(child1);
+        }
+        else {
+            node_tree_info(node_of_, node_ranks_, rank(), root, parent, child);
+        }
+    }
 } // namespace madness
@@ -55,6 +55,7 @@
 #include <madness/world/safempi.h>
 #include <madness/world/worldtypes.h>
 #include <cstdlib>
+#include <vector>
 
 /// \addtogroup mpi
 /// @{
@@ -104,6 +105,7 @@ namespace madness {
             /// last world object is destroyed.
             static std::shared_ptr<WorldMpi> world_mpi;
             static bool own_mpi; ///< \todo Brief description needed.
+            static std::vector<int> node_leader; ///< Lowest rank in \c COMM_WORLD on the node of each rank in \c COMM_WORLD
 
 #ifdef MADNESS_USE_BSEND_ACKS
             /// Acknowledgment buffer.
@@ -228,8 +230,22 @@ namespace madness {
                     MPI_Abort(MPI_COMM_WORLD, 1);
                 }
 #endif // defined(MVAPICH2_VERSION)
+
+                init_node_leader();
             }
 
+            /// Finds which ranks of \c COMM_WORLD share a node (collective over \c COMM_WORLD)
+
+            /// Done once, the node layout of every other communicator is
+            /// derived from it without communication.  Skipped if
+            /// \c MAD_GOP_NODE_SIZE is set.
+            static void init_node_leader();
+
+            /// Lowest rank in \c COMM_WORLD on the node of each rank in \c COMM_WORLD
+
+            /// \return the leaders, or an empty vector if they were not detected
+            static const std::vector<int>& node_leaders() { return node_leader; }
+
             /// Finalize the MPI runtime.
 
             /// This function starts the teardown process of the MPI runtime.
@@ -265,18 +281,28 @@ namespace madness {
         : private detail::WorldMpiRuntime, public SafeMPI::Intracomm
     {
 
+        std::vector<int> node_of_;               ///< Node index of each rank, empty if the tree is not node-aware
+        std::vector<std::vector<int>> node_ranks_; ///< Ranks on each node in increasing order
+
         // Not allowed
         WorldMpiInterface(const WorldMpiInterface&) = delete;
         WorldMpiInterface& operator=(const WorldMpiInterface&) = delete;
 
+        /// Determines which ranks share a node from WorldMpi::node_leaders()
+        void init_node_layout();
+
     public:
         /// Constructs an interface in the specified \c SafeMPI communicator.
 
-        /// \todo Verify this documentation.
+        /// Which processes share a node (see tree_info()) is looked up in the
+        /// layout of \c COMM_WORLD found at initialization, so this does not
+        /// communicate.
         /// \param[in] comm The communicator.
         WorldMpiInterface(const SafeMPI::Intracomm& comm) :
             detail::WorldMpiRuntime(), SafeMPI::Intracomm(comm)
-        { }
+        {
+            init_node_layout();
+        }
 
         ~WorldMpiInterface() = default;
 
@@ -447,6 +473,38 @@ namespace madness {
 
         /// \return The number of processes.
         int size() const { return SafeMPI::Intracomm::Get_size(); }
+
+        /// Number of nodes used by the collective tree (1 if it is not node-aware)
+        int nnode() const { return node_ranks_.empty() ? 1 : int(node_ranks_.size()); }
+
+        /// Parent and children of this process in the tree used by collectives
+
+        /// If processes share nodes the tree has two levels: a binary tree
+        /// over the ranks of each node rooted at its lowest rank (or \c root
+        /// on the node of \c root), and a binary tree over nodes linking
+        /// those local roots.  Only the latter sends messages between
+        /// nodes, so a collective crosses the network nnode()-1 times rather
+        /// than about size() times.  Otherwise, or if \c MAD_GOP_NODE_SIZE
+        /// is 0, this is the binary tree of \c binary_tree_info().  Setting
+        /// \c MAD_GOP_NODE_SIZE to n>0 treats each n consecutive ranks as a
+        /// node.
+        /// \param[in] root The root of the tree.
+        /// \param[out] parent The parent of this process (-1 for \c root).
+        /// \param[out] child The children of this process (at most 4).
+        void tree_info(ProcessID root, ProcessID& parent, std::vector<ProcessID>& child);
+
+        /// Parent and children of \c me in the two-level tree for an arbitrary node layout
+
+        /// \param[in] node_of The node index of each rank.
+        /// \param[in] node_ranks The ranks on each node in increasing order.
+        /// \param[in] me The process of interest.
+        /// \param[in] root The root of the tree.
+        /// \param[out] parent The parent of \c me (-1 for \c root).
+        /// \param[out] child The children of \c me.
+        static void node_tree_info(const std::vector<int>& node_of,
+                                   const std::vector<std::vector<int>>& node_ranks,
+                                   ProcessID me, ProcessID root,
+                                   ProcessID& parent, std::vector<ProcessID>& child);
     }; // class WorldMpiInterface
 
 }
@@ -42,7 +42,9 @@
 #include <list>
 #include <memory>
 #include <atomic>
+#include <cstring>
 #include <madness/world/safempi.h>
+#include <madness/world/node_shared_segment.h>
 #include <madness/world/archive.h>
 
 namespace madness {
@@ -51,6 +53,7 @@ namespace madness {
     RMIStats RMI::stats;
     bool RMI::debugging = false;
     std::list< std::unique_ptr<RMISendReq> > RMI::send_req;
+    std::atomic<void (*)()> RMI::poll_hook{nullptr};
 
     bool& RMI::is_server_thread_accessor() {
       static thread_local bool is_server_thread = false;
@@ -70,13 +73,15 @@ namespace madness {
 
         // Now that the server thread doing other stuff (including being
         // responsible for its own outbound messages) we have to poll.
-        int narrived = 0, iterations = 0;
+        int narrived = 0, nshm = 0, iterations = 0;
 
         MutexWaiter waiter;
         while((narrived == 0) && (iterations < 1000)) {
           narrived = SafeMPI::Request::Testsome(maxq_, recv_req.get(), ind.get(), status.get());
-          if (narrived) break;
+          if (shm_size_) nshm = shm_process();
+          if (narrived || nshm) break;
           ++iterations;
+          call_poll_hook();
           clear_send_req();
           myusleep(RMI::testsome_backoff_us);
         }
@@ -88,7 +93,7 @@ namespace madness {
         if (print_debug_info && narrived > 0)
             print_error(rank, ":RMI: ", narrived, " messages just arrived\n");
 
-        if (narrived) {
+        if (narrived || nshm) {
             for (int m=0; m<narrived; ++m) {
                 const int src = status[m].Get_source();
                 const size_t len = status[m].Get_count(MPI_BYTE);
@@ -130,40 +135,7 @@ namespace madness {
                 }
             }
 
-            // Only ordered messages can end up in the queue due to
-            // out-of-order receipt or order of recv buffer processing.
-
-            // Sort queued messages by source and ascending (modulo overflow) recv count
-            std::sort(q.get(),q.get()+n_in_q);
-
-            // Loop thru messages ... since we have sorted only one pass
-            // is necessary and if we cannot process a message we
-            // save it at the beginning of the queue
-            int nleftover = 0;
-            for (int m=0; m<n_in_q; ++m) {
-                const int src = q[m].src;
-                if (q[m].count == recv_counters[src]) {
-                  if (print_debug_info)
-                    print_error(rank, ":RMI: queue invoking from=", src,
-                                " nbyte=", q[m].len, " func=", q[m].func,
-                                " ordered=", is_ordered(q[m].attr),
-                                " count=", q[m].count, "\n");
-
-                  ++(recv_counters[src]);
-                  q[m].func(recv_buf[q[m].i], q[m].len);
-                  post_recv_buf(q[m].i);
-                }
-                else {
-                    q[nleftover++] = q[m];
-                    if (print_debug_info)
-                      print_error(rank,
-                                  ":RMI: queue pending out of order from=", src,
-                                  " nbyte=", q[m].len, " func=", q[m].func,
-                                  " ordered=", is_ordered(q[m].attr),
-                                  " count=", q[m].count, "\n");
-                }
-            }
-            n_in_q = nleftover;
+            process_queue();
 
             post_pending_huge_msg();
 
@@ -173,10 +145,195 @@ namespace madness {
             // aggregates task submission.
             ThreadPool::instance()->flush_prebuf();
 #endif
+            call_poll_hook();
             clear_send_req();
         }
     }
 
+    void RMI::RmiTask::process_queue() {
+        const bool print_debug_info = RMI::debugging;
+
+        // Only ordered messages can end up in the queue due to
+        // out-of-order receipt or order of recv buffer processing.
+
+        // Sort queued messages by source and ascending (modulo overflow) recv count
+        std::sort(q.get(),q.get()+n_in_q);
+
+        // Loop thru messages ... since we have sorted only one pass
+        // is necessary and if we cannot process a message we
+        // save it at the beginning of the queue
+        int nleftover = 0;
+        for (int m=0; m<n_in_q; ++m) {
+            const int src = q[m].src;
+            if (q[m].count == recv_counters[src]) {
+              if (print_debug_info)
+                print_error(rank, ":RMI: queue invoking from=", src,
+                            " nbyte=", q[m].len, " func=", q[m].func,
+                            " ordered=", is_ordered(q[m].attr),
+                            " count=", q[m].count, "\n");
+
+              ++(recv_counters[src]);
+              q[m].func(recv_buf[q[m].i], q[m].len);
+              post_recv_buf(q[m].i);
+            }
+            else {
+                q[nleftover++] = q[m];
+                if (print_debug_info)
+                  print_error(rank,
+                              ":RMI: queue pending out of order from=", src,
+                              " nbyte=", q[m].len, " func=", q[m].func,
+                              " ordered=", is_ordered(q[m].attr),
+                              " count=", q[m].count, "\n");
+            }
+        }
+        n_in_q = nleftover;
+    }
+
+    int RMI::RmiTask::shm_process() {
+        int n = 0;
+        for (ProcessID src : shm_peers_) {
+            ShmRing* r = shm_ring(src, rank);
+            unsigned char* data = r->data();
+            std::uint64_t tail = r->tail.load(std::memory_order_relaxed);
+
+            // Take a bounded number from each source so none is starved
+            for (std::size_t m=0; m<maxq_; ++m) {
+                if (tail == r->head.load(std::memory_order_acquire)) break;
+
+                const std::uint64_t pos = tail % shm_size_;
+                const std::uint64_t len = *reinterpret_cast<const std::uint64_t*>(data + pos);
+                if (len == SHM_WRAP) {
+                    tail += shm_size_ - pos;
+                    r->tail.store(tail, std::memory_order_release);
+                    continue;
+                }
+
+                void* buf = data + pos + HEADER_LEN;
+                const header* h = (const header*)(buf);
+                rmi_handlerT func = archive::to_abs_fn_ptr<rmi_handlerT>(h->func);
+                const attrT attr = h->attr;
+                const counterT count = (attr>>16);
+
+                // An earlier message from src went by MPI and has not been
+                // invoked yet ... leave this one in the ring until it is
+                if (is_ordered(attr) && count != recv_counters[src]) break;
+
+                ++(RMI::stats.nmsg_recv);
+                ++(RMI::stats.nmsg_shm_recv);
+                RMI::stats.nbyte_recv += len;
+
+                if (RMI::debugging)
+                  print_error(rank, ":RMI: invoking from shm src=", src,
+                              " nbyte=", len, " func=", func,
+                              " ordered=", is_ordered(attr),
+                              " count=", count, "\n");
+
+                if (is_ordered(attr)) ++(recv_counters[src]);
+                func(buf, len);
+
+                // The handler is done with the record so the sender may reuse it
+                tail += HEADER_LEN + ((len + ALIGNMENT - 1)/ALIGNMENT)*ALIGNMENT;
+                r->tail.store(tail, std::memory_order_release);
+                ++n;
+            }
+        }
+        return n;
+    }
+
+    bool RMI::RmiTask::shm_send(const void* buf, size_t nbyte_buf, size_t nbyte, ProcessID dest,
+                                const Insert* insert, int ninsert) {
+        const std::uint64_t rec = HEADER_LEN + ((nbyte + ALIGNMENT - 1)/ALIGNMENT)*ALIGNMENT;
+        if (rec > shm_size_/2) return false;
+
+        // The caller holds the lock so this is the only writer of head
+        ShmRing* r = shm_ring(rank, dest);
+        std::uint64_t head = r->head.load(std::memory_order_relaxed);
+        const std::uint64_t tail = r->tail.load(std::memory_order_acquire);
+        std::uint64_t pos = head % shm_size_;
+        const std::uint64_t skip = (shm_size_ - pos < rec) ? shm_size_ - pos : 0;
+        if (head + skip + rec - tail > shm_size_) return false; // Full ... rather than wait let MPI carry it
+
+        unsigned char* data = r->data();
+        if (skip) {
+            *reinterpret_cast<std::uint64_t*>(data + pos) = SHM_WRAP;
+            head += skip;
+            pos = 0;
+        }
+        *reinterpret_cast<std::uint64_t*>(data + pos) = nbyte;
+
+        // Gather the buffer and the inserted blocks into the record
+        unsigned char* p = data + pos + HEADER_LEN;
+        const unsigned char* b = static_cast<const unsigned char*>(buf);
+        size_t done = 0;
+        for (int k=0; k<ninsert; ++k) {
+            std::memcpy(p, b + done, insert[k].offset - done);
+            p += insert[k].offset - done;
+            done = insert[k].offset;
+            std::memcpy(p, insert[k].ptr, insert[k].nbyte);
+            p += insert[k].nbyte;
+        }
+        std::memcpy(p, b + done, nbyte_buf - done);
+
+        r->head.store(head + rec, std::memory_order_release);
+        return true;
+    }
+
+    void RMI::RmiTask::init_shm() {
+        // Get the ring size from the MAD_RMI_SHM environment variable (unset
+        // or 0 disables).
+        const char* mad_rmi_shm = getenv("MAD_RMI_SHM");
+        if (!mad_rmi_shm || nproc == 1) return;
+        std::size_t size = cstr_to_memory_size(mad_rmi_shm);
+        if (size == 0) return;
+        if (size < MIN_SHM_SIZE) {
+            size = MIN_SHM_SIZE;
+            if (rank == 0)
+                print_error("!!! WARNING: MAD_RMI_SHM must be at least ", size, " bytes.\n",
+                            "!!! WARNING: Increasing MAD_RMI_SHM to ", size, " bytes.\n");
+        }
+
+        SafeMPI::Intracomm node = comm.Split_type(SafeMPI::Intracomm::SHARED_SPLIT_TYPE, rank);
+        const int nlocal = node.Get_size();
+        const int me = node.Get_rank();
+        if (nlocal == 1) return;
+
+        // Every ordered pair of local processes has a ring, so the segment
+        // grows as nlocal^2 ... keep it within MAX_SHM_TOTAL
+        const std::size_t nring = std::size_t(nlocal)*nlocal;
+        const std::size_t maxsize = std::max(MAX_SHM_TOTAL/nring, std::size_t(MIN_SHM_SIZE));
+        if (size > maxsize) {
+            if (me == 0)
+                print_error("!!! WARNING: MAD_RMI_SHM of ", size, " bytes for ", nlocal, " processes per node exceeds ",
+                            std::size_t(MAX_SHM_TOTAL), " bytes of shared memory.\n",
+                            "!!! WARNING: Reducing MAD_RMI_SHM to ", maxsize, " bytes.\n");
+            size = maxsize;
+        }
+        size = ((size + ALIGNMENT - 1)/ALIGNMENT)*ALIGNMENT;
+
+        // Rank in comm of each process on this node
+        std::vector<int> mine(nlocal, 0), local(nlocal, 0);
+        mine[me] = rank;
+        node.Allreduce(mine.data(), local.data(), nlocal, MPI_INT, MPI_SUM);
+
+        const std::size_t len = std::size_t(nlocal)*nlocal*(sizeof(ShmRing) + size);
+        unsigned char* base = map_node_shared_segment(node, node, "rmi", len, true);
+        if (!base) {
+            if (me == 0)
+                print_error("!!! WARNING: could not map ", len, " bytes of shared memory for MAD_RMI_SHM.\n",
+                            "!!! WARNING: RMI will use only MPI on this node.\n");
+            return;
+        }
+
+        shm_base_ = base;
+        shm_len_ = len;
+        shm_local_.assign(nproc, -1);
+        for (int i=0; i<nlocal; ++i) {
+            shm_local_[local[i]] = i;
+            if (local[i] != rank) shm_peers_.push_back(local[i]);
+        }
+        shm_size_ = size;
+    }
+
     void RMI::RmiTask::post_pending_huge_msg() {
         if (recv_buf[nrecv_]) return;      // Message already pending
         if (!hugeq.empty()) {
@@ -220,6 +377,7 @@ namespace madness {
         //             }
         //         }
         //for (int i=0; i<nrecv_; ++i) free(recv_buf[i]);
+        if (shm_base_) unmap_node_shared_segment(shm_base_, shm_len_);
     }
 
     static std::atomic<bool> rmi_task_is_running = false;
@@ -234,12 +392,16 @@ namespace madness {
             , max_msg_len_(DEFAULT_MAX_MSG_LEN)
             , nrecv_(DEFAULT_NRECV)
             , maxq_(DEFAULT_NRECV + 1)
+            , zerocopy_min_(DEFAULT_ZEROCOPY_MIN)
             , recv_buf()
             , recv_req()
             , status()
             , ind()
             , q()
             , n_in_q(0)
+            , shm_size_(0)
+            , shm_len_(0)
+            , shm_base_(nullptr)
     {
         // Get the maximum buffer size from the MAD_BUFFER_SIZE environment
         // variable.
@@ -294,6 +456,13 @@ namespace madness {
             }
         }
 
+        // Get the smallest block sent in place from the MAD_AM_ZEROCOPY
+        // environment variable (0, the default, disables).
+        const char* mad_am_zerocopy = getenv("MAD_AM_ZEROCOPY");
+        if (mad_am_zerocopy) {
+            zerocopy_min_ = cstr_to_memory_size(mad_am_zerocopy);
+        }
+
         // Allocate memory for receive buffer and requests
         recv_buf.reset(new void*[maxq_]);
         recv_req.reset(new Request[maxq_]);
@@ -319,6 +488,8 @@ namespace madness {
             }
             recv_buf[nrecv_] = 0;
         }
+
+        init_shm();
     }
 
 
@@ -413,7 +584,12 @@ namespace madness {
     }
 
     RMI::Request
-    RMI::RmiTask::RmiTask::isend(const void* buf, size_t nbyte, ProcessID dest, rmi_handlerT func, attrT attr) {
+    RMI::RmiTask::RmiTask::isend(const void* buf, size_t nbyte, ProcessID dest, rmi_handlerT func, attrT attr,
+                                 const Insert* insert, int ninsert) {
+
+        // The receiver sees the buffer with the blocks inserted
+        const size_t nbyte_buf = nbyte;
+        for (int k=0; k<ninsert; ++k) nbyte += insert[k].nbyte;
 
         MADNESS_ASSERT(nbyte <= std::numeric_limits<int>::max());
 
@@ -440,7 +616,7 @@ namespace madness {
             waiter.reset();
             while (!req_ack.Test()) waiter.wait();
         }
-        else if (nbyte < HEADER_LEN) {
+        else if (nbyte_buf < HEADER_LEN) {
             MADNESS_EXCEPTION("RMI::isend --- your buffer is too small to hold the header", static_cast<int>(nbyte));
         }
 
@@ -469,17 +645,60 @@ namespace madness {
         ++(RMI::stats.nmsg_sent);
         RMI::stats.nbyte_sent += nbyte;
 
+        // A process on this node can take the message straight from a
+        // ring, unless it is huge (then it was announced by MPI above)
+        if (shm_size_ && dest != rank && nbyte <= max_msg_len_ && shm_local_[dest] >= 0 &&
+            shm_send(buf, nbyte_buf, nbyte, dest, insert, ninsert)) {
+            ++(RMI::stats.nmsg_shm_sent);
+            unlock();
+            return Request(); // Copied already, so complete
+        }
+
+
+        // Blocks are sent in place by describing the whole message as
+        // a datatype of absolute addresses
+        const void* sendbuf = buf;
+        int count = nbyte;
+        MPI_Datatype datatype = MPI_BYTE;
+        if (ninsert) {
+            const int nblock = 2*ninsert + 1;
+            std::unique_ptr<int[]> len(new int[nblock]);
+            std::unique_ptr<MPI_Aint[]> disp(new MPI_Aint[nblock]);
+            const char* p = static_cast<const char*>(buf);
+            size_t done = 0; // Bytes of buf already described
+            int n = 0;
+            for (int k=0; k<ninsert; ++k) {
+                MADNESS_ASSERT(insert[k].offset >= std::max(done, size_t(HEADER_LEN)) && insert[k].offset <= nbyte_buf);
+                if (insert[k].offset > done) {
+                    disp[n] = SafeMPI::Get_address(p + done);
+                    len[n++] = insert[k].offset - done;
+                    done = insert[k].offset;
+                }
+                disp[n] = SafeMPI::Get_address(insert[k].ptr);
+                len[n++] = insert[k].nbyte;
+            }
+            if (nbyte_buf > done) {
+                disp[n] = SafeMPI::Get_address(p + done);
+                len[n++] = nbyte_buf - done;
+            }
+            sendbuf = MPI_BOTTOM;
+            count = 1;
+            datatype = SafeMPI::Type_create_hindexed(n, len.get(), disp.get(), MPI_BYTE);
+        }
 
         numsent++;
         Request result;
         if (nssend_ && numsent==std::size_t(nssend_)) {
-            result = comm.Issend(buf, nbyte, MPI_BYTE, dest, tag);
+            result = comm.Issend(sendbuf, count, datatype, dest, tag);
             numsent %= nssend_;
         }
         else {
-            result = comm.Isend(buf, nbyte, MPI_BYTE, dest, tag);
+            result = comm.Isend(sendbuf, count, datatype, dest, tag);
         }
 
+        // MPI keeps the datatype alive until the send completes
+        if (ninsert) SafeMPI::Type_free(datatype);
+
         unlock();
 
         return result;
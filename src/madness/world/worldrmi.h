@@ -39,8 +39,10 @@
 #include <sstream>
 #include <utility>
 #include <list>
+#include <atomic>
 #include <memory>
 #include <tuple>
+#include <vector>
 #include <pthread.h>
 #include <madness/world/print.h>
 
@@ -150,9 +152,12 @@ namespace madness {
         uint64_t nmsg_recv;
         uint64_t nbyte_recv;
         uint64_t max_serv_send_q;
+        uint64_t nmsg_shm_sent;  ///< Messages of nmsg_sent that went through shared memory
+        uint64_t nmsg_shm_recv;  ///< Messages of nmsg_recv that came through shared memory
 
         RMIStats()
-            : nmsg_sent(0), nbyte_sent(0), nmsg_recv(0), nbyte_recv(0), max_serv_send_q(0) {}
+            : nmsg_sent(0), nbyte_sent(0), nmsg_recv(0), nbyte_recv(0), max_serv_send_q(0)
+            , nmsg_shm_sent(0), nmsg_shm_recv(0) {}
     };
 
     /// This for RMI server thread to manage lifetime of WorldAM messages that it is sending
@@ -187,8 +192,29 @@ namespace madness {
 
         static std::list< std::unique_ptr<RMISendReq> > send_req; // List of outstanding world active messages sent by the server
 
+        /// A block of a message that is sent directly from where it lives rather than from the message buffer
+        struct Insert {
+            std::size_t offset; ///< Offset in the message buffer at which the block is inserted
+            const void* ptr;    ///< The block (do not modify until send is completed)
+            std::size_t nbyte;  ///< Size of the block in bytes
+        };
+
+        /// Sets a function the server thread calls whenever it polls for messages (null for none)
+
+        /// Used by the active message layer to send aggregated messages
+        /// that have waited too long.  The hook runs on the server thread
+        /// so it must not block.
+        static void set_poll_hook(void (*hook)()) { poll_hook = hook; }
+
     private:
 
+        static std::atomic<void (*)()> poll_hook;
+
+        static void call_poll_hook() {
+            void (*hook)() = poll_hook.load(std::memory_order_acquire);
+            if (hook) hook();
+        }
+
         static void clear_send_req() {
             //std::cout << "clearing server messages " << pthread_self() << std::endl;
             stats.max_serv_send_q = std::max(stats.max_serv_send_q,uint64_t(send_req.size()));
@@ -229,6 +255,7 @@ namespace madness {
             std::size_t nrecv_;
             long nssend_;
             std::size_t maxq_;
+            std::size_t zerocopy_min_;
             std::unique_ptr<void*[]> recv_buf; // Will be at least ALIGNMENT aligned ... +1 for huge messages
             std::unique_ptr<SafeMPI::Request[]> recv_req;
 
@@ -237,6 +264,53 @@ namespace madness {
             std::unique_ptr<qmsg[]> q;
             int n_in_q;
 
+            /// Ring of messages from one process to another on the same node
+
+            /// The ring lives in memory shared by all processes on the node.
+            /// Only the sender moves \c head and only the receiver moves
+            /// \c tail, so no lock is shared between processes.  Each record
+            /// is an \c ALIGNMENT byte header holding the message length
+            /// followed by the message padded to \c ALIGNMENT.
+            struct ShmRing {
+                alignas(ALIGNMENT) std::atomic<std::uint64_t> head; ///< Bytes ever written
+                alignas(ALIGNMENT) std::atomic<std::uint64_t> tail; ///< Bytes ever consumed
+
+                /// The record data, which follows this header
+                unsigned char* data() { return reinterpret_cast<unsigned char*>(this) + sizeof(ShmRing); }
+            };
+
+            static const std::uint64_t SHM_WRAP = ~std::uint64_t(0); ///< Record length marking the unused end of a ring
+
+            std::size_t shm_size_;         ///< Capacity of each ring in bytes, 0 if not using shared memory
+            std::size_t shm_len_;          ///< Bytes mapped at shm_base_
+            unsigned char* shm_base_;      ///< All rings of this node
+            std::vector<int> shm_local_;   ///< Index on this node of each process, -1 if elsewhere
+            std::vector<ProcessID> shm_peers_; ///< Other processes on this node
+
+            /// Maps the rings shared with processes on the same node (collective)
+            void init_shm();
+
+            /// The ring carrying messages from \c src to \c dest (both on this node)
+            ShmRing* shm_ring(ProcessID src, ProcessID dest) const {
+                const std::size_t nlocal = shm_peers_.size() + 1;
+                return reinterpret_cast<ShmRing*>(shm_base_ +
+                    (shm_local_[src]*nlocal + shm_local_[dest])*(sizeof(ShmRing) + shm_size_));
+            }
+
+            /// Copies a message into the ring to \c dest if it has room
+
+            /// \return False if the message must go by MPI instead
+            bool shm_send(const void* buf, size_t nbyte_buf, size_t nbyte, ProcessID dest,
+                          const Insert* insert, int ninsert);
+
+            /// Invokes messages waiting in the rings to this process
+
+            /// \return The number of messages invoked
+            int shm_process();
+
+            /// Invokes queued out-of-order messages that are now in order
+            void process_queue();
+
             static inline bool is_ordered(attrT attr) { return attr & ATTR_ORDERED; }
 
             void process_some();
@@ -288,7 +362,8 @@ namespace madness {
 
             static void huge_msg_handler(void *buf, size_t nbytein);
 
-            Request isend(const void* buf, size_t nbyte, ProcessID dest, rmi_handlerT func, attrT attr);
+            Request isend(const void* buf, size_t nbyte, ProcessID dest, rmi_handlerT func, attrT attr,
+                          const Insert* insert=nullptr, int ninsert=0);
 
             void post_pending_huge_msg();
 
@@ -312,6 +387,9 @@ namespace madness {
 
         static const size_t DEFAULT_MAX_MSG_LEN = 3*512*1024;  //!< the default size of recv buffers, in bytes; the actual size can be configured by the user via envvar MAD_BUFFER_SIZE
         static const int DEFAULT_NRECV = 128;  //!< the default # of recv buffers; the actual number can be configured by the user via envvar MAD_RECV_BUFFERS
+        static const size_t DEFAULT_ZEROCOPY_MIN = 0;  //!< the default smallest block sent in place, 0 (always copy) until callers are known not to modify sent tensors in place; can be configured by the user via envvar MAD_AM_ZEROCOPY
+        static const size_t MIN_SHM_SIZE = 64*1024;  //!< the smallest shared-memory ring; rings are enabled by the user via envvar MAD_RMI_SHM
+        static const size_t MAX_SHM_TOTAL = size_t(1) << 30;  //!< the most shared memory all rings of a node may take; rings are shrunk to fit
 
         // Not allowed
         RMI(const RMI&);
@@ -333,6 +411,24 @@ namespace madness {
             return task_ptr->maxq_;
         }
 
+        /// Returns the smallest block worth sending in place rather than copying into a message
+
+        /// @return The size in bytes, 0 if blocks are always copied
+        /// @note The default value is given by RMI::DEFAULT_ZEROCOPY_MIN (0), can be overridden at runtime by the user via environment variable MAD_AM_ZEROCOPY (e.g., 16KB).
+        /// @warning Blocks sent in place are read when MPI sends them, not when the message is created; see new_am_arg().
+        static std::size_t zerocopy_min() {
+            return task_ptr ? task_ptr->zerocopy_min_ : 0;
+        }
+
+        /// Returns the capacity of each shared-memory ring between processes on the same node
+
+        /// @return The size in bytes, 0 if messages always go by MPI
+        /// @note Rings are off by default and are enabled by setting environment variable MAD_RMI_SHM to their size (e.g., "4MB", at least RMI::MIN_SHM_SIZE).  Messages to processes on the same node are then copied through the ring when it has room; larger messages and those to other nodes go by MPI.
+        /// @warning There is a ring for every ordered pair of processes on a node, so the node reserves nlocal*nlocal rings in /dev/shm up front (e.g., 16 GB for 64 processes with 4MB rings).  Rings are shrunk so that the total stays below RMI::MAX_SHM_TOTAL, but not below RMI::MIN_SHM_SIZE.
+        static std::size_t shm_size() {
+            return task_ptr ? task_ptr->shm_size_ : 0;
+        }
+
         /// Returns the number of recv buffers
 
         /// @return The number of recv buffers
@@ -362,6 +458,27 @@ namespace madness {
             return task_ptr->isend(buf, nbyte, dest, func, attr);
         }
 
+        /// Send a remote method invocation gathered from a buffer and separately stored blocks
+
+        /// The message received is the contents of \c buf with each block
+        /// inserted at its offset, so no copy of the blocks is made on this
+        /// end.  Offsets must be nondecreasing and beyond the header.
+        /// @param[in] buf Pointer to the data buffer (do not modify until send is completed)
+        /// @param[in] nbyte Size of the data buffer in bytes (not counting the blocks)
+        /// @param[in] insert The blocks to insert
+        /// @param[in] ninsert The number of blocks
+        /// @param[in] dest Process to receive the message
+        /// @param[in] func The function to handle the message on the remote end
+        /// @param[in] attr Attributes of the message (ATTR_UNORDERED or ATTR_ORDERED)
+        /// @return The status as an RMI::Request that presently is a SafeMPI::Request
+        static Request
+        isend(const void* buf, size_t nbyte, const Insert* insert, int ninsert,
+              ProcessID dest, rmi_handlerT func, unsigned int attr=ATTR_UNORDERED) {
+            if (!task_ptr)
+                MADNESS_EXCEPTION("!! MADNESS error: The RMI thread is not running", 0);
+            return task_ptr->isend(buf, nbyte, dest, func, attr, insert, ninsert);
+        }
+
         /// will complain to std::cerr and throw if ASLR is on by making
         /// sure that address of this function matches across @p comm
         /// @param[in] comm the communicator
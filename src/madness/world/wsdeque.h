@@ -0,0 +1,185 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+
+
+  $Id$
+*/
+
+#ifndef MADNESS_WORLD_WSDEQUE_H__INCLUDED
+#define MADNESS_WORLD_WSDEQUE_H__INCLUDED
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+/// \file wsdeque.h
+/// \brief Implements WorkStealingDeque
+
+namespace madness {
+
+    /// Lock-free single-owner work-stealing deque (Chase and Lev, 2005).
+
+    /// The owning thread pushes and pops at the bottom (LIFO) without
+    /// taking a lock; any other thread may steal from the top (FIFO),
+    /// contending only with other thieves and, for the last element, the
+    /// owner.  Memory orderings follow Le, Pop, Cohen and Zappa Nardelli
+    /// (PPoPP 2013).  The buffer grows as needed; old buffers are kept
+    /// until destruction since a thief might still be reading one.
+    ///
+    /// \c T must be trivially copyable (it is only used with pointers).
+    template <typename T>
+    class WorkStealingDeque {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "WorkStealingDeque holds trivially copyable values only");
+
+        struct Array {
+            const std::int64_t size; ///< Capacity, a power of two
+            std::atomic<T>* const buf;
+
+            explicit Array(std::int64_t size)
+                : size(size), buf(new std::atomic<T>[size]) {}
+            ~Array() { delete [] buf; }
+
+            T get(std::int64_t i) const {
+                return buf[i & (size-1)].load(std::memory_order_relaxed);
+            }
+            void put(std::int64_t i, T value) {
+                buf[i & (size-1)].store(value, std::memory_order_relaxed);
+            }
+        };
+
+        alignas(64) std::atomic<std::int64_t> top;    ///< Next element to steal
+        alignas(64) std::atomic<std::int64_t> bottom; ///< Next free slot of the owner
+        std::atomic<Array*> array;
+        std::vector<Array*> retired; ///< Outgrown buffers, touched only by the owner
+        std::atomic<std::uint64_t> npush; ///< #calls to push, written only by the owner
+        alignas(64) std::atomic<std::uint64_t> nsteal; ///< #successful steals
+
+        Array* grow(Array* a, std::int64_t b, std::int64_t t) {
+            Array* na = new Array(2*a->size);
+            for (std::int64_t i=t; i<b; ++i) na->put(i, a->get(i));
+            retired.push_back(a);
+            array.store(na, std::memory_order_release);
+            return na;
+        }
+
+    public:
+        WorkStealingDeque(std::size_t hint=1024)
+            : top(0), bottom(0), array(nullptr), npush(0), nsteal(0)
+        {
+            std::int64_t sz = 2;
+            while (sz < std::int64_t(hint)) sz *= 2;
+            array.store(new Array(sz), std::memory_order_relaxed);
+        }
+
+        WorkStealingDeque(const WorkStealingDeque&) = delete;
+        WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+        ~WorkStealingDeque() {
+            delete array.load(std::memory_order_relaxed);
+            for (Array* a : retired) delete a;
+        }
+
+        /// Insert value at the bottom ... owner only
+        void push(T value) {
+            std::int64_t b = bottom.load(std::memory_order_relaxed);
+            std::int64_t t = top.load(std::memory_order_acquire);
+            Array* a = array.load(std::memory_order_relaxed);
+            if (b - t > a->size - 1) a = grow(a, b, t);
+            a->put(b, value);
+            std::atomic_thread_fence(std::memory_order_release);
+            bottom.store(b+1, std::memory_order_relaxed);
+            npush.store(npush.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);  // single writer, no RMW needed
+        }
+
+        /// Remove the most recently pushed value ... owner only; returns false if empty
+        bool pop(T& value) {
+            std::int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+            Array* a = array.load(std::memory_order_relaxed);
+            bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            std::int64_t t = top.load(std::memory_order_relaxed);
+
+            if (t > b) { // Empty
+                bottom.store(b+1, std::memory_order_relaxed);
+                return false;
+            }
+            value = a->get(b);
+            if (t == b) { // Last element ... race against thieves
+                const bool won = top.compare_exchange_strong(t, t+1,
+                                                             std::memory_order_seq_cst,
+                                                             std::memory_order_relaxed);
+                bottom.store(b+1, std::memory_order_relaxed);
+                return won;
+            }
+            return true;
+        }
+
+        /// Remove the oldest value ... any thread; returns false if empty or lost a race
+        bool steal(T& value) {
+            std::int64_t t = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            std::int64_t b = bottom.load(std::memory_order_acquire);
+            if (t >= b) return false;
+
+            Array* a = array.load(std::memory_order_acquire);
+            T v = a->get(t);
+            if (!top.compare_exchange_strong(t, t+1,
+                                             std::memory_order_seq_cst,
+                                             std::memory_order_relaxed))
+                return false;
+            value = v;
+            nsteal.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        /// Approximate number of entries (exact when called by a quiescent owner)
+        std::size_t size() const {
+            const std::int64_t n = bottom.load(std::memory_order_relaxed) -
+                top.load(std::memory_order_relaxed);
+            return n > 0 ? std::size_t(n) : 0;
+        }
+
+        bool empty() const { return size() == 0; }
+
+        /// Number of values pushed by the owner
+        std::uint64_t get_npush() const { return npush.load(std::memory_order_relaxed); }
+
+        /// Number of values taken by thieves
+        std::uint64_t get_nsteal() const {
+            return nsteal.load(std::memory_order_relaxed);
+        }
+    };
+
+}  // namespace madness
+
+#endif // MADNESS_WORLD_WSDEQUE_H__INCLUDED